@@ -43,6 +43,10 @@
 /*********************
  *      DEFINES
  *********************/
+// The game list only has this number of buttons, they are rebound to the games while scrolling.
+#define GAME_LIST_POOL  8
+// Games read at once from the index of the SD card.
+#define GAME_LIST_PAGE  32
 
 
 /**********************
@@ -61,11 +65,16 @@ static void game_execute_cb(lv_obj_t * parent, lv_event_t e);
 static void game_menu_cb(lv_obj_t * parent, lv_event_t e);
 static void msgbox_no_game_cb(lv_obj_t * msgbox, lv_event_t e);
 static void game_list_cb(lv_obj_t * parent, lv_event_t e);
+static void game_list_create(uint16_t games_num);
+static void game_list_bind();
+static const char * game_list_name(uint16_t index);
+static lv_res_t game_list_signal(lv_obj_t * list, lv_signal_t sign, void * param);
 
 // On game menu
 static void on_game_menu();
 static void slider_volume_cb(lv_obj_t * slider, lv_event_t e);
 static void slider_brightness_cb(lv_obj_t * slider, lv_event_t e);
+static void slider_run_ahead_cb(lv_obj_t * slider, lv_event_t e);
 static void list_game_menu_cb(lv_obj_t * parent, lv_event_t e);
 
 // External app menu
@@ -137,6 +146,7 @@ static lv_obj_t * list_emulators_main;
 static lv_obj_t * btn_emulator_lib;
 static lv_obj_t * container_header_game_icon;
 static lv_obj_t * list_game_emulator;
+static lv_obj_t * game_list_btn[GAME_LIST_POOL];
 static lv_obj_t * list_game_options;
 static lv_obj_t * mbox_game_options;
 
@@ -145,6 +155,10 @@ static lv_obj_t * mbox_game_options;
 static lv_obj_t * list_on_game;
 static lv_obj_t * mbox_volume;
 static lv_obj_t * mbox_brightness;
+static lv_obj_t * mbox_run_ahead;
+
+// Frames of run-ahead chosen on the menu, main applies them to each game started.
+static uint8_t run_ahead_frames = 0;
 
 // External app menu objects
 
@@ -163,6 +177,16 @@ static lv_obj_t * mbox_color;
 
 static const char *TAG = "GUI_frontend";
 
+// Virtual game list state
+static lv_signal_cb_t game_list_ancestor_signal;
+static uint16_t game_list_total = 0;    // Games of the console.
+static uint16_t game_list_used = 0;     // Buttons of the pool in use.
+static uint16_t game_list_first = 0;    // Game shown on the first button.
+static uint16_t game_list_selected = 0; // Focused game.
+static sd_game_t game_list_page[GAME_LIST_PAGE];
+static uint16_t game_list_page_first = 0;
+static uint16_t game_list_page_count = 0;
+
 /**********************
  *   GLOBAL FUNCTIONS
  **********************/
@@ -318,6 +342,12 @@ static void on_game_menu(){
     list_btn = lv_list_add_btn(list_on_game, LV_SYMBOL_IMAGE, "Brightness");
     lv_obj_set_event_cb(list_btn, list_game_menu_cb);
 
+    // Only the GameBoy and Sega emulators can run ahead.
+    if(emulator_selected != NES && emulator_selected != SNES){
+        list_btn = lv_list_add_btn(list_on_game, LV_SYMBOL_NEXT, "Run-ahead");
+        lv_obj_set_event_cb(list_btn, list_game_menu_cb);
+    }
+
     list_btn = lv_list_add_btn(list_on_game, LV_SYMBOL_CLOSE, "Exit");
     lv_obj_set_event_cb(list_btn, list_game_menu_cb);
 
@@ -460,28 +490,14 @@ static void game_list_cb(lv_obj_t * parent, lv_event_t e){
             ESP_LOGI(TAG,"Selected Sega Game Gear");
         }
 
-        // Get the game list of each console.
-        char game_name[30][100];
-        uint8_t games_num = sd_game_list(game_name, emulator_selected);
+        // Refresh the game index of each console, the list reads it by pages.
+        uint16_t games_num = sd_game_count(emulator_selected);
 
         ESP_LOGI(TAG,"Found %i games",games_num);
 
         // Print the list of games or show a message is any game is available
         if(games_num>0){
-            list_game_emulator = lv_list_create(lv_layer_top(), NULL);
-            lv_obj_set_size(list_game_emulator, 210, 200);
-            lv_obj_align(list_game_emulator, NULL, LV_ALIGN_CENTER, 0, 23);
-            //lv_obj_set_event_cb(list_game_emulator, emulator_list_event);
-            lv_page_glue_obj(list_game_emulator,true);
-            // Add a button for each game
-            for(int i=0;i<games_num;i++){
-                lv_obj_t * game_btn = lv_list_add_btn(list_game_emulator, NULL, game_name[i]);
-                lv_group_add_obj(group_interact, game_btn);
-                lv_obj_set_event_cb(game_btn, game_menu_cb);
-            }
-            lv_group_add_obj(group_interact, list_game_emulator);
-
-            lv_group_focus_obj(list_game_emulator);
+            game_list_create(games_num);
         }
         else{
             lv_obj_del(container_header_game_icon);
@@ -514,6 +530,81 @@ static void game_list_cb(lv_obj_t * parent, lv_event_t e){
     }
 }
 
+/* Function: game_list_create
+ * ---------------------
+ * Create the game list with a fixed pool of buttons, the up and down keys
+ * move a window over the games and rebind the buttons, so the LVGL memory
+ * doesn't depend on the number of games.
+ */
+static void game_list_create(uint16_t games_num){
+    game_list_total = games_num;
+    game_list_used = games_num < GAME_LIST_POOL ? games_num : GAME_LIST_POOL;
+    game_list_first = 0;
+    game_list_selected = 0;
+    game_list_page_count = 0;
+
+    list_game_emulator = lv_list_create(lv_layer_top(), NULL);
+    lv_obj_set_size(list_game_emulator, 210, 200);
+    lv_obj_align(list_game_emulator, NULL, LV_ALIGN_CENTER, 0, 23);
+    lv_obj_set_event_cb(list_game_emulator, game_menu_cb);
+    lv_page_glue_obj(list_game_emulator,true);
+
+    for(int i=0;i<game_list_used;i++){
+        game_list_btn[i] = lv_list_add_btn(list_game_emulator, NULL, "");
+        lv_obj_set_event_cb(game_list_btn[i], game_menu_cb);
+    }
+    game_list_bind();
+
+    // The list handles the up and down keys itself to move the window.
+    game_list_ancestor_signal = lv_obj_get_signal_cb(list_game_emulator);
+    lv_obj_set_signal_cb(list_game_emulator, game_list_signal);
+
+    lv_group_add_obj(group_interact, list_game_emulator);
+    lv_group_focus_obj(list_game_emulator);
+    lv_list_focus_btn(list_game_emulator, game_list_btn[0]);
+}
+
+static void game_list_bind(){
+    for(int i=0;i<game_list_used;i++){
+        lv_label_set_text(lv_list_get_btn_label(game_list_btn[i]), game_list_name(game_list_first + i));
+    }
+}
+
+static const char * game_list_name(uint16_t index){
+    if(index < game_list_page_first || index >= game_list_page_first + game_list_page_count){
+        game_list_page_first = index - (index % GAME_LIST_PAGE);
+        game_list_page_count = sd_game_read(emulator_selected, game_list_page_first, GAME_LIST_PAGE, game_list_page);
+        if(index >= game_list_page_first + game_list_page_count) return "";
+    }
+    return game_list_page[index - game_list_page_first].name;
+}
+
+static lv_res_t game_list_signal(lv_obj_t * list, lv_signal_t sign, void * param){
+    if(sign == LV_SIGNAL_CONTROL){
+        uint32_t key = *((uint32_t *)param);
+
+        if(key == LV_KEY_DOWN || key == LV_KEY_UP){
+            if(key == LV_KEY_DOWN && game_list_selected + 1 < game_list_total) game_list_selected++;
+            else if(key == LV_KEY_UP && game_list_selected > 0) game_list_selected--;
+
+            // Move the window when the focus goes out of it.
+            if(game_list_selected < game_list_first){
+                game_list_first = game_list_selected;
+                game_list_bind();
+            }
+            else if(game_list_selected >= game_list_first + game_list_used){
+                game_list_first = game_list_selected - game_list_used + 1;
+                game_list_bind();
+            }
+
+            lv_list_focus_btn(list, game_list_btn[game_list_selected - game_list_first]);
+            return LV_RES_OK;
+        }
+    }
+
+    return game_list_ancestor_signal(list, sign, param);
+}
+
 static void msgbox_no_game_cb(lv_obj_t * msgbox, lv_event_t e){
     // Delete the message of no games
     if(e == LV_EVENT_CLICKED) {
@@ -562,6 +653,9 @@ static void emulators_list_cb(lv_obj_t * parent, lv_event_t e){
 }
 
 static void game_menu_cb(lv_obj_t * parent, lv_event_t e){
+    // The list only handles the cancel, the clicks are forwarded to its focused button.
+    if(parent == list_game_emulator && e != LV_EVENT_CANCEL) return;
+
     if(e == LV_EVENT_CLICKED) {
        /* ESP_LOGI(TAG, "Loading: %s",(char *)lv_list_get_btn_text(parent));
 
@@ -613,9 +707,12 @@ static void game_menu_cb(lv_obj_t * parent, lv_event_t e){
 
     }
     else if(e == LV_EVENT_CANCEL  ){
+        if(list_game_emulator == NULL) return;
+
         // Delete the list of games and the header icon
         lv_obj_del(container_header_game_icon);
         lv_obj_del(list_game_emulator);
+        list_game_emulator = NULL;
         lv_obj_set_hidden(list_emulators_main,false);
         lv_group_focus_obj(list_emulators_main);
         printf("foo\r\n");
@@ -702,6 +799,25 @@ static void slider_brightness_cb(lv_obj_t * slider, lv_event_t e){
     }
 }
 
+static void slider_run_ahead_cb(lv_obj_t * slider, lv_event_t e){
+    if(e == LV_EVENT_VALUE_CHANGED) {
+        struct SYSTEM_MODE emulator;
+
+        run_ahead_frames = lv_slider_get_value(slider);
+        ESP_LOGI(TAG, "Run-ahead set: %i",run_ahead_frames);
+
+        emulator.mode = MODE_CHANGE_RUN_AHEAD;
+        emulator.run_ahead_frames = run_ahead_frames;
+
+        if( xQueueSend( modeQueue,&emulator, ( TickType_t ) 10) != pdPASS ){
+            ESP_LOGE(TAG,"modeQueue send error");
+        }
+    }
+    else if(e == LV_EVENT_CANCEL){
+        lv_obj_del(mbox_run_ahead);
+    }
+}
+
 static void list_game_menu_cb(lv_obj_t * parent, lv_event_t e){
     if(e == LV_EVENT_CLICKED){
         struct SYSTEM_MODE emulator;
@@ -776,6 +892,29 @@ static void list_game_menu_cb(lv_obj_t * parent, lv_event_t e){
             lv_group_add_obj(group_interact, slider);
             lv_group_focus_obj(slider);
         }
+        else if(strcmp(lv_list_get_btn_text(parent),"Run-ahead")==0){
+            mbox_run_ahead = lv_msgbox_create(lv_layer_top(), NULL);
+            lv_msgbox_set_text(mbox_run_ahead, "Run-ahead frames");
+
+            lv_group_add_obj(group_interact, mbox_run_ahead);
+            lv_group_focus_obj(mbox_run_ahead);
+
+            lv_obj_set_style_local_bg_opa(lv_layer_top(), LV_OBJ_PART_MAIN, LV_STATE_DEFAULT, LV_OPA_70);
+            lv_obj_set_style_local_bg_color(lv_layer_top(), LV_OBJ_PART_MAIN, LV_STATE_DEFAULT, LV_COLOR_GRAY);
+            lv_obj_set_click(lv_layer_top(), true);
+
+            // Each frame removes one frame of input latency, 0 disables it.
+            lv_obj_t * slider = lv_slider_create(mbox_run_ahead, NULL);
+            lv_obj_align(slider, NULL, LV_ALIGN_CENTER, 0, 0);
+            lv_obj_set_width(slider, 180);
+            lv_slider_set_range(slider, 0, 3);
+            lv_slider_set_value(slider,run_ahead_frames,LV_ANIM_OFF);
+
+            lv_obj_set_event_cb(slider, slider_run_ahead_cb);
+
+            lv_group_add_obj(group_interact, slider);
+            lv_group_focus_obj(slider);
+        }
         else if(strcmp(lv_list_get_btn_text(parent),"Exit")==0){
 
             emulator.mode = MODE_OUT;
@@ -11,6 +11,13 @@
 #include "esp_system.h"
 #include "esp_ota_ops.h"
 
+#include "sd_storage.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define APP_BLOCK_SIZE (16*1024)
+
 
 /**********************
 *  STATIC VARIABLES
@@ -71,23 +78,21 @@ void external_app_init(const char *app_name){
         return -1;
     }
 
-    FILE *fd = NULL;
-
     char name_aux[256];
     sprintf(name_aux,"/sdcard/apps/%s",app_name);
 
-    fd = fopen(name_aux, "rb");
-    if(fd == NULL){
+    // The next block is read from the SD card while the current one is written to flash.
+    sd_stream_t *stream = sd_stream_open(name_aux, 0, APP_BLOCK_SIZE);
+    if(stream == NULL){
         ESP_LOGE(TAG,"Opening error with: %s",name_aux);
         return -1;
     }
 
-    static char write_buffer[512 + 1] = { 0 };
+    const uint8_t *block;
+    size_t data_read;
     int binary_file_length = 0;
-    while(1){
-        size_t data_read = fread(write_buffer, 1, 512, fd);
-
-        err = esp_ota_write( update_handle, (const void *)write_buffer, data_read);
+    while((block = sd_stream_read(stream, &data_read)) != NULL){
+        err = esp_ota_write( update_handle, (const void *)block, data_read);
         if (err != ESP_OK) {
             ESP_LOGE(TAG,"OTA write error");
         }
@@ -95,10 +100,10 @@ void external_app_init(const char *app_name){
         binary_file_length += data_read;
 
         ESP_LOGI(TAG, "Written image length %d", binary_file_length);
-
-        if(data_read < 512) break;
     }
 
+    sd_stream_close(stream);
+
     ESP_LOGI(TAG, "OTA Write correct");
 
     err = esp_ota_end(update_handle);
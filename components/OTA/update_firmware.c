@@ -12,6 +12,13 @@
 #include "esp_system.h"
 #include "esp_ota_ops.h"
 
+#include "sd_storage.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define UPDATE_BLOCK_SIZE (16*1024)
+
 /**********************
 *  STATIC VARIABLES
 **********************/
@@ -47,7 +54,6 @@ int update_init(char *fw_name){
     esp_app_desc_t update_fw;
     esp_app_desc_t invalid_fw;
 
-    static char temp_buffer[1024];
     uint32_t update_size = 0;
 
 
@@ -84,26 +90,21 @@ int update_init(char *fw_name){
     }
 
 
-    //Open the new fw file
+    //Open the new fw file, the next block is read while the current one is written to the OTA partition.
     char name_aux[256];
     sprintf(name_aux,"/sdcard/%s",fw_name);
-    FILE *fd = fopen(name_aux, "rb");
-    if(fd == NULL){
+    sd_stream_t *stream = sd_stream_open(name_aux, 0, UPDATE_BLOCK_SIZE);
+    if(stream == NULL){
         ESP_LOGE(TAG,"Opening error with: %s",name_aux);
         return -1;
     }
 
-    err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &update_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
-        return -1;
-    }
-
-    // Check the header to know if it's a valid version of the firmware
-    size_t data_header = fread(temp_buffer, 1, 1024, fd);
+    // Check the header of the first block to know if it's a valid version of the firmware
+    size_t data_read = 0;
+    const uint8_t *block = sd_stream_read(stream, &data_read);
 
-    if(data_header > sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)){
-        memcpy(&update_fw, &temp_buffer[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], sizeof(esp_app_desc_t));
+    if(data_read > sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)){
+        memcpy(&update_fw, &block[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], sizeof(esp_app_desc_t));
 
         // Check if you're triying to flash the same firmware
         if(!memcmp(update_fw.version,running_fw.version,sizeof(running_fw.version))){
@@ -115,33 +116,35 @@ int update_init(char *fw_name){
         if(last_invalid_app != NULL){
             if (!memcmp(invalid_app_info.version, update_fw.version, sizeof(update_fw.version))) {
                 ESP_LOGE(TAG,"New firmware is the same previous invalid version");
+                sd_stream_close(stream);
                 return -1;
             }
         }
     }
 
-    fseek(fd, 0, SEEK_SET);
-    memset(temp_buffer,0,sizeof(temp_buffer));
+    err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &update_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
+        sd_stream_close(stream);
+        return -1;
+    }
 
     // The update is fine, so we will copy the new FW from the SD card to the OTA partition
-    while(1){
-        size_t data_read = fread(temp_buffer, 1, 1024, fd);
-
-        err = esp_ota_write( update_handle, (const void *)temp_buffer, data_read);
+    while(block != NULL){
+        err = esp_ota_write( update_handle, (const void *)block, data_read);
         if (err != ESP_OK) {
             ESP_LOGE(TAG,"OTA write error");
+            sd_stream_close(stream);
             return -1;
         }
 
-
         update_size += data_read;
         ESP_LOGI(TAG, "Written to OTA: %d",update_size);
 
-        if(data_read < 1024) break;
-
+        block = sd_stream_read(stream, &data_read);
     }
 
-    fclose(fd);
+    sd_stream_close(stream);
 
     ESP_LOGI(TAG, "Update process succed!");
 
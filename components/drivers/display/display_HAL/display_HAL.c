@@ -20,6 +20,7 @@
 #endif
 #include "display_HAL.h"
 #include "system_configuration.h"
+#include "profiler.h"
 
 /*********************
  *      DEFINES
@@ -80,7 +81,7 @@ static const char *TAG = "Display_HAL";
 *  STATIC PROTOTYPES
 **********************/
 static uint16_t getPixelGBC(const uint16_t *bufs, uint16_t x, uint16_t y, uint16_t w2, uint16_t h2);
-static uint8_t getPixelSMS(const uint8_t *bufs, uint16_t x, uint16_t y, uint16_t w2, uint16_t h2, bool GAME_GEAR);
+static uint8_t getPixelSMS(const uint8_t *bufs, uint16_t x, uint16_t y, uint16_t w2, uint16_t h2);
 static uint8_t getPixelNES(const uint8_t *bufs, uint16_t x, uint16_t y, uint16_t w2, uint16_t h2);
 
 /**********************
@@ -200,6 +201,8 @@ void display_HAL_gb_frame(const uint16_t *data)
         short outputWidth = 240;
         short xpos = (SCR_WIDTH - outputWidth) / 2;
 
+        // The display lines sent inside are counted on their own phase.
+        PROFILER_BEGIN();
         for (int y = 0; y < outputHeight; y += LINE_COUNT)
         {
             for (int i = 0; i < LINE_COUNT; ++i)
@@ -216,15 +219,22 @@ void display_HAL_gb_frame(const uint16_t *data)
                 }
             }
 
+#if PROFILER
+            if (y == 0)
+                profiler_overlay(display.current_buffer, outputWidth, LINE_COUNT);
+#endif
             sending_line = calc_line;
             calc_line = (calc_line == 1) ? 0 : 1;
 // ST7789_swap_buffers(&display);
+            PROFILER_BEGIN();
 #if USE_ILI9341
             ILI9341_write_lines(&display, y, xpos, outputWidth, line[sending_line], LINE_COUNT);
 #else
             ST7789_write_lines(&display, y, xpos, outputWidth, line[sending_line], LINE_COUNT);
 #endif
+            PROFILER_END(PROFILER_SPI);
         }
+        PROFILER_END(PROFILER_SCALER);
     }
 }
 
@@ -258,6 +268,8 @@ void display_HAL_NES_frame(const uint8_t *data)
         short outputWidth = 240 + (240 - 240);
         short xpos = (240 - outputWidth) / 2;
 
+        // The display lines sent inside are counted on their own phase.
+        PROFILER_BEGIN();
         for (int y = 0; y < outputHeight; y += LINE_COUNT)
         {
             for (int i = 0; i < LINE_COUNT; ++i)
@@ -273,18 +285,25 @@ void display_HAL_NES_frame(const uint8_t *data)
                 }
             }
 
+#if PROFILER
+            if (y == 0)
+                profiler_overlay(display.current_buffer, outputWidth, LINE_COUNT);
+#endif
             sending_line = calc_line;
             calc_line = (calc_line == 1) ? 0 : 1;
+            PROFILER_BEGIN();
 #if USE_ILI9341
             ILI9341_write_lines(&display, y, xpos, outputWidth, line[sending_line], LINE_COUNT);
 #else
             ST7789_write_lines(&display, y, xpos, outputWidth, line[sending_line], LINE_COUNT);
 #endif
+            PROFILER_END(PROFILER_SPI);
         }
+        PROFILER_END(PROFILER_SCALER);
     }
 }
 
-void display_HAL_SMS_frame(const uint8_t *data, uint16_t color[], bool GAMEGEAR)
+void display_HAL_SMS_frame(const uint8_t *data, uint16_t color[])
 {
     uint16_t sending_line = 0;
     uint16_t calc_line = 0;
@@ -314,6 +333,8 @@ void display_HAL_SMS_frame(const uint8_t *data, uint16_t color[], bool GAMEGEAR)
         short outputWidth = SCR_WIDTH;
         short xpos = (SCR_WIDTH - outputWidth) / 2;
 
+        // The display lines sent inside are counted on their own phase.
+        PROFILER_BEGIN();
         for (int y = 0; y < outputHeight; y += LINE_COUNT)
         {
             for (int i = 0; i < LINE_COUNT; ++i)
@@ -326,35 +347,107 @@ void display_HAL_SMS_frame(const uint8_t *data, uint16_t color[], bool GAMEGEAR)
                 for (int x = 0; x < outputWidth; ++x)
                 {
                     //uint16_t sample = color[getPixelSms(data, x, (y + i), outputWidth, outputHeight)];
-                    uint16_t sample = color[getPixelSMS(data, x, (y + i), outputWidth, outputHeight, GAMEGEAR) & PIXEL_MASK];
+                    uint16_t sample = color[getPixelSMS(data, x, (y + i), outputWidth, outputHeight) & PIXEL_MASK];
                     display.current_buffer[index++] = ((sample >> 8) | ((sample) << 8));
                     //line[calc_line][index++] = color[getPixelSms(data, x, (y + i), outputWidth, outputHeight)];
                 }
             }
+#if PROFILER
+            if (y == 0)
+                profiler_overlay(display.current_buffer, outputWidth, LINE_COUNT);
+#endif
             sending_line = calc_line;
             calc_line = (calc_line == 1) ? 0 : 1;
+            PROFILER_BEGIN();
 #if USE_ILI9341
             ILI9341_write_lines(&display, y, xpos, outputWidth, line[sending_line], LINE_COUNT);
 #else
             ST7789_write_lines(&display, y, xpos, outputWidth, line[sending_line], LINE_COUNT);
 #endif
+            PROFILER_END(PROFILER_SPI);
+        }
+        PROFILER_END(PROFILER_SCALER);
+    }
+}
+
+void display_HAL_GG_frame(const uint8_t *data, uint16_t color[])
+{
+    uint16_t sending_line = 0;
+    uint16_t calc_line = 0;
+    uint16_t palette[PIXEL_MASK + 1];
+
+    if (data == NULL)
+    {
+        display_HAL_SMS_frame(NULL, NULL);
+        return;
+    }
+
+    // Byte swap the palette once per frame instead of once per pixel.
+    for (int i = 0; i <= PIXEL_MASK; ++i)
+    {
+        palette[i] = (color[i] >> 8) | (color[i] << 8);
+    }
+
+    short outputHeight = SCR_HEIGHT;
+    short outputWidth = SCR_WIDTH;
+
+    PROFILER_BEGIN();
+    for (int y = 0; y < outputHeight; y += LINE_COUNT)
+    {
+        for (int i = 0; i < LINE_COUNT; ++i)
+        {
+            if ((y + i) >= outputHeight)
+                break;
+
+            // 144 -> 240 lines: each source line is shown on 5/3 output lines.
+            int src_line = ((y + i) * GG_FRAME_HEIGHT) / outputHeight;
+            uint16_t *dst = &display.current_buffer[i * outputWidth];
+
+            if (i > 0 && src_line == (((y + i - 1) * GG_FRAME_HEIGHT) / outputHeight))
+            {
+                memcpy(dst, dst - outputWidth, outputWidth * sizeof(uint16_t));
+                continue;
+            }
+
+            // 160 -> 240 columns: every 2 source pixels become 3.
+            const uint8_t *src = &data[src_line * GG_FRAME_WIDTH];
+
+            for (int x = 0; x < GG_FRAME_WIDTH; x += 2)
+            {
+                uint16_t a = palette[src[x] & PIXEL_MASK];
+                uint16_t b = palette[src[x + 1] & PIXEL_MASK];
+
+                *dst++ = a;
+                *dst++ = a;
+                *dst++ = b;
+            }
         }
+
+#if PROFILER
+        if (y == 0)
+            profiler_overlay(display.current_buffer, outputWidth, LINE_COUNT);
+#endif
+        sending_line = calc_line;
+        calc_line = (calc_line == 1) ? 0 : 1;
+        PROFILER_BEGIN();
+#if USE_ILI9341
+        ILI9341_write_lines(&display, y, 0, outputWidth, line[sending_line], LINE_COUNT);
+#else
+        ST7789_write_lines(&display, y, 0, outputWidth, line[sending_line], LINE_COUNT);
+#endif
+        PROFILER_END(PROFILER_SPI);
     }
+    PROFILER_END(PROFILER_SCALER);
 }
 
 /**********************
  *   STATIC FUNCTIONS
  **********************/
 
-static uint8_t getPixelSMS(const uint8_t *bufs, uint16_t x, uint16_t y, uint16_t w2, uint16_t h2, bool GAME_GEAR)
+static uint8_t getPixelSMS(const uint8_t *bufs, uint16_t x, uint16_t y, uint16_t w2, uint16_t h2)
 {
     uint16_t frame_width = SMS_FRAME_WIDTH;
     uint16_t frame_height = SMS_FRAME_HEIGHT;
-    if (GAME_GEAR)
-    {
-        frame_width = GG_FRAME_WIDTH;
-        frame_height = GG_FRAME_HEIGHT;
-    }
 
     int x_diff, y_diff, xv, yv, red, green, blue, col, a, b, c, d, index;
     int x_ratio = (int)((((frame_width)-1) << 16) / w2) + 1;
@@ -366,14 +459,7 @@ static uint8_t getPixelSMS(const uint8_t *bufs, uint16_t x, uint16_t y, uint16_t
     x_diff = ((x_ratio * x) >> 16) - (xv);
     y_diff = ((y_ratio * y) >> 16) - (yv);
 
-    if (GAME_GEAR)
-    {
-        index = yv * 256 + xv + 48;
-    }
-    else
-    {
-        index = yv * frame_width + xv;
-    }
+    index = yv * frame_width + xv;
 
     a = bufs[index];
     b = bufs[index + 1];
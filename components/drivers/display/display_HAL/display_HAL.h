@@ -91,14 +91,29 @@ void display_HAL_NES_frame(const uint8_t *data);
  * information to the screen driver.
  * 
  * Arguments:
- *  - data: Frame data of the Sega Master System or Game Gear emulator, without color.
+ *  - data: 256x192 frame data of the Sega Master System emulator, without color.
  *  - color: Color to apply to each frame.
- *  - GAMEGEAR: Set to true if you want to create a Game Gear frame, otherwise for Master System set to false
  * 
  * Returns: Nothing
  * 
  */
-void display_HAL_SMS_frame(const uint8_t *data, uint16_t color[], bool GAMEGEAR);
+void display_HAL_SMS_frame(const uint8_t *data, uint16_t color[]);
+
+/*
+ * Function:  display_HAL_GG_frame 
+ * --------------------
+ * 
+ * Scale the 160x144 Game Gear viewport to the screen, every 2 pixels become 3 horizontally
+ * and every 3 lines become 5 vertically, and send it to the screen driver.
+ * 
+ * Arguments:
+ *  - data: 160x144 frame data of the Game Gear emulator, without color.
+ *  - color: Color to apply to each frame.
+ * 
+ * Returns: Nothing
+ * 
+ */
+void display_HAL_GG_frame(const uint8_t *data, uint16_t color[]);
 
 /*
  * Function:  display_HAL_get_buffer 
@@ -3,16 +3,29 @@
  *********************/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_vfs_fat.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "esp32/rom/crc.h"
+#include "soc/soc_memory_layout.h"
 
 #include "driver/sdmmc_host.h"
 #include "driver/sdspi_host.h"
@@ -29,6 +42,96 @@
 #define MOUNT_POINT     "/sdcard"
 #define SPI_DMA_CHAN    2
 
+// Files are read in blocks of this size, the SD driver turns each one into a multi-sector transfer.
+#define READ_BLOCK_SIZE (32*1024)
+
+// Signature of a valid ROM cache header on the flash partition, "ROMC".
+#define ROM_CACHE_MAGIC 0x524F4D43
+
+// Index of the games of each console, kept on its folder, "GLIB".
+#define LIBRARY_FILE    ".library"
+#define LIBRARY_MAGIC   0x42494C47
+#define LIBRARY_VERSION 1
+
+// A stream keeps one block for the consumer while the reader task fills the other one.
+#define STREAM_BUFFERS  2
+
+// Header of the save data files, "SAVD".
+#define SAVE_MAGIC      0x44564153
+#define SAVE_VERSION    1
+// Saves waiting for the writer task, a new save is dropped while it's full.
+#define SAVE_QUEUE_LEN  2
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t signature; // CRC32 of the file names in directory order, it changes with the directory.
+}sd_library_header_t;
+
+typedef struct{
+    int8_t index;   // Buffer holding the data, -1 marks the end of the file.
+    size_t length;
+}sd_block_t;
+
+// Stored on the last sector of the data partition, it identifies the ROM cached on it.
+// Written only after the whole ROM was copied, so a valid header means a complete copy.
+typedef struct{
+    uint32_t magic;
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t head_crc;  // CRC32 of the first block of the file.
+}rom_cache_header_t;
+
+typedef struct{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t size;
+    uint32_t crc;       // CRC32 of the data after the header.
+}sd_save_header_t;
+
+typedef struct{
+    char *path;
+    uint8_t *data;
+    size_t size;
+}sd_save_job_t;
+
+struct sd_stream{
+    int fd;
+    size_t block_size;
+    uint8_t *buffer[STREAM_BUFFERS];
+    QueueHandle_t free_queue;   // Buffers ready to be filled by the reader task.
+    QueueHandle_t ready_queue;  // Blocks ready to be used by the consumer.
+    int8_t current;             // Buffer held by the consumer, -1 if none.
+    volatile bool stop;
+    bool eof;
+};
+
+struct sd_bank_cache{
+    int fd;
+    size_t bank_size;
+    uint16_t banks;             // Number of banks of the file.
+    uint16_t slots;             // Number of banks kept on memory.
+    uint8_t *data;              // Memory of all the slots.
+    int16_t *slot_bank;         // Bank on each slot, -1 if it's empty.
+    uint32_t *slot_used;        // Last use of each slot, the lowest one is replaced.
+    int16_t *bank_slot;         // Slot of each bank, -1 if it isn't on memory.
+    uint32_t tick;
+    SemaphoreHandle_t lock;     // Protects the slots between the emulator and the prefetch task.
+    SemaphoreHandle_t file_lock;// Protects the file, the prefetch task reads it without the slots locked.
+    SemaphoreHandle_t loaded;   // Given by the prefetch task when a bank the emulator is waiting for is ready.
+    int16_t loading_bank;       // Bank read by the prefetch task, -1 if none.
+    int16_t loading_slot;       // Slot reserved for it, never replaced while it's read.
+    bool waiting;               // The emulator waits for the bank of the prefetch task.
+    QueueHandle_t prefetch_queue;
+    TaskHandle_t prefetch_task;
+    sd_bank_stats_t stats;
+};
+
 
 /**********************
 *      VARIABLES
@@ -40,6 +143,31 @@ struct sd_card_info sd_card_info;
 *  STATIC VARIABLES
 **********************/
 static const char *TAG = "SD_CARD";
+static spi_flash_mmap_handle_t rom_cache_map = 0;
+static QueueHandle_t save_queue = NULL;
+static volatile uint8_t save_pending = 0;     // Saves queued or being written.
+static portMUX_TYPE save_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**********************
+ *  STATIC PROTOTYPES
+ **********************/
+static const char * sd_console_dir(uint8_t console);
+static bool sd_game_match(const char *name, uint8_t console);
+static sd_game_t * sd_library_alloc(uint16_t count);
+static uint16_t sd_library_refresh(uint8_t console);
+static int sd_game_compare(const void *a, const void *b);
+static void sd_game_info(const char *path, uint8_t console, sd_game_t *game);
+static size_t sd_read_file(const char *path, size_t offset, uint8_t *data, size_t size);
+static void sd_stream_task(void *arg);
+static void sd_stream_free(sd_stream_t *stream);
+static int16_t sd_bank_reserve(sd_bank_cache_t *cache);
+static void sd_bank_read(sd_bank_cache_t *cache, uint16_t bank, int16_t slot);
+static int16_t sd_bank_load(sd_bank_cache_t *cache, uint16_t bank);
+static void sd_bank_prefetch_task(void *arg);
+static void sd_bank_cache_free(sd_bank_cache_t *cache);
+static void sd_save_task(void *arg);
+static bool sd_save_file(const char *path, const uint8_t *data, size_t size);
+static uint8_t * sd_save_check(const char *path, size_t *size, bool legacy);
 
 /**********************
  *      MACROS
@@ -71,10 +199,10 @@ bool sd_init(){
     slot_config.width = 1;
 #endif
 
-    // Mount Fat filesystem(Only one file at the time)
+    // Mount Fat filesystem, the ROM bank cache and the save writer keep their files open while the game runs.
     esp_vfs_fat_sdmmc_mount_config_t mount_config = {
         .format_if_mount_failed = false,
-        .max_files = 1,
+        .max_files = 3,
         .allocation_unit_size = 16 * 1024
     };
    
@@ -149,63 +277,86 @@ bool sd_init(){
 }
 
 
-uint8_t sd_game_list(char game_name[30][100],uint8_t console){
-    
+uint16_t sd_game_count(uint8_t console){
+    const char *dir_path = sd_console_dir(console);
+    char path[300];
     struct dirent *entry;
-    //TODO: Improve game name management, at this moment the max size of the name is 100 characters and 30 games per console
-    // Open the folder of the specific console
-    DIR *dir = NULL;
-    if(console == NES) dir =  opendir("/sdcard/NES");
-    else if(console == GAMEBOY) dir =  opendir("/sdcard/GameBoy");
-    else if(console == GAMEBOY_COLOR) dir =  opendir("/sdcard/GameBoy_Color");
-    else if(console == SNES) dir =  opendir("/sdcard/SNES");
-    else if(console == SMS) dir =  opendir("/sdcard/Master_System");
-    else if(console == GG) dir =  opendir("/sdcard/Game_Gear");
 
+    if(dir_path == NULL) return 0;
 
+    // Open the folder of the specific console
+    DIR *dir = opendir(dir_path);
     if (!dir) {
         ESP_LOGE(TAG, "Failed to stat dir : 0x%02x", console);
         return 0;
     }
-    
-    //Loop to find the game of each console base on the file extension
-    uint8_t i =0;
-    while((entry = readdir(dir)) != NULL){
- 
-        size_t nameLength = strlen(entry->d_name);
 
-        // TODO: Rework game list maker, set by alphabetical order
+    // Only the signature of the names is needed to know if the index is still valid.
+    uint16_t count = 0;
+    uint32_t signature = 0;
 
-        if ((strcmp(entry->d_name + (nameLength - 4), ".nes") == 0) && console == NES) {
-            sprintf(game_name[i],"%s",entry->d_name);
-            ESP_LOGI(TAG, "Found %s ",game_name[i]);
-            i++;
-        }
-        else if ((strcmp(entry->d_name + (nameLength - 3), ".gb") == 0) && console == GAMEBOY){
-            sprintf(game_name[i],"%s",entry->d_name);
-            ESP_LOGI(TAG, "Found %s ",game_name[i]);
-            i++;
-        }
-        else if ((strcmp(entry->d_name + (nameLength - 4), ".gbc") == 0) && console == GAMEBOY_COLOR){
-            sprintf(game_name[i],"%s",entry->d_name);
-            ESP_LOGI(TAG, "Found %s ",game_name[i]);
-            i++;
-        }
-        else if ((strcmp(entry->d_name + (nameLength - 4), ".sms") == 0) && console == SMS){
-            sprintf(game_name[i],"%s",entry->d_name);
-            ESP_LOGI(TAG, "Found %s ",game_name[i]);
-            i++;
+    while((entry = readdir(dir)) != NULL){
+        if(!sd_game_match(entry->d_name, console)) continue;
+
+        // The name is used to open the game, a truncated one wouldn't be found.
+        if(strlen(entry->d_name) >= sizeof(((sd_game_t *)0)->name)){
+            ESP_LOGW(TAG, "Name too long, %s not listed",entry->d_name);
+            continue;
         }
-        else if ((strcmp(entry->d_name + (nameLength - 3), ".gg") == 0) && console == GG){
-            sprintf(game_name[i],"%s",entry->d_name);
-            ESP_LOGI(TAG, "Found %s ",game_name[i]);
-            i++;
+
+        // The index can't hold more games, the refresh stops on the same one.
+        if(count == UINT16_MAX){
+            ESP_LOGW(TAG, "Too many games, only the first %i are listed",count);
+            break;
         }
+
+        signature = crc32_le(signature, (const uint8_t *)entry->d_name, strlen(entry->d_name) + 1);
+        count++;
     }
-    // Return the number of files
-    return i;
+    closedir(dir);
+
+    sprintf(path, "%s/%s", dir_path, LIBRARY_FILE);
+    sd_library_header_t header;
+    bool valid = false;
+
+    FILE *fd = fopen(path, "rb");
+    if(fd != NULL){
+        valid = fread(&header, sizeof(header), 1, fd) == 1 && header.magic == LIBRARY_MAGIC && header.version == LIBRARY_VERSION
+                && header.signature == signature && header.count == count;
+        fclose(fd);
+    }
+
+    if(valid){
+        // Nothing changed on the directory.
+        ESP_LOGI(TAG, "Found %i games on the index",count);
+        return count;
+    }
+
+    return sd_library_refresh(console);
 }
 
+uint16_t sd_game_read(uint8_t console, uint16_t first, uint16_t count, sd_game_t *games){
+    const char *dir_path = sd_console_dir(console);
+    sd_library_header_t header;
+    char path[300];
+    uint16_t r = 0;
+
+    if(dir_path == NULL) return 0;
+
+    sprintf(path, "%s/%s", dir_path, LIBRARY_FILE);
+    FILE *fd = fopen(path, "rb");
+    if(fd == NULL) return 0;
+
+    if(fread(&header, sizeof(header), 1, fd) == 1 && header.magic == LIBRARY_MAGIC && header.version == LIBRARY_VERSION
+       && first < header.count){
+        if(count > header.count - first) count = header.count - first;
+        if(fseek(fd, sizeof(header) + first * sizeof(sd_game_t), SEEK_SET) == 0) r = fread(games, sizeof(sd_game_t), count, fd);
+    }
+
+    fclose(fd);
+    return r;
+}
+
 uint8_t sd_app_list(char app_name[30][100],bool update){
     struct dirent *entry;
 
@@ -231,83 +382,405 @@ uint8_t sd_app_list(char app_name[30][100],bool update){
     
 
 size_t sd_file_size(const char *path){
-    
-    FILE *fd = fopen(path, "rb");
-
-    fseek(fd, 0, SEEK_END);
-    size_t actual_size = ftell(fd);
-    fseek(fd, 0, SEEK_SET);
+    struct stat st;
 
-    ESP_LOGI(TAG,"Size: %i bytes",actual_size);
-    fclose(fd);
+    if(stat(path, &st) != 0){
+        ESP_LOGE(TAG, "Error opening: %s ",path);
+        return 0;
+    }
 
-    return actual_size;
+    ESP_LOGI(TAG,"Size: %li bytes",st.st_size);
+    return st.st_size;
 }
 
 void sd_get_file (const char *path, void * data){
-    const size_t BLOCK_SIZE = 512;// We're going to read file in chunk of 512 Bytes
-    size_t r = 0;
+    sd_read_file(path, 0, data, sd_file_size(path));
+}
 
-    FILE *fd = fopen(path, "rb"); //Open the file in binary read mode
+void * sd_load_file(const char *path, size_t offset, size_t min_size, size_t *size){
+    int64_t start_time = esp_timer_get_time();
 
-    if(fd==NULL){
-       ESP_LOGE(TAG, "Error opening: %s ",path);
+    size_t file_size = sd_file_size(path);
+    if(file_size <= offset){
+        ESP_LOGE(TAG, "Nothing to load from: %s ",path);
+        return NULL;
     }
-    while (true){
-        //__asm__("memw"); // Protect the write into the RAM memory
-        size_t count = fread((uint8_t *)data + r, 1, BLOCK_SIZE, fd);
-       // __asm__("memw");
+    file_size -= offset;
 
-        r += count;
-        if (count < BLOCK_SIZE) break;
+    // Only the part after the offset is kept, padded up to the minimum size.
+    size_t alloc_size = file_size < min_size ? min_size : file_size;
+    uint8_t *data = malloc(alloc_size);
+    if(data == NULL){
+        ESP_LOGE(TAG, "Not enough memory to load %i bytes",alloc_size);
+        return NULL;
+    }
+
+    // The header is skipped without reading it.
+    size_t r = sd_read_file(path, offset, data, file_size);
+    if(r != file_size){
+        ESP_LOGE(TAG, "Error reading: %s (%i of %i bytes)",path,r,file_size);
+        free(data);
+        return NULL;
     }
 
-    fclose(fd);
+    if(alloc_size > file_size) memset(data + file_size, 0, alloc_size - file_size);
+
+    uint32_t elapsed = (esp_timer_get_time() - start_time) / 1000;
+    ESP_LOGI(TAG,"Loaded %i bytes in %u ms (%u KB/s)",file_size,elapsed,
+            elapsed ? (uint32_t)(file_size / elapsed) : 0);
+
+    if(size != NULL) *size = file_size;
+    return data;
+}
+
+sd_stream_t * sd_stream_open(const char *path, size_t offset, size_t block_size){
+    sd_stream_t *stream = calloc(1, sizeof(sd_stream_t));
+    if(stream == NULL) return NULL;
+
+    stream->block_size = block_size;
+    stream->current = -1;
+
+    stream->fd = open(path, O_RDONLY);
+    if(stream->fd < 0){
+        ESP_LOGE(TAG, "Error opening: %s ",path);
+        free(stream);
+        return NULL;
+    }
+
+    if(offset && lseek(stream->fd, offset, SEEK_SET) != offset){
+        ESP_LOGE(TAG, "Error seeking: %s ",path);
+        close(stream->fd);
+        free(stream);
+        return NULL;
+    }
+
+    for(int8_t i = 0; i < STREAM_BUFFERS; i++){
+        stream->buffer[i] = heap_caps_malloc(block_size, MALLOC_CAP_8BIT | MALLOC_CAP_DMA);
+        if(stream->buffer[i] == NULL){
+            ESP_LOGW(TAG,"Stream buffer %i not enough DMA memory for allocate. Allocating on regular memory.",i);
+            stream->buffer[i] = malloc(block_size);
+        }
+    }
+
+    stream->free_queue = xQueueCreate(STREAM_BUFFERS, sizeof(int8_t));
+    stream->ready_queue = xQueueCreate(STREAM_BUFFERS + 1, sizeof(sd_block_t));
+
+    if(stream->buffer[0] == NULL || stream->buffer[1] == NULL || stream->free_queue == NULL || stream->ready_queue == NULL){
+        ESP_LOGE(TAG, "Not enough memory to open a stream");
+        close(stream->fd);
+        sd_stream_free(stream);
+        return NULL;
+    }
+
+    for(int8_t i = 0; i < STREAM_BUFFERS; i++) xQueueSend(stream->free_queue, &i, 0);
+
+    // The reader runs above the consumer, so a read starts as soon as a buffer is released.
+    if(xTaskCreate(&sd_stream_task, "sd_stream", 2048, stream, uxTaskPriorityGet(NULL) + 1, NULL) != pdPASS){
+        ESP_LOGE(TAG, "Error creating the stream task");
+        close(stream->fd);
+        sd_stream_free(stream);
+        return NULL;
+    }
+
+    return stream;
+}
+
+const uint8_t * sd_stream_read(sd_stream_t *stream, size_t *length){
+    sd_block_t block;
+
+    // Hand the previous block back to the reader.
+    if(stream->current >= 0){
+        xQueueSend(stream->free_queue, &stream->current, portMAX_DELAY);
+        stream->current = -1;
+    }
+
+    *length = 0;
+    if(stream->eof) return NULL;
+
+    xQueueReceive(stream->ready_queue, &block, portMAX_DELAY);
+    if(block.index < 0){
+        stream->eof = true;
+        return NULL;
+    }
+
+    stream->current = block.index;
+    *length = block.length;
+    return stream->buffer[block.index];
+}
+
+void sd_stream_close(sd_stream_t *stream){
+    sd_block_t block;
+
+    if(stream == NULL) return;
+
+    stream->stop = true;
+    if(stream->current >= 0) xQueueSend(stream->free_queue, &stream->current, portMAX_DELAY);
+
+    // Wait for the reader task to finish, it always ends with an end of file block.
+    while(!stream->eof){
+        xQueueReceive(stream->ready_queue, &block, portMAX_DELAY);
+        if(block.index < 0) stream->eof = true;
+        else xQueueSend(stream->free_queue, &block.index, portMAX_DELAY);
+    }
+
+    sd_stream_free(stream);
+}
+
+sd_bank_cache_t * sd_bank_cache_open(const char *path, size_t bank_size, uint16_t slots){
+    size_t file_size = sd_file_size(path);
+    if(file_size == 0) return NULL;
+
+    sd_bank_cache_t *cache = calloc(1, sizeof(sd_bank_cache_t));
+    if(cache == NULL) return NULL;
+
+    cache->bank_size = bank_size;
+    cache->banks = (file_size + bank_size - 1) / bank_size;
+    cache->slots = slots < cache->banks ? slots : cache->banks;
+
+    cache->fd = open(path, O_RDONLY);
+    if(cache->fd < 0){
+        ESP_LOGE(TAG, "Error opening: %s ",path);
+        free(cache);
+        return NULL;
+    }
+
+    cache->data = heap_caps_malloc(cache->slots * bank_size, MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM);
+    if(cache->data == NULL){
+        ESP_LOGW(TAG,"Bank cache not enough PSRAM for allocate. Allocating on regular memory.");
+        cache->data = malloc(cache->slots * bank_size);
+    }
+    cache->slot_bank = malloc(cache->slots * sizeof(int16_t));
+    cache->slot_used = calloc(cache->slots, sizeof(uint32_t));
+    cache->bank_slot = malloc(cache->banks * sizeof(int16_t));
+    cache->lock = xSemaphoreCreateMutex();
+    cache->file_lock = xSemaphoreCreateMutex();
+    cache->loaded = xSemaphoreCreateBinary();
+    cache->prefetch_queue = xQueueCreate(4, sizeof(uint16_t));
+
+    if(cache->data == NULL || cache->slot_bank == NULL || cache->slot_used == NULL || cache->bank_slot == NULL
+       || cache->lock == NULL || cache->file_lock == NULL || cache->loaded == NULL || cache->prefetch_queue == NULL){
+        ESP_LOGE(TAG, "Not enough memory to open a bank cache");
+        sd_bank_cache_free(cache);
+        return NULL;
+    }
+
+    memset(cache->slot_bank, 0xff, cache->slots * sizeof(int16_t));
+    memset(cache->bank_slot, 0xff, cache->banks * sizeof(int16_t));
+    cache->loading_bank = -1;
+    cache->loading_slot = -1;
+
+    // The prefetch runs below the emulator, it only uses the SD card while the game is running from the cache.
+    if(xTaskCreate(&sd_bank_prefetch_task, "sd_prefetch", 2048, cache, 1, &cache->prefetch_task) != pdPASS){
+        ESP_LOGE(TAG, "Error creating the prefetch task");
+        sd_bank_cache_free(cache);
+        return NULL;
+    }
+
+    ESP_LOGI(TAG,"Bank cache of %i banks of %i bytes for %i banks",cache->slots,bank_size,cache->banks);
+    return cache;
+}
+
+uint8_t * sd_bank_cache_get(sd_bank_cache_t *cache, uint16_t bank){
+    // Out of range banks are mirrored, like on a real cartridge.
+    bank %= cache->banks;
+
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+
+    int16_t slot = cache->bank_slot[bank];
+    if(slot >= 0){
+        cache->stats.hits++;
+    }
+    else{
+        int64_t start_time = esp_timer_get_time();
+
+        // The prefetch task is already reading it, wait for it instead of reading it again.
+        while(cache->loading_bank == bank){
+            cache->waiting = true;
+            xSemaphoreGive(cache->lock);
+            xSemaphoreTake(cache->loaded, portMAX_DELAY);
+            xSemaphoreTake(cache->lock, portMAX_DELAY);
+        }
+
+        slot = cache->bank_slot[bank];
+        if(slot < 0) slot = sd_bank_load(cache, bank);
+        cache->stats.misses++;
+        cache->stats.stall_us += esp_timer_get_time() - start_time;
+    }
+    cache->slot_used[slot] = ++cache->tick;
+
+    // Games usually go through their banks in order, so the next one is read in the background.
+    // It needs a slot of its own while it's read, the one of the current bank can't be taken.
+    uint16_t next = bank + 1;
+    if(cache->slots > 1 && next < cache->banks && cache->bank_slot[next] < 0) xQueueSend(cache->prefetch_queue, &next, 0);
+
+    xSemaphoreGive(cache->lock);
+
+    return cache->data + slot * cache->bank_size;
+}
+
+void sd_bank_cache_stats(sd_bank_cache_t *cache, sd_bank_stats_t *stats){
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    *stats = cache->stats;
+    xSemaphoreGive(cache->lock);
+}
+
+void sd_bank_cache_close(sd_bank_cache_t *cache){
+    if(cache == NULL) return;
+
+    // The prefetch task only touches the slots and the file with their locks taken, so it's safe to stop it here.
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    xSemaphoreTake(cache->file_lock, portMAX_DELAY);
+    vTaskDelete(cache->prefetch_task);
+    cache->prefetch_task = NULL;
+    xSemaphoreGive(cache->file_lock);
+    xSemaphoreGive(cache->lock);
+
+    sd_bank_cache_free(cache);
+}
+
+bool sd_save_write(const char *path, void *data, size_t size){
+    if(save_queue == NULL){
+        save_queue = xQueueCreate(SAVE_QUEUE_LEN, sizeof(sd_save_job_t));
+        if(save_queue == NULL){
+            ESP_LOGE(TAG, "Error creating the save queue");
+            return false;
+        }
+
+        // The writer runs on the video and audio core, so it never stalls the emulation.
+        if(xTaskCreatePinnedToCore(&sd_save_task, "sd_save", 3072, NULL, 1, NULL, 1) != pdPASS){
+            ESP_LOGE(TAG, "Error creating the save task");
+            vQueueDelete(save_queue);
+            save_queue = NULL;
+            return false;
+        }
+    }
+
+    sd_save_job_t job;
+    job.path = strdup(path);
+    job.data = data;
+    job.size = size;
+    if(job.path == NULL) return false;
+
+    portENTER_CRITICAL(&save_mux);
+    save_pending++;
+    portEXIT_CRITICAL(&save_mux);
+
+    if(xQueueSend(save_queue, &job, 0) != pdTRUE){
+        ESP_LOGW(TAG, "Save queue full, dropping the save of: %s",path);
+        portENTER_CRITICAL(&save_mux);
+        save_pending--;
+        portEXIT_CRITICAL(&save_mux);
+        free(job.path);
+        return false;
+    }
+
+    return true;
+}
+
+void * sd_save_read(const char *path, size_t *size){
+    char tmp_path[310];
+
+    uint8_t *data = sd_save_check(path, size, true);
+    if(data != NULL) return data;
+
+    // A power loss between removing the old save and the rename leaves only the new one.
+    sprintf(tmp_path, "%s.tmp", path);
+    data = sd_save_check(tmp_path, size, false);
+    if(data != NULL) ESP_LOGW(TAG, "Recovered the save data from: %s",tmp_path);
+
+    return data;
+}
+
+void sd_save_sync(){
+    while(save_pending) vTaskDelay(10 / portTICK_PERIOD_MS);
 }
 
 
 char * IRAM_ATTR sd_get_file_flash (const char *path){
-     const size_t BLOCK_SIZE = 4096*2;
     char *map_ptr;// Pointer to file in the internal flash.
-    
-    spi_flash_mmap_handle_t map_handle;
+    int64_t start_time = esp_timer_get_time();
 
     const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "data_0");
     if(partition == NULL){
         ESP_LOGE(TAG, "Partition NULL");
+        return NULL;
     }
     ESP_LOGI(TAG,"Partition label %s, ffset 0x%x with size 0x%x\r\n",partition->label,partition->address, partition->size);
-    
-
-    ESP_ERROR_CHECK(esp_partition_erase_range(partition, 0, partition->size));
 
-    size_t r = 0;
+    // The ROM goes at the start of the partition and the cache header on its last sector.
+    size_t header_offset = partition->size - SPI_FLASH_SEC_SIZE;
 
-    FILE *fd = fopen(path, "rb"); //Open the file in binary read mode
+    struct stat st;
+    if(stat(path, &st) != 0){
+        ESP_LOGE(TAG, "Error opening: %s ",path);
+        return NULL;
+    }
+    if(st.st_size > header_offset){
+        ESP_LOGE(TAG, "File too big for the partition: %li bytes",st.st_size);
+        return NULL;
+    }
 
-    if(fd==NULL){
+    // The next block is read from the SD card while the current one is written to flash.
+    sd_stream_t *stream = sd_stream_open(path, 0, READ_BLOCK_SIZE);
+    if(stream == NULL){
        ESP_LOGE(TAG, "Error opening: %s ",path);
+       return NULL;
     }
 
-    char * temp_buffer;
-    temp_buffer =  malloc(BLOCK_SIZE);
-    esp_fill_random(temp_buffer,BLOCK_SIZE);
+    size_t count;
+    const uint8_t *block = sd_stream_read(stream, &count);
 
-    while (true){
-        __asm__("memw"); // Protect the write into the RAM memory
-        size_t count = fread(temp_buffer, 1, BLOCK_SIZE, fd);
-        esp_partition_write(partition, r, temp_buffer, BLOCK_SIZE);
-        __asm__("memw");
+    rom_cache_header_t header = {
+        .magic = ROM_CACHE_MAGIC,
+        .size = st.st_size,
+        .mtime = st.st_mtime,
+        .head_crc = block ? crc32_le(0, block, count) : 0,
+    };
+    rom_cache_header_t cached;
+    esp_partition_read(partition, header_offset, &cached, sizeof(cached));
 
-        r += count;
-        if (count < BLOCK_SIZE) break;
+    if(!memcmp(&header, &cached, sizeof(header))){
+        // Same game as the last time, it's already on the flash.
+        ESP_LOGI(TAG,"ROM already cached on flash memory");
+        sd_stream_close(stream);
+    }
+    else{
+        // Invalidate the cache before touching the data, an interrupted copy will not be taken as valid.
+        ESP_ERROR_CHECK(esp_partition_erase_range(partition, header_offset, SPI_FLASH_SEC_SIZE));
+
+        size_t r = 0;
+        while (block != NULL){
+            // Only erase the sectors used by the file, right before writing them.
+            size_t erase_size = (count + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1);
+            ESP_ERROR_CHECK(esp_partition_erase_range(partition, r, erase_size));
+            esp_partition_write(partition, r, block, count);
+            r += count;
+
+            block = sd_stream_read(stream, &count);
+        }
+
+        sd_stream_close(stream);
+
+        if(r != st.st_size){
+            ESP_LOGE(TAG, "Error reading: %s (%i of %li bytes)",path,r,st.st_size);
+            return NULL;
+        }
+
+        esp_partition_write(partition, header_offset, &header, sizeof(header));
     }
 
-    close(fd);
-    free(temp_buffer);
     // Return a pointer to the position of the saved file on the internal flash.
+    if(rom_cache_map) spi_flash_munmap(rom_cache_map);
+    rom_cache_map = 0;
 
-	ESP_ERROR_CHECK(esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &map_ptr, &map_handle));
+    // Only the file is mapped, the data window of the MMU is shared with the firmware.
+    esp_err_t err = esp_partition_mmap(partition, 0, st.st_size, SPI_FLASH_MMAP_DATA, (const void **)&map_ptr, &rom_cache_map);
+    if(err != ESP_OK){
+        ESP_LOGE(TAG, "Error mapping %li bytes of flash: %s",st.st_size,esp_err_to_name(err));
+        return NULL;
+    }
+
+    ESP_LOGI(TAG,"ROM on flash memory after %lli ms",(esp_timer_get_time() - start_time) / 1000);
    return map_ptr;
 }
 
@@ -316,5 +789,545 @@ bool sd_mounted(){
     return SD_mount;
 }
 
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+static const char * sd_console_dir(uint8_t console){
+    if(console == NES) return "/sdcard/NES";
+    else if(console == GAMEBOY) return "/sdcard/GameBoy";
+    else if(console == GAMEBOY_COLOR) return "/sdcard/GameBoy_Color";
+    else if(console == SNES) return "/sdcard/SNES";
+    else if(console == SMS) return "/sdcard/Master_System";
+    else if(console == GG) return "/sdcard/Game_Gear";
+    return NULL;
+}
+
+static bool sd_game_match(const char *name, uint8_t console){
+    const char *ext = strrchr(name, '.');
+    if(ext == NULL) return false;
+
+    if(console == NES) return strcmp(ext, ".nes") == 0;
+    else if(console == GAMEBOY) return strcmp(ext, ".gb") == 0;
+    else if(console == GAMEBOY_COLOR) return strcmp(ext, ".gbc") == 0;
+    else if(console == SMS) return strcmp(ext, ".sms") == 0;
+    else if(console == GG) return strcmp(ext, ".gg") == 0;
+    return false;
+}
+
+static sd_game_t * sd_library_alloc(uint16_t count){
+    sd_game_t *games = heap_caps_malloc(count * sizeof(sd_game_t), MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM);
+    if(games == NULL) games = malloc(count * sizeof(sd_game_t));
+    return games;
+}
+
+/* Function: sd_library_refresh
+ * ---------------------
+ * Rewrite the index of a console from its folder, the games already on the
+ * old index are copied from it and only the new files are read.
+ */
+static uint16_t sd_library_refresh(uint8_t console){
+    const char *dir_path = sd_console_dir(console);
+    char path[300];
+    struct dirent *entry;
+
+    DIR *dir = opendir(dir_path);
+    if (!dir) return 0;
+
+    // Only the names are read from the directory, the rest comes from the old index for the games already on it.
+    uint16_t capacity = 64;
+    uint16_t count = 0;
+    uint32_t signature = 0;
+    sd_game_t *games = sd_library_alloc(capacity);
+
+    while(games != NULL && (entry = readdir(dir)) != NULL){
+        if(!sd_game_match(entry->d_name, console) || strlen(entry->d_name) >= sizeof(games->name)) continue;
+
+        if(count == UINT16_MAX) break;
+
+        if(count == capacity){
+            // The capacity is kept on 16 bits like the number of games.
+            capacity = capacity > UINT16_MAX / 2 ? UINT16_MAX : capacity * 2;
+            sd_game_t *grown = sd_library_alloc(capacity);
+            if(grown != NULL) memcpy(grown, games, count * sizeof(sd_game_t));
+            free(games);
+            games = grown;
+            if(games == NULL) break;
+        }
+
+        memset(&games[count], 0, sizeof(sd_game_t));
+        strcpy(games[count].name, entry->d_name);
+        signature = crc32_le(signature, (const uint8_t *)entry->d_name, strlen(entry->d_name) + 1);
+        count++;
+    }
+    closedir(dir);
+
+    if(games == NULL){
+        ESP_LOGE(TAG, "Not enough memory for the game list");
+        return 0;
+    }
+
+    // Get the last index of the console
+    sprintf(path, "%s/%s", dir_path, LIBRARY_FILE);
+    sd_library_header_t header;
+    sd_game_t *index = NULL;
+
+    FILE *fd = fopen(path, "rb");
+    if(fd != NULL){
+        if(fread(&header, sizeof(header), 1, fd) == 1 && header.magic == LIBRARY_MAGIC && header.version == LIBRARY_VERSION){
+            index = sd_library_alloc(header.count ? header.count : 1);
+            if(index != NULL && fread(index, sizeof(sd_game_t), header.count, fd) != header.count){
+                free(index);
+                index = NULL;
+            }
+        }
+        fclose(fd);
+    }
+
+    // Refresh the index, only the new files are read.
+    uint16_t new_games = 0;
+    for(uint16_t i = 0; i < count; i++){
+        sd_game_t *cached = index ? bsearch(&games[i], index, header.count, sizeof(sd_game_t), sd_game_compare) : NULL;
+        if(cached != NULL){
+            strcpy(cached->name, games[i].name); // Keep the case of the directory entry
+            games[i] = *cached;
+        }
+        else{
+            sprintf(path, "%s/%s", dir_path, games[i].name);
+            sd_game_info(path, console, &games[i]);
+            new_games++;
+        }
+    }
+    free(index);
+
+    qsort(games, count, sizeof(sd_game_t), sd_game_compare);
+
+    header.magic = LIBRARY_MAGIC;
+    header.version = LIBRARY_VERSION;
+    header.count = count;
+    header.signature = signature;
+
+    sprintf(path, "%s/%s", dir_path, LIBRARY_FILE);
+    fd = fopen(path, "wb");
+    if(fd != NULL){
+        fwrite(&header, sizeof(header), 1, fd);
+        fwrite(games, sizeof(sd_game_t), count, fd);
+        fclose(fd);
+    }
+    else{
+        ESP_LOGW(TAG, "Error writing the index: %s ",path);
+    }
+
+    ESP_LOGI(TAG, "Found %i games, %i new",count,new_games);
+    free(games);
+    return count;
+}
+
+static int sd_game_compare(const void *a, const void *b){
+    return strcasecmp(((const sd_game_t *)a)->name, ((const sd_game_t *)b)->name);
+}
+
+/* Function: sd_game_info
+ * ---------------------
+ * Fill the size, modification time, CRC and header fields of a game.
+ * The file is read with a stream, so the CRC overlaps the SD transfers.
+ */
+static void sd_game_info(const char *path, uint8_t console, sd_game_t *game){
+    struct stat st;
+
+    if(stat(path, &st) == 0){
+        game->size = st.st_size;
+        game->mtime = st.st_mtime;
+    }
+
+    sd_stream_t *stream = sd_stream_open(path, 0, READ_BLOCK_SIZE);
+    if(stream == NULL) return;
+
+    // SMS and GG headers are at the end of the first 8, 16 or 32 KBytes, after the copier header if present.
+    size_t copier = ((game->size / 512) & 1) ? 512 : 0;
+    const size_t sega_offset[3] = {0x7FF0 + copier, 0x3FF0 + copier, 0x1FF0 + copier};
+    bool sega_found = false;
+
+    const uint8_t *block;
+    size_t length;
+    size_t pos = 0;
+
+    while((block = sd_stream_read(stream, &length)) != NULL){
+        if(pos == 0){
+            if((console == GAMEBOY || console == GAMEBOY_COLOR) && length > 0x148){
+                game->mapper = block[0x147];    // Cartridge type
+                game->info = block[0x143];      // CGB flag
+            }
+            else if(console == NES && length >= 16 && !memcmp(block, "NES\x1a", 4)){
+                game->mapper = (block[6] >> 4) | (block[7] & 0xF0);
+                game->info = block[4];          // 16 KByte PRG banks
+            }
+        }
+
+        if((console == SMS || console == GG) && !sega_found){
+            for(uint8_t i = 0; i < 3; i++){
+                size_t offset = sega_offset[i];
+                if(offset >= pos && offset + 16 <= pos + length && !memcmp(block + offset - pos, "TMR SEGA", 8)){
+                    game->mapper = block[offset - pos + 15] >> 4;   // Region code
+                    game->info = block[offset - pos + 15] & 0x0F;   // ROM size code
+                    sega_found = true;
+                    break;
+                }
+            }
+        }
+
+        game->crc = crc32_le(game->crc, block, length);
+        pos += length;
+    }
+
+    sd_stream_close(stream);
+}
+
+/* Function: sd_read_file
+ * ---------------------
+ * Read size bytes of a file, starting at offset, into data.
+ * The SD driver can only DMA into internal memory and falls back to one
+ * command per sector otherwise, so reads into PSRAM go through a stream:
+ * the next block is read while the current one is being copied.
+ *
+ * Returns: Number of bytes read.
+ */
+static size_t sd_read_file(const char *path, size_t offset, uint8_t *data, size_t size){
+    size_t r = 0;
+
+    if(!esp_ptr_dma_capable(data)){
+        sd_stream_t *stream = sd_stream_open(path, offset, READ_BLOCK_SIZE);
+        if(stream != NULL){
+            const uint8_t *block;
+            size_t length;
+
+            while(r < size && (block = sd_stream_read(stream, &length)) != NULL){
+                if(length > size - r) length = size - r;
+                memcpy(data + r, block, length);
+                r += length;
+            }
+
+            sd_stream_close(stream);
+            return r;
+        }
+        ESP_LOGW(TAG,"Stream not available, reading in place.");
+    }
+
+    int fd = open(path, O_RDONLY); //Open the file in binary read mode
+    if(fd < 0){
+        ESP_LOGE(TAG, "Error opening: %s ",path);
+        return 0;
+    }
+
+    if(offset && lseek(fd, offset, SEEK_SET) != offset){
+        ESP_LOGE(TAG, "Error seeking: %s ",path);
+        close(fd);
+        return 0;
+    }
+
+    while(r < size){
+        size_t len = size - r;
+        if(len > READ_BLOCK_SIZE) len = READ_BLOCK_SIZE;
+
+        ssize_t count = read(fd, data + r, len);
+        if(count <= 0) break;
+        r += count;
+    }
+
+    close(fd);
+    return r;
+}
+
+/* Function: sd_stream_task
+ * ---------------------
+ * Reader of a stream, fills the free buffers with the next blocks of the
+ * file until the end of it or until the stream is closed.
+ */
+static void sd_stream_task(void *arg){
+    sd_stream_t *stream = (sd_stream_t *)arg;
+    sd_block_t block;
+    int8_t index;
+
+    while(1){
+        xQueueReceive(stream->free_queue, &index, portMAX_DELAY);
+        if(stream->stop) break;
+
+        ssize_t count = read(stream->fd, stream->buffer[index], stream->block_size);
+        if(count <= 0) break;
+
+        block.index = index;
+        block.length = count;
+        xQueueSend(stream->ready_queue, &block, portMAX_DELAY);
+
+        if(count < stream->block_size) break;
+    }
+
+    close(stream->fd);
+
+    // After this the consumer may free the stream.
+    block.index = -1;
+    block.length = 0;
+    xQueueSend(stream->ready_queue, &block, portMAX_DELAY);
+
+    vTaskDelete(NULL);
+}
+
+static void sd_stream_free(sd_stream_t *stream){
+    for(int8_t i = 0; i < STREAM_BUFFERS; i++) free(stream->buffer[i]);
+    if(stream->free_queue != NULL) vQueueDelete(stream->free_queue);
+    if(stream->ready_queue != NULL) vQueueDelete(stream->ready_queue);
+    free(stream);
+}
+
+/* Function: sd_bank_load
+ * ---------------------
+ * Read a bank into the least recently used slot. Must be called with the
+ * cache lock taken.
+ *
+ * Returns: Slot holding the bank.
+ */
+/* Function: sd_bank_reserve
+ * ---------------------
+ * Take an empty slot or the least recently used one, the slot being read
+ * by the prefetch task is skipped. Called with the slots locked.
+ */
+static int16_t sd_bank_reserve(sd_bank_cache_t *cache){
+    int16_t slot = -1;
+
+    for(int16_t i = 0; i < cache->slots; i++){
+        if(i == cache->loading_slot) continue;
+        if(cache->slot_bank[i] < 0){
+            slot = i;
+            break;
+        }
+        if(slot < 0 || cache->slot_used[i] < cache->slot_used[slot]) slot = i;
+    }
+
+    if(cache->slot_bank[slot] >= 0) cache->bank_slot[cache->slot_bank[slot]] = -1;
+    cache->slot_bank[slot] = -1;
+    return slot;
+}
+
+/* Function: sd_bank_read
+ * ---------------------
+ * Read a bank from the file into a reserved slot, the end of the last bank
+ * is filled with 0xFF. Only the file is locked.
+ */
+static void sd_bank_read(sd_bank_cache_t *cache, uint16_t bank, int16_t slot){
+    uint8_t *data = cache->data + slot * cache->bank_size;
+    size_t r = 0;
+
+    xSemaphoreTake(cache->file_lock, portMAX_DELAY);
+    if(lseek(cache->fd, bank * cache->bank_size, SEEK_SET) >= 0){
+        while(r < cache->bank_size){
+            ssize_t count = read(cache->fd, data + r, cache->bank_size - r);
+            if(count <= 0) break;
+            r += count;
+        }
+    }
+    xSemaphoreGive(cache->file_lock);
+
+    if(r < cache->bank_size) memset(data + r, 0xff, cache->bank_size - r);
+}
+
+/* Function: sd_bank_load
+ * ---------------------
+ * Read a missed bank for the emulator, with the slots locked.
+ */
+static int16_t sd_bank_load(sd_bank_cache_t *cache, uint16_t bank){
+    int16_t slot = sd_bank_reserve(cache);
+    sd_bank_read(cache, bank, slot);
+
+    cache->slot_bank[slot] = bank;
+    cache->bank_slot[bank] = slot;
+    return slot;
+}
+
+/* Function: sd_bank_prefetch_task
+ * ---------------------
+ * Load the banks requested by sd_bank_cache_get before they are used.
+ * They take the age of the last used bank, so they never replace the
+ * banks mapped at that moment. The slot is reserved and published with
+ * the slots locked, the SD card is read without it so the emulator
+ * keeps using the cached banks meanwhile.
+ */
+static void sd_bank_prefetch_task(void *arg){
+    sd_bank_cache_t *cache = (sd_bank_cache_t *)arg;
+    uint16_t bank;
 
+    while(1){
+        xQueueReceive(cache->prefetch_queue, &bank, portMAX_DELAY);
 
+        xSemaphoreTake(cache->lock, portMAX_DELAY);
+        if(cache->bank_slot[bank] >= 0){
+            xSemaphoreGive(cache->lock);
+            continue;
+        }
+        int16_t slot = sd_bank_reserve(cache);
+        cache->loading_bank = bank;
+        cache->loading_slot = slot;
+        xSemaphoreGive(cache->lock);
+
+        sd_bank_read(cache, bank, slot);
+
+        xSemaphoreTake(cache->lock, portMAX_DELAY);
+        cache->slot_bank[slot] = bank;
+        cache->bank_slot[bank] = slot;
+        cache->slot_used[slot] = cache->tick;
+        cache->stats.prefetches++;
+        cache->loading_bank = -1;
+        cache->loading_slot = -1;
+        if(cache->waiting){
+            cache->waiting = false;
+            xSemaphoreGive(cache->loaded);
+        }
+        xSemaphoreGive(cache->lock);
+    }
+}
+
+/* Function: sd_save_task
+ * ---------------------
+ * Writer of the save data, it takes the snapshots from the queue and
+ * writes them on the SD card at low priority.
+ */
+static void sd_save_task(void *arg){
+    sd_save_job_t job;
+
+    while(1){
+        xQueueReceive(save_queue, &job, portMAX_DELAY);
+
+        int64_t start_time = esp_timer_get_time();
+        if(sd_save_file(job.path, job.data, job.size)){
+            ESP_LOGI(TAG,"Saved %i bytes to %s in %lli ms",job.size,job.path,(esp_timer_get_time() - start_time) / 1000);
+        }
+
+        free(job.data);
+        free(job.path);
+
+        portENTER_CRITICAL(&save_mux);
+        save_pending--;
+        portEXIT_CRITICAL(&save_mux);
+    }
+}
+
+/* Function: sd_save_file
+ * ---------------------
+ * Write the data with its header to a temporary file, sync it and replace
+ * the old save with it, so a power loss at any point keeps a valid save.
+ * The data is copied through a DMA capable block when it's on PSRAM.
+ *
+ * Returns: True if the save was written.
+ */
+static bool sd_save_file(const char *path, const uint8_t *data, size_t size){
+    char tmp_path[310];
+    sd_save_header_t header;
+    uint8_t *block = NULL;
+    bool r = false;
+
+    header.magic = SAVE_MAGIC;
+    header.version = SAVE_VERSION;
+    header.reserved = 0;
+    header.size = size;
+    header.crc = crc32_le(0, data, size);
+
+    sprintf(tmp_path, "%s.tmp", path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC);
+    if(fd < 0){
+        ESP_LOGE(TAG, "Error creating: %s ",tmp_path);
+        return false;
+    }
+
+    if(!esp_ptr_dma_capable(data)) block = heap_caps_malloc(READ_BLOCK_SIZE, MALLOC_CAP_8BIT | MALLOC_CAP_DMA);
+
+    if(write(fd, &header, sizeof(header)) != sizeof(header)) goto exit;
+
+    for(size_t w = 0; w < size;){
+        size_t len = size - w;
+        if(len > READ_BLOCK_SIZE) len = READ_BLOCK_SIZE;
+
+        const uint8_t *src = data + w;
+        if(block != NULL){
+            memcpy(block, src, len);
+            src = block;
+        }
+
+        if(write(fd, src, len) != len) goto exit;
+        w += len;
+    }
+
+    r = fsync(fd) == 0;
+
+exit:
+    close(fd);
+    free(block);
+
+    if(!r){
+        ESP_LOGE(TAG, "Error writing: %s ",tmp_path);
+        unlink(tmp_path);
+        return false;
+    }
+
+    // FAT can't rename over an existing file, the old save is removed first.
+    unlink(path);
+    if(rename(tmp_path, path) != 0){
+        ESP_LOGE(TAG, "Error renaming: %s ",tmp_path);
+        return false;
+    }
+
+    return true;
+}
+
+/* Function: sd_save_check
+ * ---------------------
+ * Load a save data file and check its header and CRC. The data is moved
+ * to the start of the buffer. If legacy is set, a file without header is
+ * accepted as it is, the saves before this format didn't have one.
+ *
+ * Returns: Pointer to the allocated data or NULL if it isn't valid.
+ */
+static uint8_t * sd_save_check(const char *path, size_t *size, bool legacy){
+    struct stat st;
+    size_t file_size;
+
+    if(stat(path, &st) != 0) return NULL;
+
+    uint8_t *data = sd_load_file(path, 0, 0, &file_size);
+    if(data == NULL) return NULL;
+
+    sd_save_header_t header;
+    if(file_size >= sizeof(header)) memcpy(&header, data, sizeof(header));
+    else header.magic = 0;
+
+    if(header.magic != SAVE_MAGIC){
+        if(legacy){
+            *size = file_size;
+            return data;
+        }
+        free(data);
+        return NULL;
+    }
+
+    if(header.version != SAVE_VERSION || header.size != file_size - sizeof(header)
+       || crc32_le(0, data + sizeof(header), header.size) != header.crc){
+        ESP_LOGE(TAG, "Corrupted save data: %s ",path);
+        free(data);
+        return NULL;
+    }
+
+    memmove(data, data + sizeof(header), header.size);
+    *size = header.size;
+    return data;
+}
+
+static void sd_bank_cache_free(sd_bank_cache_t *cache){
+    if(cache->fd >= 0) close(cache->fd);
+    free(cache->data);
+    free(cache->slot_bank);
+    free(cache->slot_used);
+    free(cache->bank_slot);
+    if(cache->lock != NULL) vSemaphoreDelete(cache->lock);
+    if(cache->file_lock != NULL) vSemaphoreDelete(cache->file_lock);
+    if(cache->loaded != NULL) vSemaphoreDelete(cache->loaded);
+    if(cache->prefetch_queue != NULL) vQueueDelete(cache->prefetch_queue);
+    free(cache);
+}
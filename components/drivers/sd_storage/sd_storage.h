@@ -12,6 +12,25 @@
 /*********************
  *      DEFINES
  *********************/
+typedef struct sd_stream sd_stream_t;
+typedef struct sd_bank_cache sd_bank_cache_t;
+
+typedef struct{
+    char name[100];     // File name
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t crc;       // CRC32 of the whole file
+    uint8_t mapper;     // GB cartridge type, NES mapper or SMS/GG region code
+    uint8_t info;       // GB CGB flag, NES PRG banks or SMS/GG ROM size code
+}sd_game_t;
+
+typedef struct{
+    uint32_t hits;          // Banks found on memory.
+    uint32_t misses;        // Banks the emulator had to wait for.
+    uint32_t prefetches;    // Banks read in the background.
+    uint64_t stall_us;      // Time spent waiting for missed banks.
+}sd_bank_stats_t;
+
 struct sd_card_info{
     char card_name[32];
     uint8_t card_type;
@@ -41,19 +60,38 @@ bool sd_init();
 
 
 /*
- * Function:  sd_game_list 
+ * Function:  sd_game_count 
  * --------------------
  * 
- * This function  gives the number of game available and the name of them for each console.
+ * This function counts the games available for each console. They are kept sorted by name on an index
+ * file on the folder of the console, it's only refreshed when the files of the folder change and only the
+ * new games are read. The games are read from the index with sd_game_read.
  * 
  * Arguments:
- *  -game_name: Two dimensions array in which will be save the game names.
  *  -console: Console to check the available games.
  * 
- * Returns: Number of available games for the console.
+ * Returns: The number of available games for the console.
  * 
  */
-uint8_t sd_game_list(char game_name[30][100], uint8_t console);
+uint16_t sd_game_count(uint8_t console);
+
+/*
+ * Function:  sd_game_read 
+ * --------------------
+ * 
+ * Read a page of the game index of a console written by sd_game_count, so long lists can be shown without
+ * keeping all of them on memory.
+ * 
+ * Arguments:
+ *  -console: Console of the games.
+ *  -first: Position of the first game to read on the sorted list.
+ *  -count: Number of games to read.
+ *  -games: Array where the games will be saved.
+ * 
+ * Returns: Number of games read.
+ * 
+ */
+uint16_t sd_game_read(uint8_t console, uint16_t first, uint16_t count, sd_game_t *games);
 
 /*
  * Function:  sd_app_list 
@@ -101,12 +139,34 @@ size_t sd_file_size(const char *path);
  */
 void  sd_get_file (const char *path, void * data);
 
+/*
+ * Function:  sd_load_file 
+ * --------------------
+ * 
+ * Given a valid file path, allocate a buffer of the exact size of the file and read it from the SD card
+ * in large blocks. Used to load the game ROMs.
+ * 
+ * Arguments:
+ *  -path: Valid path to the file.
+ *  -offset: Number of bytes skipped at the start of the file, e.g. a ROM header.
+ *  -min_size: Minimum size of the buffer, the bytes after the end of the file are zeroed.
+ *  -size: If not NULL, returns the number of bytes read from the file.
+ * 
+ * Returns: Pointer to the allocated buffer or NULL if the file couldn't be loaded.
+ * 
+ */
+void * sd_load_file(const char *path, size_t offset, size_t min_size, size_t *size);
+
 /*
  * Function:  sd_get_file_flash 
  * --------------------
  * 
  * Given a valid file path, copy a file from the SD card to the "storage" partition on the flash memory.
  * 
+ * The last sector of the partition keeps the size, modification time and CRC of the first block of the
+ * cached file. If they match, the game was already copied and it's only mapped, otherwise only the sectors
+ * needed by the file are erased and written.
+ * 
  * Note: A valid 4 Mbyte data partition should set previously on the partition.csv file to use this feature.
  * It's not recommendable to use in files under 3 MByte, because the write speed is significantly slower than
  * the memory RAM alternative.
@@ -119,6 +179,162 @@ void  sd_get_file (const char *path, void * data);
  */
 char * IRAM_ATTR sd_get_file_flash (const char *path);
 
+/*
+ * Function:  sd_stream_open 
+ * --------------------
+ * 
+ * Open a file to be read block by block. A reader task reads the next block into a second buffer
+ * while the caller is using the current one, so copying, flashing or hashing the data overlaps
+ * with the SD card transfers.
+ * 
+ * Arguments:
+ *  -path: Valid path to the file.
+ *  -offset: Number of bytes skipped at the start of the file.
+ *  -block_size: Size of each block, the two buffers are allocated on DMA memory when possible.
+ * 
+ * Returns: Handler of the stream or NULL if the file couldn't be opened.
+ * 
+ */
+sd_stream_t * sd_stream_open(const char *path, size_t offset, size_t block_size);
+
+/*
+ * Function:  sd_stream_read 
+ * --------------------
+ * 
+ * Get the next block of the file, waiting for it if it's still being read. The previous block is
+ * given back to the reader, so it must not be used after this call.
+ * 
+ * Arguments:
+ *  -stream: Stream handler.
+ *  -length: Returns the number of valid bytes of the block.
+ * 
+ * Returns: Pointer to the block or NULL at the end of the file.
+ * 
+ */
+const uint8_t * sd_stream_read(sd_stream_t *stream, size_t *length);
+
+/*
+ * Function:  sd_stream_close 
+ * --------------------
+ * 
+ * Stop the reader task, close the file and free the stream buffers.
+ * 
+ * Arguments:
+ *  -stream: Stream handler.
+ * 
+ * Returns: Nothing.
+ * 
+ */
+void sd_stream_close(sd_stream_t *stream);
+
+/*
+ * Function:  sd_bank_cache_open 
+ * --------------------
+ * 
+ * Open a file to be read by banks on demand, so games bigger than the available memory can run straight
+ * from the SD card. The banks are kept on a LRU cache on PSRAM and the bank after the last requested one
+ * is read in the background.
+ * 
+ * Note: At least 4 slots are needed, the two last requested banks are never replaced.
+ * 
+ * Arguments:
+ *  -path: Valid path to the file.
+ *  -bank_size: Size of each bank.
+ *  -slots: Number of banks kept on memory.
+ * 
+ * Returns: Handler of the cache or NULL if the file couldn't be opened.
+ * 
+ */
+sd_bank_cache_t * sd_bank_cache_open(const char *path, size_t bank_size, uint16_t slots);
+
+/*
+ * Function:  sd_bank_cache_get 
+ * --------------------
+ * 
+ * Get a bank of the file, reading it from the SD card if it isn't on the cache.
+ * 
+ * Arguments:
+ *  -cache: Cache handler.
+ *  -bank: Number of the bank, the out of range ones are mirrored.
+ * 
+ * Returns: Pointer to the bank, valid until other banks replace it.
+ * 
+ */
+uint8_t * sd_bank_cache_get(sd_bank_cache_t *cache, uint16_t bank);
+
+/*
+ * Function:  sd_bank_cache_stats 
+ * --------------------
+ * 
+ * Get the hits, misses, prefetches and stall time of the cache since it was opened.
+ * 
+ * Arguments:
+ *  -cache: Cache handler.
+ *  -stats: Returns the statistics.
+ * 
+ * Returns: Nothing.
+ * 
+ */
+void sd_bank_cache_stats(sd_bank_cache_t *cache, sd_bank_stats_t *stats);
+
+/*
+ * Function:  sd_bank_cache_close 
+ * --------------------
+ * 
+ * Stop the prefetch task, close the file and free the cache.
+ * 
+ * Arguments:
+ *  -cache: Cache handler.
+ * 
+ * Returns: Nothing.
+ * 
+ */
+void sd_bank_cache_close(sd_bank_cache_t *cache);
+
+/*
+ * Function:  sd_save_write 
+ * --------------------
+ * 
+ * Queue save data to be written on the background. The data goes to a temporary file
+ * with a CRC, which is synced and renamed over the old save, so a power loss never corrupts it.
+ * 
+ * Arguments:
+ *  -path: Valid path to the save file.
+ *  -data: Allocated buffer with the snapshot of the save data, freed once it's written.
+ *  -size: Size of the data.
+ * 
+ * Returns: True if it was queued, otherwise the caller keeps the buffer.
+ * 
+ */
+bool sd_save_write(const char *path, void *data, size_t size);
+
+/*
+ * Function:  sd_save_read 
+ * --------------------
+ * 
+ * Load a save data file and check its CRC. If the save is missing or corrupted, the
+ * temporary file of an interrupted save is used.
+ * 
+ * Arguments:
+ *  -path: Valid path to the save file.
+ *  -size: Returns the size of the data.
+ * 
+ * Returns: Pointer to the allocated data or NULL if there isn't a valid save.
+ * 
+ */
+void * sd_save_read(const char *path, size_t *size);
+
+/*
+ * Function:  sd_save_sync 
+ * --------------------
+ * 
+ * Wait until all the queued saves are written.
+ * 
+ * Returns: Nothing.
+ * 
+ */
+void sd_save_sync();
+
 /*
  * Function:  sd_mounted 
  * --------------------
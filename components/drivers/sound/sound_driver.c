@@ -12,6 +12,7 @@
 
 #include "sound_driver.h"
 #include "system_configuration.h"
+#include "profiler.h"
 
 /**********************
 *      VARIABLES
@@ -65,10 +66,8 @@ bool audio_init(uint32_t sample_rate){
 
 void audio_submit(short *stereoAudioBuffer, uint32_t frameCount){
 
-    uint32_t audio_length = frameCount * 2 * sizeof(int16_t);
-    size_t count;
-
     // Normalize the size of the sample to avoid size bigger than +- 32767
+    PROFILER_BEGIN();
     for(short i = 0; i < frameCount * 2; ++i){
         int sample = stereoAudioBuffer[i] * volume_level; // Set the volumen level to the sample
 
@@ -77,8 +76,20 @@ void audio_submit(short *stereoAudioBuffer, uint32_t frameCount){
 
         stereoAudioBuffer[i] = (short)sample;
     }
+    PROFILER_END(PROFILER_AUDIO);
+
+    audio_submit_raw(stereoAudioBuffer, frameCount);
+}
+
+void audio_submit_raw(short *stereoAudioBuffer, uint32_t frameCount){
+
+    uint32_t audio_length = frameCount * 2 * sizeof(int16_t);
+    size_t count;
 
+    // It blocks until the DMA has room for the samples.
+    PROFILER_BEGIN();
     i2s_write(I2S_NUM, (const char *)stereoAudioBuffer, audio_length, &count, portMAX_DELAY);
+    PROFILER_END(PROFILER_WAIT);
 
     if(count != audio_length){
         ESP_LOGE(TAG,"I2S Write error:\n Send count: %d\n Audio_Length: %d",count,audio_length);
@@ -97,6 +108,10 @@ uint8_t audio_volume_get(){
     return volume_level*100;
 }
 
+float audio_gain_get(){
+    return volume_level;
+}
+
 void audio_volume_set(float level){
     if(level >= 0 || level <= 100) volume_level = level/100.0f;
     ESP_LOGI(TAG,"Volumen level set: %i",(uint8_t)volume_level *100);
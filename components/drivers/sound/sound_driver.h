@@ -45,6 +45,22 @@ bool audio_init(uint32_t sample_rate);
  */
 void audio_submit(short *stereoAudioBuffer, uint32_t frameCount);
 
+/*
+ * Function:  audio_submit_raw 
+ * --------------------
+ * 
+ * Send the audio samples to the I2S driver without processing them. Use it when the
+ * emulator already applied the volume level given by audio_gain_get.
+ * 
+ * Arguments:
+ *  -stereoAudioBuffer: Pointer to the interleaved stereo audio buffer, ready to play.
+ *  -framecount: Number of stereo samples in the buffer.
+ * 
+ * Returns: Nothing.
+ * 
+ */
+void audio_submit_raw(short *stereoAudioBuffer, uint32_t frameCount);
+
 /*
  * Function:  audio_terminate 
  * --------------------
@@ -68,6 +84,18 @@ void audio_terminate();
  */
 uint8_t audio_volume_get();
 
+/*
+ * Function:  audio_gain_get 
+ * --------------------
+ * 
+ * Give the volumen level as a gain to apply to each sample, without logging it so it can
+ * be read on every frame.
+ * 
+ * Returns: Gain from 0 to 1.
+ * 
+ */
+float audio_gain_get();
+
 /*
  * Function:  audio_volume_set 
  * --------------------
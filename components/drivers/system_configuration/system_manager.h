@@ -16,6 +16,7 @@ QueueHandle_t batteryQueue;
 #define MODE_BATTERY_ALERT  0x07
 #define MODE_CHANGE_VOLUME  0x08
 #define MODE_CHANGE_BRIGHT  0x09
+#define MODE_CHANGE_RUN_AHEAD 0x0A
 
 
 #define GAMEBOY         0x00
@@ -36,6 +37,7 @@ struct SYSTEM_MODE{
     uint8_t console;
     uint8_t volume_level;
     uint8_t brightness_level;
+    uint8_t run_ahead_frames;
     char game_name[200];
 };
 
@@ -25,6 +25,7 @@
 
 #include "system_configuration.h"
 #include "system_manager.h"
+#include "profiler.h"
 
 /**********************
  *      VARIABLES
@@ -59,7 +60,9 @@ void input_init(void){
 uint16_t input_read(void){
 #if USE_PCF8574
     //Get the mux values
+    PROFILER_BEGIN();
     uint16_t inputs_value = PCF8574_readInputs();
+    PROFILER_END(PROFILER_INPUT);
     //printf("Input Values: %04x\r\n", inputs_value);
 
     //Check if the menu button it was pushed
@@ -131,7 +134,9 @@ uint16_t input_read(void){
     }
 #else
 //Get the mux values
+    PROFILER_BEGIN();
     uint16_t inputs_value = TCA9555_readInputs();
+    PROFILER_END(PROFILER_INPUT);
 
     //Check if the menu button it was pushed
     if(!((inputs_value >>11) & 0x01)){ //Temporary workaround !((inputs_value >>11) & 0x01) is the real button
@@ -1,3 +1,12 @@
+/*********************
+ *      DEFINES
+ *********************/
+
+// Bit of input_read() that fast-forwards the game while it's held, the R shoulder button.
+#define FAST_FORWARD_BUTTON 8
+// While fast-forwarding only one of these frames is sent to the display.
+#define FAST_FORWARD_SKIP   4
+
 /*********************
  *      FUNCTIONS
  *********************/
@@ -77,6 +77,9 @@ byte pal_getcolor(int c, int r, int g, int b);
 #include <stdio.h> /* need FILE for below */
 void savestate(FILE *f);
 void loadstate(FILE *f);
+int savestate_size();
+int savestate_mem(byte *buf, int size);
+int loadstate_mem(const byte *buf, int size);
 
 /* inflate.c */
 int unzip (const unsigned char *data, long *p, void (* callback) (unsigned char d));
@@ -16,6 +16,7 @@
 
 #include <stdlib.h>
 #include <esp_attr.h>
+#include "profiler.h"
 #include <stdint.h>
 
 struct lcd lcd;
@@ -669,7 +670,8 @@ void IRAM_ATTR lcd_refreshline()
 	WT = (L - WY) >> 3;
 	WV = (L - WY) & 7;
 
-	if ((frame % 2) == 0)
+	// The manager only enables the frame buffer on the frames that are shown.
+	if (fb.enabled)
 	{
 		if (!(R_LCDC & 0x80))
 		{
@@ -686,6 +688,7 @@ void IRAM_ATTR lcd_refreshline()
 
 		lastLcdDisabled = 0;
 
+		PROFILER_BEGIN();
 
 		spr_enum();
 		tilebuf();
@@ -715,6 +718,8 @@ void IRAM_ATTR lcd_refreshline()
 		byte* src = BUF;
 
 		while (cnt--) *(dst++) = PAL2[*(src++)];
+
+		PROFILER_END(PROFILER_RENDER);
 	}
 
 	vdest += fb.pitch;
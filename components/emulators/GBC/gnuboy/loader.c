@@ -23,8 +23,15 @@
 #include "lcd.h"
 #include "rtc.h"
 #include "rc.h"
+#include "loader.h"
 #include "sound.h"
 
+/*********************
+ *      DEFINES
+ *********************/
+// 16 KByte ROM banks kept on PSRAM when the game runs from the SD card (1 MByte).
+#define ROM_CACHE_BANKS 64
+
 /**********************
  *  STATIC VARIABLES
  **********************/
@@ -132,20 +139,30 @@ bool gbc_rom_load(const char *game_name, uint8_t console){
 	size_t game_size = sd_file_size(rom_name);
 
 	/*It's only available 3MB of RAM, so, the games with a higher size,
-	* will be save on flash memory. The disadvantage is that the load 
-	* process is way slower but it's a temporary workaround */
+	* run straight from the SD card, its banks are read on demand into
+	* a cache. If the cache can't be allocated, the game is copied to
+	* the flash memory, which is way slower if it's not cached there. */
 
 	char * data = NULL; //Pointer to the memory region where the game will be saved.
+	rom.cache = NULL;
 
 	if(game_size > 3*1024*1024){
-		ESP_LOGW(TAG,"Loading game on flash memory, this process could take several minutes.");
-		data = sd_get_file_flash(rom_name);
+		ESP_LOGW(TAG,"Loading game from the SD card on demand");
+		rom.cache = sd_bank_cache_open(rom_name, 16384, ROM_CACHE_BANKS);
+		if(rom.cache != NULL){
+			data = (char *)sd_bank_cache_get(rom.cache, 0);
+		}
+		else{
+			ESP_LOGW(TAG,"Loading game on flash memory, this process could take several minutes if it's not cached.");
+			data = sd_get_file_flash(rom_name);
+			if(data == NULL) return false;
+		}
 	}
 	else{
 		//Allocate the size of the game.
 		ESP_LOGW(TAG,"Loading game on RAM memory");
-		data = malloc(game_size);
-		sd_get_file(rom_name,data);
+		data = sd_load_file(rom_name,0,0,NULL);
+		if(data == NULL) return false;
 	}
 
 
@@ -222,15 +239,15 @@ bool gbc_rom_load(const char *game_name, uint8_t console){
 
 	ESP_LOGI(TAG,"ROM DATA:\nMBC type = %s\nROM Size = %d (%dK)\nRAM size = %d (%dK)", mbcName, mbc.romsize, rlen / 1024, mbc.ramsize, sram_length / 1024);
 
-	// ROM
-	rom.bank = (byte *)data;
+	// ROM, the banks come from the cache when it's used
+	rom.bank = rom.cache ? NULL : (byte *)data;
 	rom.length = rlen;
 
 	// SRAM
 	ram.sram_dirty = 1;
 	ram.sbank = malloc(sram_length); //Allocate the required SRAM
 	if (!ram.sbank){
-		if (rlen <= (0x100000 * 3) && sram_length <= 0x100000){
+		if (!rom.cache && rlen <= (0x100000 * 3) && sram_length <= 0x100000){
 			ram.sbank = data + (0x100000 * 3);
 			ESP_LOGW(TAG,"Error allocating the required SRAM, triying to force allocation on PSRAM.");
 		}
@@ -340,18 +357,26 @@ bool gbc_state_save(const char *game_name, uint8_t console){
 		sprintf(rom_name,"/sdcard/GameBoy_Color/Save_Data/%s.sav",game_name);
 	}
 	
-	FILE *f = fopen(rom_name, "w");
-	
-	if (f != NULL){
-		savestate(f);
-		fclose(f);
-		ESP_LOGI(TAG,"%s SAVE.",game_name);
-		return true;
+	// Snapshot the state on RAM, the save task writes it on the SD card.
+	int size = gbc_state_size();
+	char *data = malloc(size);
+
+	if (data == NULL){
+		ESP_LOGE(TAG,"Not enough memory for the save snapshot.");
+		return false;
 	}
-	else{
-		ESP_LOGE(TAG,"Fail to create game save file.");
+
+	int64_t start_time = esp_timer_get_time();
+	gbc_state_snapshot(data, size);
+	ESP_LOGI(TAG,"Save snapshot: %i bytes in %lli us",size,esp_timer_get_time() - start_time);
+
+	if (!sd_save_write(rom_name, data, size)){
+		free(data);
 		return false;
 	}
+
+	ESP_LOGI(TAG,"%s SAVE.",game_name);
+	return true;
 }
 
 
@@ -362,25 +387,41 @@ bool gbc_state_load(const char *game_name, uint8_t console){
 		sprintf(rom_name,"/sdcard/GameBoy_Color/Save_Data/%s.sav",game_name);
 	}
 	
-	FILE *f = fopen(rom_name, "r");
-
-	if (f != NULL){
-		loadstate(f);
-		fclose(f);
-		vram_dirty();
-		pal_dirty();
-		sound_dirty();
-		mem_updatemap();
+	size_t size;
+	void *data = sd_save_read(rom_name, &size);
+
+	if (data != NULL && gbc_state_restore(data, size)){
+		free(data);
 		ESP_LOGI(TAG,"%s LOAD.",game_name);
 		return true;
 	}
 	else{
 		ESP_LOGE(TAG,"Fail to load save data.");
+		free(data);
 		return false;
 	}
 
 }
 
+int gbc_state_size(){
+	return savestate_size();
+}
+
+int gbc_state_snapshot(void *buffer, int size){
+	return savestate_mem(buffer, size);
+}
+
+bool gbc_state_restore(const void *buffer, int size){
+	if (loadstate_mem(buffer, size) != 0) return false;
+
+	// The caches built from the restored memory are rebuilt.
+	vram_dirty();
+	pal_dirty();
+	sound_dirty();
+	mem_updatemap();
+	return true;
+}
+
 void rtc_save()
 {
 	FILE *f;
@@ -428,6 +469,8 @@ void loader_unload()
 	//free(rom.bank);
 	romfile = sramfile = saveprefix = 0;
 	rom.bank = 0;
+	sd_bank_cache_close(rom.cache);
+	rom.cache = NULL;
 	ram.sbank = 0;
 	//mbc.type = mbc.romsize = mbc.ramsize = mbc.batt = 0;
 }
@@ -20,6 +20,11 @@ int gbc_sram_save();
 bool gbc_state_load(const char *game_name, uint8_t console);
 bool gbc_state_save(const char *game_name, uint8_t console);
 
+/* Snapshots of the running game on RAM, with the layout of the save files */
+int gbc_state_size();
+int gbc_state_snapshot(void *buffer, int size);
+bool gbc_state_restore(const void *buffer, int size);
+
 
 
 #endif
@@ -14,10 +14,18 @@
 #include "esp_partition.h"
 #include "esp_attr.h"
 
+#include "sd_storage.h"
+
 struct mbc mbc;
 struct rom rom;
 struct ram ram;
 
+static inline byte *rom_bank(int n)
+{
+	if (rom.cache) return sd_bank_cache_get(rom.cache, n);
+	return rom.bank[n];
+}
+
 /*
  * In order to make reads and writes efficient, we keep tables
  * (indexed by the high nibble of the address) specifying which
@@ -36,17 +44,17 @@ void IRAM_ATTR mem_updatemap()
 	byte **map;
 
 	map = mbc.rmap;
-	map[0x0] = rom.bank[0];
-	map[0x1] = rom.bank[0];
-	map[0x2] = rom.bank[0];
-	map[0x3] = rom.bank[0];
+	map[0x0] = rom_bank(0);
+	map[0x1] = map[0x0];
+	map[0x2] = map[0x0];
+	map[0x3] = map[0x0];
 
 	if (mbc.rombank < mbc.romsize)
 	{
-		map[0x4] = rom.bank[mbc.rombank] - 0x4000;
-		map[0x5] = rom.bank[mbc.rombank] - 0x4000;
-		map[0x6] = rom.bank[mbc.rombank] - 0x4000;
-		map[0x7] = rom.bank[mbc.rombank] - 0x4000;
+		map[0x4] = rom_bank(mbc.rombank) - 0x4000;
+		map[0x5] = map[0x4];
+		map[0x6] = map[0x4];
+		map[0x7] = map[0x4];
 	}
 	else
 	{
@@ -580,10 +588,10 @@ byte IRAM_ATTR mem_read(int a)
 		case 0x0:
 		case 0x2:
 		//if (a >= 16384) return 0xff;
-		return rom.bank[0][a & 0x3fff];
+		return rom_bank(0)[a & 0x3fff];
 		case 0x4:
 		case 0x6:
-		return rom.bank[mbc.rombank][a & 0x3FFF];
+		return rom_bank(mbc.rombank)[a & 0x3FFF];
 		case 0x8:
 		/* if ((R_STAT & 0x03) == 0x03) return 0xFF; */
 		return lcd.vbank[R_VBK&1][a & 0x1FFF];
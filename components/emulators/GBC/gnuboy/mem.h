@@ -31,6 +31,7 @@ struct mbc
 struct rom
 {
 	byte (* bank)[16384];
+	struct sd_bank_cache *cache; /* banks read on demand when the ROM isn't on memory */
 	char name[20];
 	int length;
 };
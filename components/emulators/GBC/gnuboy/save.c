@@ -92,11 +92,13 @@ struct svar svars[] =
 	I4("S1ec", &snd.ch[0].encnt),
 	I4("S1sc", &snd.ch[0].swcnt),
 	I4("S1sf", &snd.ch[0].swfreq),
+	I4("S1ev", &snd.ch[0].envol),
 
 	I4("S2on", &snd.ch[1].on),
 	I4("S2p ", &snd.ch[1].pos),
 	I4("S2c ", &snd.ch[1].cnt),
 	I4("S2ec", &snd.ch[1].encnt),
+	I4("S2ev", &snd.ch[1].envol),
 
 	I4("S3on", &snd.ch[2].on),
 	I4("S3p ", &snd.ch[2].pos),
@@ -106,6 +108,7 @@ struct svar svars[] =
 	I4("S4p ", &snd.ch[3].pos),
 	I4("S4c ", &snd.ch[3].cnt),
 	I4("S4ec", &snd.ch[3].encnt),
+	I4("S4ev", &snd.ch[3].envol),
 
 	I4("hdma", &hw.hdma),
 
@@ -152,25 +155,20 @@ struct svar svars[] =
 	END
 };
 
-//byte buf[4096];
+/* Number of 4 KByte blocks of the internal RAM, VRAM and SRAM */
+#define IRAM_BLOCKS (hw.cgb ? 8 : 2)
+#define VRAM_BLOCKS (hw.cgb ? 4 : 2)
+#define SRAM_BLOCKS (mbc.ramsize << 1)
 
-void loadstate(FILE *f)
+/* Read the variables and the small memories from the 4 KByte header block */
+static void state_parse(const byte *buf)
 {
 	int i, j;
-	//byte buf[4096];
-	byte* buf = malloc(4096);
-	if (!buf) abort();
-
-	un32 (*header)[2] = (un32 (*)[2])buf;
+	const un32 (*header)[2] = (const un32 (*)[2])buf;
 	un32 d;
-	int irl = hw.cgb ? 8 : 2;
-	int vrl = hw.cgb ? 4 : 2;
-	int srl = mbc.ramsize << 1;
 
 	ver = hramofs = hiofs = palofs = oamofs = wavofs = 0;
-
-	fseek(f, 0, SEEK_SET);
-	fread(buf, 4096, 1, f);
+	snd.ch[0].envol = snd.ch[1].envol = snd.ch[3].envol = -1;
 
 	for (j = 0; header[j][0]; j++)
 	{
@@ -205,9 +203,72 @@ void loadstate(FILE *f)
 	if (wavofs) memcpy(snd.wave, buf+wavofs, sizeof snd.wave);
 	else memcpy(snd.wave, ram.hi+0x30, 16); /* patch data from older files */
 
+	/* envelope volumes missing from older files */
+	if (snd.ch[0].envol < 0) snd.ch[0].envol = R_NR12 >> 4;
+	if (snd.ch[1].envol < 0) snd.ch[1].envol = R_NR22 >> 4;
+	if (snd.ch[3].envol < 0) snd.ch[3].envol = R_NR42 >> 4;
+
 	iramblock = 1;
-	vramblock = 1+irl;
-	sramblock = 1+irl+vrl;
+	vramblock = 1+IRAM_BLOCKS;
+	sramblock = 1+IRAM_BLOCKS+VRAM_BLOCKS;
+}
+
+/* Build the 4 KByte header block with the variables and the small memories */
+static void state_header(byte *buf)
+{
+	int i;
+	un32 (*header)[2] = (un32 (*)[2])buf;
+	un32 d = 0;
+
+	ver = 0x105;
+	iramblock = 1;
+	vramblock = 1+IRAM_BLOCKS;
+	sramblock = 1+IRAM_BLOCKS+VRAM_BLOCKS;
+	wavofs = 4096 - 784;
+	hiofs = 4096 - 768;
+	palofs = 4096 - 512;
+	oamofs = 4096 - 256;
+	memset(buf, 0, 4096);
+
+	for (i = 0; svars[i].len > 0; i++)
+	{
+		header[i][0] = *(un32 *)svars[i].key;
+		switch (svars[i].len)
+		{
+		case 1:
+			d = *(byte *)svars[i].ptr;
+			break;
+		case 2:
+			d = *(un16 *)svars[i].ptr;
+			break;
+		case 4:
+			d = *(un32 *)svars[i].ptr;
+			break;
+		}
+		header[i][1] = LIL(d);
+	}
+	header[i][0] = header[i][1] = 0;
+
+	memcpy(buf+hiofs, ram.hi, sizeof ram.hi);
+	memcpy(buf+palofs, lcd.pal, sizeof lcd.pal);
+	memcpy(buf+oamofs, lcd.oam.mem, sizeof lcd.oam);
+	memcpy(buf+wavofs, snd.wave, sizeof snd.wave);
+}
+
+void loadstate(FILE *f)
+{
+	//byte buf[4096];
+	byte* buf = malloc(4096);
+	if (!buf) abort();
+
+	int irl = IRAM_BLOCKS;
+	int vrl = VRAM_BLOCKS;
+	int srl = SRAM_BLOCKS;
+
+	fseek(f, 0, SEEK_SET);
+	fread(buf, 4096, 1, f);
+
+	state_parse(buf);
 
 	fseek(f, iramblock<<12, SEEK_SET);
 	fread(ram.ibank, 4096, irl, f);
@@ -241,50 +302,15 @@ void loadstate(FILE *f)
 
 void savestate(FILE *f)
 {
-	int i;
 	//byte buf[4096];
 	byte* buf = malloc(4096);
 	if (!buf) abort();
 
-	un32 (*header)[2] = (un32 (*)[2])buf;
-	un32 d = 0;
-	int irl = hw.cgb ? 8 : 2;
-	int vrl = hw.cgb ? 4 : 2;
-	int srl = mbc.ramsize << 1;
+	int irl = IRAM_BLOCKS;
+	int vrl = VRAM_BLOCKS;
+	int srl = SRAM_BLOCKS;
 
-	ver = 0x105;
-	iramblock = 1;
-	vramblock = 1+irl;
-	sramblock = 1+irl+vrl;
-	wavofs = 4096 - 784;
-	hiofs = 4096 - 768;
-	palofs = 4096 - 512;
-	oamofs = 4096 - 256;
-	memset(buf, 0, /*sizeof buf*/4096);
-
-	for (i = 0; svars[i].len > 0; i++)
-	{
-		header[i][0] = *(un32 *)svars[i].key;
-		switch (svars[i].len)
-		{
-		case 1:
-			d = *(byte *)svars[i].ptr;
-			break;
-		case 2:
-			d = *(un16 *)svars[i].ptr;
-			break;
-		case 4:
-			d = *(un32 *)svars[i].ptr;
-			break;
-		}
-		header[i][1] = LIL(d);
-	}
-	header[i][0] = header[i][1] = 0;
-
-	memcpy(buf+hiofs, ram.hi, sizeof ram.hi);
-	memcpy(buf+palofs, lcd.pal, sizeof lcd.pal);
-	memcpy(buf+oamofs, lcd.oam.mem, sizeof lcd.oam);
-	memcpy(buf+wavofs, snd.wave, sizeof snd.wave);
+	state_header(buf);
 
 	fseek(f, 0, SEEK_SET);
 	fwrite(buf, 4096, 1, f);
@@ -317,9 +343,46 @@ void savestate(FILE *f)
 		__asm__("nop");
 		__asm__("memw");
 
-		printf("savesate: wrote sram addr=%p, size=0x%x, count=%d\n", (void*)tmp, 4096, count);
+		(void)count;
 		tmp += 4096;
 	}
 
 	free(buf);
 }
+
+/* Size of a state of the running game, the same layout as the files */
+int savestate_size()
+{
+	return (1 + IRAM_BLOCKS + VRAM_BLOCKS + SRAM_BLOCKS) << 12;
+}
+
+/* Copy the state into buf, returns its size or -1 if it doesn't fit */
+int savestate_mem(byte *buf, int size)
+{
+	if (size < savestate_size()) return -1;
+
+	state_header(buf);
+	memcpy(buf + (iramblock<<12), ram.ibank, IRAM_BLOCKS<<12);
+	memcpy(buf + (vramblock<<12), lcd.vbank, VRAM_BLOCKS<<12);
+	memcpy(buf + (sramblock<<12), ram.sbank, SRAM_BLOCKS<<12);
+
+	return savestate_size();
+}
+
+/* Restore the state from buf, the SRAM may be shorter on older files */
+int loadstate_mem(const byte *buf, int size)
+{
+	int sram_size;
+
+	if (size < (1 + IRAM_BLOCKS + VRAM_BLOCKS) << 12) return -1;
+
+	state_parse(buf);
+	memcpy(ram.ibank, buf + (iramblock<<12), IRAM_BLOCKS<<12);
+	memcpy(lcd.vbank, buf + (vramblock<<12), VRAM_BLOCKS<<12);
+
+	sram_size = size - (sramblock<<12);
+	if (sram_size > SRAM_BLOCKS<<12) sram_size = SRAM_BLOCKS<<12;
+	memcpy(ram.sbank, buf + (sramblock<<12), sram_size);
+
+	return 0;
+}
@@ -97,17 +97,17 @@ inline static void s4_freq()
 	if (S4.freq >> 18) S4.freq = 1<<18;
 }
 
+/* The envelope volumes are live state, they're only set by the registers
+ * writes and the triggers, never derived from the registers again. */
 void sound_dirty()
 {
 	S1.swlen = ((R_NR10>>4) & 7) << 14;
 	S1.len = (64-(R_NR11&63)) << 13;
-	S1.envol = R_NR12 >> 4;
 	S1.endir = (R_NR12>>3) & 1;
 	S1.endir |= S1.endir - 1;
 	S1.enlen = (R_NR12 & 7) << 15;
 	s1_freq();
 	S2.len = (64-(R_NR21&63)) << 13;
-	S2.envol = R_NR22 >> 4;
 	S2.endir = (R_NR22>>3) & 1;
 	S2.endir |= S2.endir - 1;
 	S2.enlen = (R_NR22 & 7) << 15;
@@ -115,7 +115,6 @@ void sound_dirty()
 	S3.len = (256-R_NR31) << 20;
 	s3_freq();
 	S4.len = (64-(R_NR41&63)) << 13;
-	S4.envol = R_NR42 >> 4;
 	S4.endir = (R_NR42>>3) & 1;
 	S4.endir |= S4.endir - 1;
 	S4.enlen = (R_NR42 & 7) << 15;
@@ -10,12 +10,17 @@
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "user_input.h"
 #include "display_HAL.h"
 #include "system_configuration.h"
 #include "system_manager.h"
 #include "sound_driver.h"
+#include "sd_storage.h"
+#include "rewind.h"
+#include "movie.h"
+#include "profiler.h"
 
 // GNUBoy libraries
 
@@ -26,6 +31,7 @@
 #include <cpu.h>
 #include <pcm.h>
 #include <regs.h>
+#include <mem.h>
 #include <rtc.h>
 #include <gnuboy.h>
 #include <sound.h>
@@ -34,7 +40,8 @@
  *  STATIC PROTOTYPES
  **********************/
 static void audioTask(void *arg);
-static void run_to_vblank();
+static void run_to_vblank(bool shown);
+static void run_ahead();
 static void videoTask(void *arg);
 static void gnuBoyTask(void *arg);
 static void input_set();
@@ -83,6 +90,27 @@ volatile unsigned char *currentAudioBufferPtr;
 char * game_name;
 uint8_t console_use;
 
+// Set by gnuboy_save(), the emulator task takes the snapshot between two frames.
+static volatile bool save_request = false;
+// Task waiting for the save of a suspended game, notified once the snapshot is taken.
+static TaskHandle_t volatile save_waiter = NULL;
+// Time given to a suspended game to reach the end of its frame.
+#define SAVE_WAIT_MS 1000
+// Rewind button status, set by input_set() after each frame and on each wait of a rewound one.
+static bool rewind_held = false;
+// Fast-forward button status, while it's held only a few frames are drawn and the audio never blocks.
+static bool fast_forward = false;
+
+// Frames emulated ahead of the shown one at boot, main sets the ones of the game menu with gnuboy_run_ahead().
+#define RUN_AHEAD_FRAMES 0
+#define RUN_AHEAD_MAX 3
+
+// Run-ahead shows a frame emulated past the real one and then restores the real state.
+static volatile uint8_t run_ahead_frames = RUN_AHEAD_FRAMES;
+static uint8_t *run_ahead_state = NULL;
+static int run_ahead_size = 0;
+static uint32_t run_ahead_time = 0;
+
 #define AUDIO_SAMPLE_RATE (16000)
 
 /**********************
@@ -116,21 +144,33 @@ void gnuboy_suspend(){
     vTaskSuspend(audioTask_handler);
 }
 
-/** 
- * TODO: Improve game save.
- * Basically it works, but when you try to save every 30 seconds, the SD card crashed so, it corrupt 
- * the file save. On the other hand I notice that some texture dissapear when the game is saved.
- * */
-
 void gnuboy_save(){
-    gbc_state_save(game_name, console_use);
+    if(eTaskGetState(gnuBoyTask_handler) != eSuspended){
+        save_request = true;
+        return;
+    }
+
+    // A suspended game never reaches the end of its frame, it runs until the snapshot is taken.
+    ulTaskNotifyTake(pdTRUE, 0);
+    save_waiter = xTaskGetCurrentTaskHandle();
+    save_request = true;
+    gnuboy_resume();
+    if(ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SAVE_WAIT_MS)) == 0) ESP_LOGE(TAG,"Save game timeout");
+    gnuboy_suspend();
+    save_waiter = NULL;
+}
+
+void gnuboy_run_ahead(uint8_t frames){
+    if(frames > RUN_AHEAD_MAX) frames = RUN_AHEAD_MAX;
+    ESP_LOGI(TAG,"Run-ahead of %u frames",frames);
+    run_ahead_frames = frames;
 }
 
 bool gnuboy_load_game(const char *name, uint8_t console){
 
     ESP_LOGI(TAG,"Loading GameBoy Color game: %s",name);
 
-    game_name = malloc(strlen(name));
+    game_name = malloc(strlen(name) + 1);
     strcpy(game_name,name);
 
     console_use = console;
@@ -154,11 +194,15 @@ static void videoTask(void *arg){
     ESP_LOGI(TAG, "GNUBoy Video Task Initialize");
     uint16_t *param;
 
+    profiler_register(PROFILER_VIDEO_TASK);
+
     //Send empty frame
     display_HAL_gb_frame(NULL);
     
     while(1){
+        PROFILER_BEGIN();
         xQueuePeek(vidQueue, &param, portMAX_DELAY);
+        PROFILER_END(PROFILER_WAIT);
         display_HAL_gb_frame(param);
         xQueueReceive(vidQueue, &param, portMAX_DELAY);
     }
@@ -172,8 +216,12 @@ static void audioTask(void *arg){
     ESP_LOGI(TAG, "GNUBoy Audio Task Initialize");
     uint16_t *param;
 
+    profiler_register(PROFILER_AUDIO_TASK);
+
     while(1){
+        PROFILER_BEGIN();
         xQueuePeek(audioQueue, &param, portMAX_DELAY);
+        PROFILER_END(PROFILER_WAIT);
         audio_submit((short *)param, currentAudioSampleCount >> 1);
         xQueueReceive(audioQueue, &param, portMAX_DELAY);
     }
@@ -187,6 +235,8 @@ static void gnuBoyTask(void *arg){
 
     ESP_LOGI(TAG, "Initialize GNUBoy task");
 
+    profiler_register(PROFILER_EMULATOR_TASK);
+
     ESP_LOGI(TAG,"Triying to allocated frame buffer on DMA memory.");
     displayBuffer[0] = heap_caps_malloc(160 * 144 * 2,MALLOC_CAP_8BIT | MALLOC_CAP_DMA );
     displayBuffer[1] = heap_caps_malloc(160 * 144 * 2,MALLOC_CAP_8BIT | MALLOC_CAP_DMA );
@@ -286,28 +336,90 @@ static void gnuBoyTask(void *arg){
     uint totalElapsedTime = 0;
     uint actualFrameCount = 0;
 
+    // The movies are kept with the save files.
+    char movie_path[300];
+    if(console_use == GAMEBOY) sprintf(movie_path,"/sdcard/GameBoy/Save_Data/%s.mov",game_name);
+    else sprintf(movie_path,"/sdcard/GameBoy_Color/Save_Data/%s.mov",game_name);
+
+    movie_init(movie_path, gbc_state_size(), gbc_state_snapshot, gbc_state_restore);
+    rewind_init(gbc_state_size(), gbc_state_snapshot, gbc_state_restore);
+
     //TODO: This loop needs to be improved.
     while(1){
+        if(rewind_held && !rewind_pop()){
+            // Keep the rewound frame on screen until the next snapshot is due.
+            input_set();
+            vTaskDelay(1);
+            continue;
+        }
+
         startTime = xthal_get_ccount();
         //Render a frame with audio
-        run_to_vblank();
+        //Yes, skipframe. The rewound frames are always shown.
+        bool shown;
+        if(rewind_held) shown = true;
+        else if(fast_forward) shown = (frame % FAST_FORWARD_SKIP) == 0;
+        else shown = (frame % 2) == 0;
+
+        // The frames the frameskip doesn't show are emulated without run-ahead, its output would be thrown away.
+        if(run_ahead_frames && shown && !rewind_held && !fast_forward && !movie_active()){
+            run_to_vblank(false);
+            run_ahead();
+        }
+        else run_to_vblank(shown);
         stopTime = xthal_get_ccount();
 
         //Get the status of the input buttons
         input_set();
 
+        // The state is copied on RAM here, the SD card is written by the save task.
+        if(save_request){
+            save_request = false;
+            gbc_state_save(game_name, console_use);
+            movie_flush();
+            if(save_waiter != NULL) xTaskNotifyGive(save_waiter);
+        }
+
+        if(!rewind_held && !movie_active()) rewind_push();
+
         if (stopTime > startTime) elapsedTime = (stopTime - startTime);
         else elapsedTime = ((uint64_t)stopTime + (uint64_t)0xffffffff) - (startTime);
 
         totalElapsedTime += elapsedTime;
         actualFrameCount++;
         frame++; //Increase the count of the frame to generate
+        profiler_frame();
 
         if (actualFrameCount == 60){
             float seconds = totalElapsedTime / (CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ * 1000000.0f);
             float fps = actualFrameCount / seconds;
 
             printf("FPS:%f\n", fps);
+            if(fast_forward) printf("Fast-forward: x%.2f\n", fps / 60.0f);
+
+            if(run_ahead_frames){
+                printf("Run-ahead: %u frames, %u us/frame\n", run_ahead_frames, run_ahead_time / actualFrameCount);
+
+                // The extra frames run up to the next vblank each, below 59 FPS drop one of them.
+                if(fps < 59.0f){
+                    run_ahead_frames--;
+                    ESP_LOGW(TAG,"Run-ahead too slow, reduced to %u frames",run_ahead_frames);
+                }
+            }
+            run_ahead_time = 0;
+
+            rewind_report(60);
+
+            if(rom.cache){
+                sd_bank_stats_t stats;
+                sd_bank_cache_stats(rom.cache, &stats);
+                uint32_t total = stats.hits + stats.misses;
+                printf("ROM cache: %u%% hits, %u misses, %u prefetched, %u ms stalled\n",
+                       total ? (uint32_t)(stats.hits * 100ULL / total) : 0, stats.misses,
+                       stats.prefetches, (uint32_t)(stats.stall_us / 1000));
+            }
+
+            profiler_report();
 
             actualFrameCount = 0;
             totalElapsedTime = 0;
@@ -317,15 +429,19 @@ static void gnuBoyTask(void *arg){
 }
 
 
-static void run_to_vblank(){
+static void run_to_vblank(bool shown){
    //Frame and sound generation
 
+    fb.enabled = shown;
+
+    // The lines drawn by the LCD are counted on their own phase.
+    PROFILER_BEGIN();
     cpu_emulate(32832);
 
     while (R_LY > 0 && R_LY < 144) emu_step(); // Step through visible line scanning phase 
+    PROFILER_END(PROFILER_CPU);
 
-    //Yes, skipframe.
-    if ((frame % 2) == 0)
+    if (fb.enabled)
     {
         xQueueSend(vidQueue, &framebuffer, 0);
 
@@ -339,13 +455,22 @@ static void run_to_vblank(){
     rtc_tick();
 
     //Generate the sound for each frame
+    PROFILER_BEGIN();
     sound_mix();
+    PROFILER_END(PROFILER_AUDIO);
 
-    if (pcm.pos > 100){
+    // Without buffer the frame is muted, its samples are dropped.
+    // While fast-forwarding the samples are dropped if the audio task is busy, instead of waiting for it.
+    if (pcm.buf && pcm.pos > 100 && fast_forward && uxQueueSpacesAvailable(audioQueue) == 0){
+        pcm.pos = 0;
+    }
+    else if (pcm.buf && pcm.pos > 100){
         currentAudioBufferPtr = audioBuffer[currentAudioBuffer];
         currentAudioSampleCount = pcm.pos;
 
+        PROFILER_BEGIN();
         xQueueSend(audioQueue, &currentAudioBufferPtr, portMAX_DELAY);
+        PROFILER_END(PROFILER_WAIT);
 
         // Swap buffers
         currentAudioBuffer = currentAudioBuffer ? 0 : 1;
@@ -353,15 +478,57 @@ static void run_to_vblank(){
         pcm.pos = 0;
     }
 
+    PROFILER_BEGIN();
     if (!(R_LCDC & 0x80)) cpu_emulate(32832);
 
     while (R_LY > 0) emu_step(); // Step through vblank phase 
+    PROFILER_END(PROFILER_CPU);
  
 }
 
+/* Function: run_ahead
+ * ---------------------
+ * Emulate the run-ahead frames after a shown frame with the audio muted,
+ * drawing only the last one, and go back to the real state. The input
+ * shows up on screen that many frames earlier.
+ */
+static void run_ahead(){
+    int64_t start_time = esp_timer_get_time();
+
+    if(run_ahead_state == NULL){
+        run_ahead_size = gbc_state_size();
+        // The internal RAM is left to the emulator, like the rewind and movie buffers.
+        run_ahead_state = heap_caps_malloc(run_ahead_size, MALLOC_CAP_SPIRAM);
+
+        if(run_ahead_state == NULL){
+            ESP_LOGE(TAG,"Not enough PSRAM for run-ahead, disabled.");
+            run_ahead_frames = 0;
+            return;
+        }
+    }
+
+    int length = gbc_state_snapshot(run_ahead_state, run_ahead_size);
+    if(length < 0){
+        ESP_LOGE(TAG,"Error creating the run-ahead state.");
+        return;
+    }
+
+    int16_t *buffer = pcm.buf;
+    pcm.buf = NULL;
+
+    for(int i = 1; i <= run_ahead_frames; i++) run_to_vblank(i == run_ahead_frames);
+
+    if(!gbc_state_restore(run_ahead_state, length)) ESP_LOGE(TAG,"Error restoring the run-ahead state.");
+    pcm.buf = buffer;
+
+    run_ahead_time += esp_timer_get_time() - start_time;
+}
+
 static void input_set(){
 
-    uint16_t inputs_value =  input_read();
+    uint16_t hotkeys = input_read();
+    // While a movie is recorded or replayed the hotkeys are ignored, they change the emulation.
+    uint16_t inputs_value = movie_input(hotkeys);
 #if 0
     pad_set(PAD_DOWN,!((inputs_value >> 0) & 0x01));
     pad_set(PAD_LEFT,!((inputs_value >> 1) & 0x01));
@@ -381,5 +548,8 @@ static void input_set(){
     pad_set(PAD_START,!((inputs_value >> 0) & 0x01));
     pad_set(PAD_SELECT,!((inputs_value >> 1) & 0x01));
 #endif
+
+    rewind_held = !movie_active() && !((hotkeys >> REWIND_BUTTON) & 0x01);
+    fast_forward = !movie_active() && !((hotkeys >> FAST_FORWARD_BUTTON) & 0x01);
 }
 
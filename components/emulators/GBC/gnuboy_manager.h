@@ -38,7 +38,8 @@ void gnuboy_suspend();
  * Function:  gnuboy_save 
  * --------------------
  * 
- * Save the progress of the game into a file on the SD card.
+ * Save the progress of the game into a file on the SD card. A suspended game is
+ * resumed until the snapshot is taken.
  * 
  *  Returns: Nothing
  */
@@ -56,4 +57,19 @@ void gnuboy_save();
  * 
  *  Returns: Nothing
  */
-bool gnuboy_load_game(const char *name, uint8_t console);
\ No newline at end of file
+bool gnuboy_load_game(const char *name, uint8_t console);
+
+/*
+ * Function:  gnuboy_run_ahead 
+ * --------------------
+ * 
+ * Emulate some frames ahead of the real one and show the last of them, removing
+ * that many frames of input latency. It costs a state save and load plus the extra
+ * frames on every shown frame, if the game can't keep 60 FPS the frames are reduced.
+ * 
+ * Arguments:
+ * -frames: Frames to run ahead, up to 3. 0 disables it.
+ * 
+ *  Returns: Nothing
+ */
+void gnuboy_run_ahead(uint8_t frames);
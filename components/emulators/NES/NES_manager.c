@@ -21,6 +21,7 @@
 #include <nofrendo.h>
 #include <event.h>
 #include <nofconfig.h>
+#include <nesstate.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/timers.h>
@@ -28,12 +29,16 @@
 #include <freertos/queue.h>
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "sd_storage.h"
 #include "display_HAL.h"
 #include "user_input.h"
 #include "sound_driver.h"
 #include "system_manager.h"
+#include "rewind.h"
+#include "movie.h"
+#include "profiler.h"
 
 
 /*********************
@@ -43,6 +48,9 @@
 #define DEFAULT_SAMPLERATE 16000
 #define DEFAULT_FRAGSIZE 128
 
+// Mono samples generated by the APU on every emulated frame.
+#define AUDIO_FRAME_SAMPLES (DEFAULT_SAMPLERATE / NES_REFRESH_RATE)
+
 #define DEFAULT_WIDTH 240
 #define DEFAULT_HEIGHT 240
 
@@ -78,11 +86,34 @@ static bitmap_t *lock_write(void);
 static void free_write(int num_dirties, rect_t *dirty_rects);
 
 static void do_audio_frame();
+static void save_snapshot();
+static bool rewind_load(const void *buffer, int size);
 
 static void timer_isr(void);
 
 static nes_t *nes;
 
+// Time at which the game started loading, cleared once the first frame is shown.
+static int64_t boot_time = 0;
+
+// Set by NES_save_game(), the emulator task takes the snapshot between two frames.
+static volatile bool save_request = false;
+// Task waiting for the save of a suspended game, notified once the snapshot is taken.
+static TaskHandle_t volatile save_waiter = NULL;
+// Time given to a suspended game to reach the end of its frame.
+#define SAVE_WAIT_MS 1000
+static char save_path[300];
+static char movie_path[300];
+// SNSS state read by NES_load_game(), restored once the machine is created.
+static uint8_t *save_data = NULL;
+static size_t save_size = 0;
+
+// Rewind button status, set by osd_getinput() when nofrendo polls the pad.
+static bool rewind_held = false;
+// Fast-forward button status, while it's held the skipped frames aren't sent to the display.
+static bool fast_forward = false;
+static bool skip_blit = false;
+
 
 /**********************
  *  TASK & TIMER HANDLERS
@@ -120,8 +151,12 @@ QueueHandle_t audioQueue;
  *   GLOBAL VARIABLES
  **********************/
 
+// Mono buffers filled by the APU on the emulation core.
+static int16_t *audioBuffer[2];
+static volatile uint8_t audioBuffer_num = 0;
+
+// Stereo DMA buffer used by the audio task to feed the I2S driver.
 static int16_t *audio_frame;
-int audioFrame;
 
 uint16 myPalette[256];
 
@@ -142,11 +177,13 @@ void NES_start(){
 
     // Queue creation
     vidQueue = xQueueCreate(10, sizeof(bitmap_t *));
-    audioQueue = xQueueCreate(1, sizeof(uint16_t *));
+    audioQueue = xQueueCreate(1, sizeof(int16_t *));
 
     //Execute emulator tasks.
     xTaskCreatePinnedToCore(&videoTask, "videoTask", 2048, NULL, 4, &videoTask_handler, 1);
-    //xTaskCreatePinnedToCore(&audioTask, "audioTask", 2048, NULL, 1, &audioTask_handler, 1);
+    // The audio task has a higher priority than the video one, it only wakes up once per frame
+    // and an underrun on the I2S DMA buffer is more noticeable than a late frame.
+    xTaskCreatePinnedToCore(&audioTask, "audioTask", 2048, NULL, 5, &audioTask_handler, 1);
     xTaskCreatePinnedToCore(&nofrendoTask, "nofrendoTask", 1024*5, NULL, 1, &nofrendoTask_handler, 0);
 
 }
@@ -154,7 +191,7 @@ void NES_start(){
 void NES_resume(){
     ESP_LOGI(TAG,"NES Resume");
     vTaskResume(videoTask_handler);
-    //vTaskResume(audioTask_handler);
+    vTaskResume(audioTask_handler);
     vTaskResume(nofrendoTask_handler);
 }
 
@@ -162,30 +199,42 @@ void NES_suspend(){
     ESP_LOGI(TAG,"NES Suspend");
     vTaskSuspend(nofrendoTask_handler);
     vTaskSuspend(videoTask_handler);
-    //vTaskSuspend(audioTask_handler);
+    vTaskSuspend(audioTask_handler);
 }
 
 void NES_load_game(const char *game_name){
     ESP_LOGI(TAG,"NES loading ROM: %s",game_name);
 
+    boot_time = esp_timer_get_time();
+
     char game_route[256];
 	sprintf(game_route,"/sdcard/NES/%s",game_name);
 
-    //Get the file size
-    size_t game_size = sd_file_size(game_route);
-
-    //Allocate the memory and clean it.
-	data = malloc(game_size);
-	memset(data,0,game_size);
-
-	sd_get_file(game_route,data);
-
-    //TODO: Add load save state.
+    //Allocate exactly the size of the game and read it.
+	data = sd_load_file(game_route,0,0,NULL);
+	if(data == NULL) ESP_LOGE(TAG,"Fail loading game.");
 
+    sprintf(save_path,"/sdcard/NES/Save_Data/%s.sav",game_name);
+    sprintf(movie_path,"/sdcard/NES/Save_Data/%s.mov",game_name);
+    save_data = sd_save_read(save_path,&save_size);
+    if(save_data != NULL) ESP_LOGI(TAG,"Found save game file of the ROM: %s",game_name);
+    else ESP_LOGW(TAG,"Any save game available for this ROM.");
 }
 
 void NES_save_game(){
-    //TODO: Implement save state
+    if(eTaskGetState(nofrendoTask_handler) != eSuspended){
+        save_request = true;
+        return;
+    }
+
+    // A suspended game never reaches the end of its frame, it runs until the snapshot is taken.
+    ulTaskNotifyTake(pdTRUE, 0);
+    save_waiter = xTaskGetCurrentTaskHandle();
+    save_request = true;
+    NES_resume();
+    if(ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SAVE_WAIT_MS)) == 0) ESP_LOGE(TAG,"Save game timeout");
+    NES_suspend();
+    save_waiter = NULL;
 }
 /**********************
  *   STATIC FUNCTIONS
@@ -196,6 +245,8 @@ static void timer_isr(void){
 }
 
 static void nofrendoTask(void *arg){
+    profiler_register(PROFILER_EMULATOR_TASK);
+
     if (log_init()) return -1;
 
    event_init();
@@ -246,11 +297,29 @@ static void nofrendoTask(void *arg){
         system_video(1);
     }
 
+    if(save_data != NULL){
+        if(state_load_mem(save_data, save_size) != 0) ESP_LOGE(TAG,"Error loading the save game, starting a new game.");
+        free(save_data);
+        save_data = NULL;
+    }
+
+    movie_init(movie_path, state_size(), state_save_mem, rewind_load);
+    rewind_init(state_size(), state_save_mem, rewind_load);
+
     while (1){
+        if(rewind_held && !rewind_pop()){
+            // Keep the rewound frame on screen until the next snapshot is due.
+            osd_getinput();
+            vTaskDelay(1);
+            continue;
+        }
+
         startTime = xthal_get_ccount();
 
         bool renderFrame;
-        if(skipFrame % 7 == 0){
+        if(rewind_held) renderFrame = true;
+        else if(fast_forward) renderFrame = (frame % FAST_FORWARD_SKIP) == 0;
+        else if(skipFrame % 7 == 0){
             skipFrame++;
             renderFrame = false;
         }
@@ -259,10 +328,24 @@ static void nofrendoTask(void *arg){
             renderFrame = true;
         }
 
+        skip_blit = fast_forward && !renderFrame;
+
+        // The PPU scanlines are counted on their own phase.
+        PROFILER_BEGIN();
         nes_renderframe(renderFrame);
+        PROFILER_END(PROFILER_CPU);
         system_video(renderFrame);
 
         do_audio_frame();
+
+        if(save_request){
+            save_request = false;
+            save_snapshot();
+            movie_flush();
+            if(save_waiter != NULL) xTaskNotifyGive(save_waiter);
+        }
+
+        if(!rewind_held && !movie_active()) rewind_push();
         
         stopTime = xthal_get_ccount();
 
@@ -274,6 +357,7 @@ static void nofrendoTask(void *arg){
 
         totalElapsedTime += elapsedTime;
          ++frame;
+        profiler_frame();
         
 
         if (frame == 60)
@@ -282,6 +366,11 @@ static void nofrendoTask(void *arg){
             float fps = frame / seconds;
 
             printf("FPS:%f\n",fps);
+            if(fast_forward) printf("Fast-forward: x%.2f\n", fps / NES_REFRESH_RATE);
+
+            rewind_report(NES_REFRESH_RATE);
+
+            profiler_report();
 
             frame = 0;
             totalElapsedTime = 0;
@@ -289,6 +378,41 @@ static void nofrendoTask(void *arg){
     }
 }
 
+/* Function: save_snapshot
+ * ---------------------
+ * Serialize the machine into a SNSS state on RAM and queue it to the save
+ * task, the SD card is written on the other core.
+ */
+static void save_snapshot(){
+    int64_t start_time = esp_timer_get_time();
+
+    int size = state_size();
+    uint8_t *buffer = malloc(size);
+    if(buffer == NULL){
+        ESP_LOGE(TAG,"Not enough memory for the save snapshot.");
+        return;
+    }
+
+    int length = state_save_mem(buffer, size);
+    if(length < 0){
+        ESP_LOGE(TAG,"Error creating the save snapshot.");
+        free(buffer);
+        return;
+    }
+
+    ESP_LOGI(TAG,"Save snapshot: %i bytes in %lli us",length,esp_timer_get_time() - start_time);
+
+    if(!sd_save_write(save_path, buffer, length)) free(buffer);
+}
+
+/* Function: rewind_load
+ * ---------------------
+ * Restore a rewind or movie snapshot, they use the same SNSS format as the save files.
+ */
+static bool rewind_load(const void *buffer, int size){
+    return state_load_mem((void *)buffer, size) == 0;
+}
+
 char *osd_getromdata() {
     printf("Initialized. ROM@%p\n", data);
     return (char*)data;
@@ -299,10 +423,17 @@ char *osd_getromdata() {
 static void videoTask(void *arg){
     ESP_LOGI(TAG, "nofrendo Video Task Initialize");
 	bitmap_t *bmp = NULL;
+    profiler_register(PROFILER_VIDEO_TASK);
     display_HAL_NES_frame(NULL);
 	while (1){
+		PROFILER_BEGIN();
 		xQueueReceive(vidQueue, &bmp, portMAX_DELAY);
+		PROFILER_END(PROFILER_WAIT);
 		display_HAL_NES_frame((const uint8_t **)bmp->line[0]);
+		if(boot_time){
+			ESP_LOGI(TAG,"Boot to first frame: %lli ms",(esp_timer_get_time() - boot_time) / 1000);
+			boot_time = 0;
+		}
 	}
 }
 
@@ -345,7 +476,7 @@ static void free_write(int num_dirties, rect_t *dirty_rects){
 }
 
 static void custom_blit(bitmap_t *bmp, int num_dirties, rect_t *dirty_rects){
-	xQueueSend(vidQueue, &bmp, 0);	
+	if(!skip_blit) xQueueSend(vidQueue, &bmp, 0);	
 }
 
 
@@ -353,31 +484,52 @@ static void custom_blit(bitmap_t *bmp, int num_dirties, rect_t *dirty_rects){
 static void audioTask(void *arg){
     
     ESP_LOGI(TAG, "nofrendo Audio Task Initialize");
-    uint16_t *param;
+    int16_t *param;
+
+    profiler_register(PROFILER_AUDIO_TASK);
 
     while(1){
-		xQueueReceive(audioQueue, &param, portMAX_DELAY);
-        do_audio_frame();
+        // The buffer is kept on the queue until it's sent, so the emulator can't overwrite it.
+        PROFILER_BEGIN();
+		xQueuePeek(audioQueue, &param, portMAX_DELAY);
+        PROFILER_END(PROFILER_WAIT);
+
+        int left = AUDIO_FRAME_SAMPLES;
+        int16_t *mono = param;
+        while(left){
+            int n = DEFAULT_FRAGSIZE;
+            if (n > left) n = left;
+            //16 bit mono -> 32-bit (16 bit r+l)
+            PROFILER_BEGIN();
+            for (int i = 0; i < n; i++){
+                audio_frame[i*2] = mono[i];
+                audio_frame[i*2+1] = mono[i];
+            }
+            PROFILER_END(PROFILER_AUDIO);
+            audio_submit(audio_frame, n);
+            mono += n;
+            left -= n;
+        }
+
+        xQueueReceive(audioQueue, &param, portMAX_DELAY);
     }
 }
 
 static void do_audio_frame(){
-	int left=DEFAULT_SAMPLERATE/NES_REFRESH_RATE;
-    while(left) {
-        int n=DEFAULT_FRAGSIZE;
-        if (n>left) n=left;
-        audio_callback(audio_frame, n);
-        //16 bit mono -> 32-bit (16 bit r+l)
-        for (int i=n-1; i>=0; i--)
-        {
-            int sample = (int)audio_frame[i];
-
-            audio_frame[i*2]= (short)sample;
-            audio_frame[i*2+1] = (short)sample;
-        }
-        audio_submit(audio_frame, n);
-        left-=n;
-    }
+    // Only the APU synthesis runs on the emulation core, the stereo conversion, volume and 
+    // I2S write are done by the audio task on the other core.
+    int16_t *buffer = audioBuffer[audioBuffer_num];
+    PROFILER_BEGIN();
+    audio_callback(buffer, AUDIO_FRAME_SAMPLES);
+    PROFILER_END(PROFILER_AUDIO);
+
+    // It only blocks if the audio task is still playing the previous frame, while
+    // fast-forwarding that frame is dropped instead and the buffer is reused.
+    PROFILER_BEGIN();
+    bool sent = xQueueSend(audioQueue, &buffer, fast_forward ? 0 : portMAX_DELAY) == pdTRUE;
+    PROFILER_END(PROFILER_WAIT);
+
+    if(sent) audioBuffer_num = audioBuffer_num ? 0 : 1;
 }
 
 void osd_setsound(void (*playfunc)(void *buffer, int length)){
@@ -391,6 +543,14 @@ static void osd_stopsound(void){
 
 static int osd_init_sound(void){
 	audio_frame = heap_caps_malloc(4 * DEFAULT_FRAGSIZE, MALLOC_CAP_8BIT | MALLOC_CAP_DMA);
+    audioBuffer[0] = heap_caps_malloc(AUDIO_FRAME_SAMPLES * sizeof(int16_t), MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    audioBuffer[1] = heap_caps_malloc(AUDIO_FRAME_SAMPLES * sizeof(int16_t), MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+
+    if(audio_frame == NULL || audioBuffer[0] == NULL || audioBuffer[1] == NULL){
+        ESP_LOGE(TAG,"Audio buffer allocation error, abort emulator run.");
+        abort();
+    }
+
 	audio_callback = NULL;
 	return 0;
 }
@@ -409,7 +569,9 @@ int osd_installtimer(int frequency, void *func){
 
 void osd_getinput(void)
 {
-	uint16_t b = input_read();
+	uint16_t input = input_read();
+	// While a movie is recorded or replayed the hotkeys are ignored, they change the emulation.
+	uint16_t b = movie_input(input);
 
 	const int ev[16] = {
         #if 0
@@ -426,6 +588,9 @@ void osd_getinput(void)
 	oldb = b;
 	event_t evh;
 
+	rewind_held = !movie_active() && !((input >> REWIND_BUTTON) & 0x01);
+	fast_forward = !movie_active() && !((input >> FAST_FORWARD_BUTTON) & 0x01);
+
 	for (x = 0; x < 16; x++)
 	{
 		if (chg & 1)
@@ -51,7 +51,9 @@ void NES_load_game(const char *game_name);
  * Function:  NES_save_game 
  * --------------------
  * 
- * Save the progress of the game into a file on the SD card.
+ * Save the progress of the game into a file on the SD card. The state is copied
+ * at the end of the current frame and written on the background, a suspended game
+ * is resumed until then.
  * 
  *  Returns: Nothing
  */
@@ -58,6 +58,11 @@ swap16(unsigned short source)
 
 /**************************************************************************/
 
+static SNSS_RETURN_CODE
+SNSS_OpenStream(SNSS_FILE **snssFile, FILE *fp, SNSS_OPEN_MODE mode);
+
+/**************************************************************************/
+
 static SNSS_RETURN_CODE
 SNSS_ReadBlockHeader(SnssBlockHeader *header, SNSS_FILE *snssFile)
 {
@@ -203,9 +208,37 @@ SNSS_WriteFileHeader(SNSS_FILE *snssFile)
 SNSS_RETURN_CODE
 SNSS_OpenFile(SNSS_FILE **snssFile, const char *filename, SNSS_OPEN_MODE mode)
 {
+   FILE *fp = fopen(filename, (SNSS_OPEN_READ == mode) ? "rb" : "wb");
+
+   return SNSS_OpenStream(snssFile, fp, mode);
+}
+
+/**************************************************************************/
+
+SNSS_RETURN_CODE
+SNSS_OpenMemory(SNSS_FILE **snssFile, void *buffer, unsigned int size, SNSS_OPEN_MODE mode)
+{
+   FILE *fp = fmemopen(buffer, size, (SNSS_OPEN_READ == mode) ? "rb" : "wb");
+
+   return SNSS_OpenStream(snssFile, fp, mode);
+}
+
+/**************************************************************************/
+
+static SNSS_RETURN_CODE
+SNSS_OpenStream(SNSS_FILE **snssFile, FILE *fp, SNSS_OPEN_MODE mode)
+{
+   *snssFile = NULL;
+
+   if (NULL == fp)
+   {
+      return SNSS_OPEN_FAILED;
+   }
+
    *snssFile = malloc(sizeof(SNSS_FILE));
    if (NULL == *snssFile)
    {
+      fclose(fp);
       return SNSS_OUT_OF_MEMORY;
    }
 
@@ -213,23 +246,7 @@ SNSS_OpenFile(SNSS_FILE **snssFile, const char *filename, SNSS_OPEN_MODE mode)
    memset(*snssFile, 0, sizeof(SNSS_FILE));
 
    (*snssFile)->mode = mode;
-
-   if (SNSS_OPEN_READ == mode)
-   {
-      (*snssFile)->fp = fopen(filename, "rb");
-   }
-   else
-   {
-      (*snssFile)->fp = fopen(filename, "wb");
-      (*snssFile)->headerBlock.numberOfBlocks = 0;
-   }
-
-   if (NULL == (*snssFile)->fp)
-   {
-      free(*snssFile);
-      *snssFile = NULL;
-      return SNSS_OPEN_FAILED;
-   }
+   (*snssFile)->fp = fp;
 
    if (SNSS_OPEN_READ == mode)
    {
@@ -37,6 +37,7 @@
 #include <vid_drv.h>
 #include <nes_pal.h>
 #include <nesinput.h>
+#include "profiler.h"
 
 
 /* PPU access */
@@ -1084,7 +1085,9 @@ void ppu_scanline(bitmap_t *bmp, int scanline, bool draw_flag)
    {
       /* Lower the Max Sprite per scanline flag */
       ppu.stat &= ~PPU_STATF_MAXSPRITE;
+      PROFILER_BEGIN();
       ppu_renderscanline(bmp, scanline, draw_flag);
+      PROFILER_END(PROFILER_RENDER);
    }
    else if (241 == scanline)
    {
@@ -268,6 +268,11 @@ static void load_baseblock(nes_t *state, SNSS_FILE *snssFile)
    ppu_write(PPU_CTRL1, state->ppu->ctrl1);
    ppu_write(PPU_VADDR, (uint8) (state->ppu->vaddr >> 8));
    ppu_write(PPU_VADDR, (uint8) (state->ppu->vaddr & 0xFF));
+
+   /* $2006 drops the top bit of the fine y scroll, restore all of it */
+   ppu_getcontext(state->ppu);
+   state->ppu->vaddr = snssFile->baseBlock.vramAddress;
+   ppu_setcontext(state->ppu);
 }
 
 static void load_vramblock(nes_t *state, SNSS_FILE *snssFile)
@@ -337,114 +342,66 @@ static void load_mapperblock(nes_t *state, SNSS_FILE *snssFile)
 }
 
 
-int state_save(void)
+/* write all the blocks of the machine to an open state */
+static SNSS_RETURN_CODE state_write(nes_t *machine, SNSS_FILE *snssFile)
 {
-   SNSS_FILE *snssFile;
    SNSS_RETURN_CODE status;
-   char fn[PATH_MAX + 1], ext[5];
-   nes_t *machine;
 
-   /* get the pointer to our NES machine context */
-   machine = nes_getcontextptr();
-   ASSERT(machine);
-   
-   /* build our filename using the image's name and the slot number */
-   strncpy(fn, machine->rominfo->filename, PATH_MAX - 4);
-   
-   ASSERT(state_slot >= FIRST_STATE_SLOT && state_slot <= LAST_STATE_SLOT);
-   sprintf(ext, ".ss%d", state_slot);
-   osd_newextension(fn, ext);
-
-   /* open our state file for writing */
-   status = SNSS_OpenFile(&snssFile, fn, SNSS_OPEN_WRITE);
-   if (SNSS_OK != status)
-      goto _error;
-
-   /* now get all of our blocks */
    if (0 == save_baseblock(machine, snssFile))
    {
       status = SNSS_WriteBlock(snssFile, SNSS_BASR);
       if (SNSS_OK != status)
-         goto _error;
+         return status;
    }
 
    if (0 == save_vramblock(machine, snssFile))
    {
       status = SNSS_WriteBlock(snssFile, SNSS_VRAM);
       if (SNSS_OK != status)
-         goto _error;
+         return status;
    }
 
    if (0 == save_sramblock(machine, snssFile))
    {
       status = SNSS_WriteBlock(snssFile, SNSS_SRAM);
       if (SNSS_OK != status)
-         goto _error;
+         return status;
    }
 
    if (0 == save_soundblock(machine, snssFile))
    {
       status = SNSS_WriteBlock(snssFile, SNSS_SOUN);
       if (SNSS_OK != status)
-         goto _error;
+         return status;
    }
 
    if (0 == save_mapperblock(machine, snssFile))
    {
       status = SNSS_WriteBlock(snssFile, SNSS_MPRD);
       if (SNSS_OK != status)
-         goto _error;
+         return status;
    }
 
-   /* close the file, we're done */
-   status = SNSS_CloseFile(&snssFile);
-   if (SNSS_OK != status)
-      goto _error;
-
-   gui_sendmsg(GUI_GREEN, "State %d saved", state_slot);
-   return 0;
-
-_error:
-   gui_sendmsg(GUI_RED, "error: %s", SNSS_GetErrorString(status));
-   SNSS_CloseFile(&snssFile);
-   return -1;
+   return SNSS_OK;
 }
 
-int state_load(void)
+/* restore the machine from all the blocks of an open state */
+static SNSS_RETURN_CODE state_read(nes_t *machine, SNSS_FILE *snssFile)
 {
-   SNSS_FILE *snssFile;
    SNSS_RETURN_CODE status;
    SNSS_BLOCK_TYPE block_type;
-   char fn[PATH_MAX + 1], ext[5];
    unsigned int i;
-   nes_t *machine;
-
-   /* get our machine's context pointer */
-   machine = nes_getcontextptr();
-   ASSERT(machine);
-
-   /* build the state name using the ROM's name and the slot number */
-   strncpy(fn, machine->rominfo->filename, PATH_MAX - 4);
-
-   ASSERT(state_slot >= FIRST_STATE_SLOT && state_slot <= LAST_STATE_SLOT);
-   sprintf(ext, ".ss%d", state_slot);
-   osd_newextension(fn, ext);
-   
-   /* open our file for writing */
-   status = SNSS_OpenFile(&snssFile, fn, SNSS_OPEN_READ);
-   if (SNSS_OK != status)
-      goto _error;
 
    /* iterate through all present blocks */
    for (i = 0; i < snssFile->headerBlock.numberOfBlocks; i++)
    {
       status = SNSS_GetNextBlockType(&block_type, snssFile);
       if (SNSS_OK != status)
-         goto _error;
+         return status;
 
       status = SNSS_ReadBlock(snssFile, block_type);
       if (SNSS_OK != status)
-         goto _error;
+         return status;
 
       switch (block_type)
       {
@@ -479,6 +436,78 @@ int state_load(void)
       }
    }
 
+   return SNSS_OK;
+}
+
+int state_save(void)
+{
+   SNSS_FILE *snssFile;
+   SNSS_RETURN_CODE status;
+   char fn[PATH_MAX + 1], ext[5];
+   nes_t *machine;
+
+   /* get the pointer to our NES machine context */
+   machine = nes_getcontextptr();
+   ASSERT(machine);
+   
+   /* build our filename using the image's name and the slot number */
+   strncpy(fn, machine->rominfo->filename, PATH_MAX - 4);
+   
+   ASSERT(state_slot >= FIRST_STATE_SLOT && state_slot <= LAST_STATE_SLOT);
+   sprintf(ext, ".ss%d", state_slot);
+   osd_newextension(fn, ext);
+
+   /* open our state file for writing */
+   status = SNSS_OpenFile(&snssFile, fn, SNSS_OPEN_WRITE);
+   if (SNSS_OK != status)
+      goto _error;
+
+   /* now get all of our blocks */
+   status = state_write(machine, snssFile);
+   if (SNSS_OK != status)
+      goto _error;
+
+   /* close the file, we're done */
+   status = SNSS_CloseFile(&snssFile);
+   if (SNSS_OK != status)
+      goto _error;
+
+   gui_sendmsg(GUI_GREEN, "State %d saved", state_slot);
+   return 0;
+
+_error:
+   gui_sendmsg(GUI_RED, "error: %s", SNSS_GetErrorString(status));
+   SNSS_CloseFile(&snssFile);
+   return -1;
+}
+
+int state_load(void)
+{
+   SNSS_FILE *snssFile;
+   SNSS_RETURN_CODE status;
+   char fn[PATH_MAX + 1], ext[5];
+   nes_t *machine;
+
+   /* get our machine's context pointer */
+   machine = nes_getcontextptr();
+   ASSERT(machine);
+
+   /* build the state name using the ROM's name and the slot number */
+   strncpy(fn, machine->rominfo->filename, PATH_MAX - 4);
+
+   ASSERT(state_slot >= FIRST_STATE_SLOT && state_slot <= LAST_STATE_SLOT);
+   sprintf(ext, ".ss%d", state_slot);
+   osd_newextension(fn, ext);
+   
+   /* open our file for writing */
+   status = SNSS_OpenFile(&snssFile, fn, SNSS_OPEN_READ);
+   if (SNSS_OK != status)
+      goto _error;
+
+   status = state_read(machine, snssFile);
+   if (SNSS_OK != status)
+      goto _error;
+
    /* close file, we're done */
    status = SNSS_CloseFile(&snssFile);
    if (SNSS_OK != status)
@@ -494,6 +523,76 @@ _error:
    return -1;
 }
 
+/* biggest state in bytes, no block is bigger on disk than its structure */
+int state_size(void)
+{
+   return 8 + 5 * 12 + sizeof(SnssBaseBlock) + sizeof(SnssVramBlock)
+          + sizeof(SnssSramBlock) + sizeof(SnssSoundBlock) + sizeof(SnssMapperBlock);
+}
+
+/* write the SNSS state to a buffer of state_size() bytes, returns its length */
+int state_save_mem(void *buffer, int size)
+{
+   SNSS_FILE *snssFile;
+   SNSS_RETURN_CODE status;
+   nes_t *machine;
+   int length;
+
+   machine = nes_getcontextptr();
+   ASSERT(machine);
+
+   status = SNSS_OpenMemory(&snssFile, buffer, size, SNSS_OPEN_WRITE);
+   if (SNSS_OK != status)
+      goto _error;
+
+   status = state_write(machine, snssFile);
+   if (SNSS_OK != status)
+      goto _error;
+
+   length = ftell(snssFile->fp);
+
+   status = SNSS_CloseFile(&snssFile);
+   if (SNSS_OK != status)
+      goto _error;
+
+   return length;
+
+_error:
+   log_printf("state_save_mem: %s\n", SNSS_GetErrorString(status));
+   SNSS_CloseFile(&snssFile);
+   return -1;
+}
+
+/* restore the machine from a SNSS state held in memory */
+int state_load_mem(void *buffer, int size)
+{
+   SNSS_FILE *snssFile;
+   SNSS_RETURN_CODE status;
+   nes_t *machine;
+
+   machine = nes_getcontextptr();
+   ASSERT(machine);
+
+   status = SNSS_OpenMemory(&snssFile, buffer, size, SNSS_OPEN_READ);
+   if (SNSS_OK != status)
+      goto _error;
+
+   status = state_read(machine, snssFile);
+   if (SNSS_OK != status)
+      goto _error;
+
+   status = SNSS_CloseFile(&snssFile);
+   if (SNSS_OK != status)
+      goto _error;
+
+   return 0;
+
+_error:
+   log_printf("state_load_mem: %s\n", SNSS_GetErrorString(status));
+   SNSS_CloseFile(&snssFile);
+   return -1;
+}
+
 /*
 ** $Log: nesstate.c,v $
 ** Revision 1.2  2001/04/27 14:37:11  neil
@@ -31,6 +31,9 @@
 extern void state_setslot(int slot);
 extern int state_load();
 extern int state_save();
+extern int state_size(void);
+extern int state_save_mem(void *buffer, int size);
+extern int state_load_mem(void *buffer, int size);
 
 #endif /* _NESSTATE_H_ */
 
@@ -12,12 +12,17 @@
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "user_input.h"
 #include "display_HAL.h"
 #include "system_configuration.h"
 #include "system_manager.h"
 #include "sound_driver.h"
+#include "sd_storage.h"
+#include "rewind.h"
+#include "movie.h"
+#include "profiler.h"
 
 #include "shared.h"
 
@@ -26,6 +31,16 @@
  *********************/
 #define AUDIO_SAMPLE_RATE (16000)
 
+#define SMS_FRAME_WIDTH 256
+#define SMS_FRAME_HEIGHT 192
+
+#define GG_FRAME_WIDTH 160
+#define GG_FRAME_HEIGHT 144
+
+// Frames emulated ahead of the shown one at boot, main sets the ones of the game menu with SMS_run_ahead().
+#define RUN_AHEAD_FRAMES 0
+#define RUN_AHEAD_MAX 3
+
 /**********************
  *  STATIC PROTOTYPES
  **********************/
@@ -33,6 +48,10 @@ static void audioTask(void *arg);
 static void videoTask(void *arg);
 static void SMSTask(void *arg);
 static void input_set();
+static void save_snapshot();
+static int rewind_save(void *buffer, int size);
+static bool rewind_load(const void *buffer, int size);
+static void run_ahead();
 
 
 /**********************
@@ -63,8 +82,36 @@ volatile uint8_t audioBuffer_num = 0;
 volatile unsigned char *audioBuffer_ptr;
 volatile uint16_t audioBufferCount = 0;
 
+int16_t *fmBuffer;
+volatile uint32_t fm_cycles = 0;
+volatile uint32_t fm_frames = 0;
+
 bool GAME_GEAR = false;
 
+// Time at which the game started loading, cleared once the first frame is shown.
+static int64_t boot_time = 0;
+
+// Set by SMS_save_game(), the emulator task takes the snapshot between two frames.
+static volatile bool save_request = false;
+// Task waiting for the save of a suspended game, notified once the snapshot is taken.
+static TaskHandle_t volatile save_waiter = NULL;
+// Time given to a suspended game to reach the end of its frame.
+#define SAVE_WAIT_MS 1000
+// State read by SMS_load_game(), restored once the emulator is initialized.
+static uint8_t *save_data = NULL;
+static size_t save_size = 0;
+static char movie_path[300];
+
+// Rewind button status, set by input_set() before each frame with the pad of the console.
+static bool rewind_held = false;
+// Fast-forward button status, while it's held only a few frames are rendered and shown.
+static bool fast_forward = false;
+
+// Run-ahead shows a frame emulated past the real one and then restores the real state.
+static volatile uint8_t run_ahead_frames = RUN_AHEAD_FRAMES;
+static uint8_t *run_ahead_state = NULL;
+static uint32_t run_ahead_time = 0;
+
 static const char *TAG = "SMS_manager";
 
 /**********************
@@ -80,7 +127,7 @@ void SMS_start(){
 
     //Execute emulator tasks.
     xTaskCreatePinnedToCore(&videoTask, "videoTask", 1024 * 4, NULL, 1, &videoTask_handler, 1);
-    xTaskCreatePinnedToCore(&audioTask, "audioTask", 2048, NULL, 1, &audioTask_handler, 1);
+    xTaskCreatePinnedToCore(&audioTask, "audioTask", 3072, NULL, 1, &audioTask_handler, 1);
     xTaskCreatePinnedToCore(&SMSTask, "SMSTask", 3048, NULL, 1, &SMSTask_handler, 0);
 }
 
@@ -99,22 +146,31 @@ void SMS_suspend(){
 }
 
 void SMS_save_game(){
-    
-    //The save file direction should be added previously when you start a new game.
-	FILE *fd = fopen(save_rom_dir, "w");
-
-    if(fd != NULL){
-        system_save_state(fd);
-        ESP_LOGI(TAG,"Game save successded.");  
+    if(eTaskGetState(SMSTask_handler) != eSuspended){
+        save_request = true;
+        return;
     }
-    else{
-        ESP_LOGE(TAG,"Error creating save game file.");
-    }
-    fclose(fd);   
+
+    // A suspended game never reaches the end of its frame, it runs until the snapshot is taken.
+    ulTaskNotifyTake(pdTRUE, 0);
+    save_waiter = xTaskGetCurrentTaskHandle();
+    save_request = true;
+    SMS_resume();
+    if(ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SAVE_WAIT_MS)) == 0) ESP_LOGE(TAG,"Save game timeout");
+    SMS_suspend();
+    save_waiter = NULL;
+}
+
+void SMS_run_ahead(uint8_t frames){
+    if(frames > RUN_AHEAD_MAX) frames = RUN_AHEAD_MAX;
+    ESP_LOGI(TAG,"Run-ahead of %u frames",frames);
+    run_ahead_frames = frames;
 }
 
 bool SMS_load_game(const char *game_name, uint8_t console){
 
+    boot_time = esp_timer_get_time();
+
     if(console == SMS) ESP_LOGI(TAG,"Loading Sega Master System ROM: %s",game_name);
     else{
         ESP_LOGI(TAG,"Loading Sega Game Gear ROM: %s",game_name);
@@ -132,18 +188,17 @@ bool SMS_load_game(const char *game_name, uint8_t console){
 	else{
 		sprintf(save_rom_dir,"/sdcard/Game_Gear/Save_Data/%s.sav",game_name);
 	}
+    strcpy(movie_path, save_rom_dir);
+    strcpy(movie_path + strlen(movie_path) - 4, ".mov");
 
-    FILE *fd = fopen(save_rom_dir, "r");
+    save_data = sd_save_read(save_rom_dir,&save_size);
 
-    if(fd != NULL){
-        //TODO: Implement properly save state
+    if(save_data != NULL){
         ESP_LOGI(TAG,"Found save game file of the ROM: %s",game_name);
-        //system_load_state(fd);
     }
     else{
         ESP_LOGW(TAG,"Any save game available for this ROM.");
     }
-    fclose(fd);
 
     return true;
 
@@ -157,13 +212,22 @@ static void videoTask(void *arg){
     ESP_LOGI(TAG, "SMS Video Task Initialize");
 
     uint8_t *param;
-    display_HAL_SMS_frame(NULL,NULL,GAME_GEAR);
+    profiler_register(PROFILER_VIDEO_TASK);
+    display_HAL_SMS_frame(NULL,NULL);
     while (1)
     {
+        PROFILER_BEGIN();
         xQueuePeek(vidQueue, &param, portMAX_DELAY);
+        PROFILER_END(PROFILER_WAIT);
         render_copy_palette(color);
-        display_HAL_SMS_frame(param,color,GAME_GEAR);
+        if(GAME_GEAR) display_HAL_GG_frame(param,color);
+        else display_HAL_SMS_frame(param,color);
         xQueueReceive(vidQueue, &param, portMAX_DELAY);
+
+        if(boot_time){
+            ESP_LOGI(TAG,"Boot to first frame: %lli ms",(esp_timer_get_time() - boot_time) / 1000);
+            boot_time = 0;
+        }
         
     }
 
@@ -173,10 +237,38 @@ static void audioTask(void *arg){
     ESP_LOGI(TAG, "SMS Audio Task Initialize");
 
     uint32_t *param;
+    uint startTime;
+
+    profiler_register(PROFILER_AUDIO_TASK);
 
     while(1){
+        PROFILER_BEGIN();
         xQueuePeek(audioQueue, &param, portMAX_DELAY);
-        audio_submit((short *)param, snd.sample_count);
+        PROFILER_END(PROFILER_WAIT);
+
+        if(sms.use_fm){
+            // Synthesize the YM2413 from the register log of this frame and mix it with the PSG.
+            PROFILER_BEGIN();
+            startTime = xthal_get_ccount();
+
+            FM_Render(param == audioBuffer[0] ? 0 : 1, fmBuffer, snd.sample_count);
+
+            int16_t *sample = (int16_t *)param;
+            for(int x = 0; x < snd.sample_count * 2; x++){
+                int32_t mix = sample[x] + ((fmBuffer[x >> 1] * snd.gain) >> 8);
+
+                if(mix > 32767) mix = 32767;
+                else if(mix < -32768) mix = -32768;
+                sample[x] = mix;
+            }
+
+            fm_cycles += xthal_get_ccount() - startTime;
+            fm_frames++;
+            PROFILER_END(PROFILER_AUDIO);
+        }
+
+        // The mixer already applied the volume.
+        audio_submit_raw((short *)param, snd.sample_count);
         xQueueReceive(audioQueue, &param, portMAX_DELAY);
     }
 }
@@ -185,15 +277,22 @@ static void SMSTask(void *arg){
 
     ESP_LOGI(TAG, "SMS Task Init");
 
+    profiler_register(PROFILER_EMULATOR_TASK);
+
     ESP_LOGI(TAG,"Triying to allocated frame buffer on DMA memory.");
     
+    //Game Gear only renders its visible viewport, so its frame buffers are smaller.
+    uint16_t frameWidth = GAME_GEAR ? GG_FRAME_WIDTH : SMS_FRAME_WIDTH;
+    uint16_t frameHeight = GAME_GEAR ? GG_FRAME_HEIGHT : SMS_FRAME_HEIGHT;
+    size_t frameSize = frameWidth * frameHeight;
+
     //Allocating frame buffer
-    framebuffer[0] = heap_caps_malloc(256 * 192,MALLOC_CAP_8BIT | MALLOC_CAP_DMA );
-    framebuffer[1] = heap_caps_malloc(256 * 192,MALLOC_CAP_8BIT | MALLOC_CAP_DMA );
+    framebuffer[0] = heap_caps_malloc(frameSize,MALLOC_CAP_8BIT | MALLOC_CAP_DMA );
+    framebuffer[1] = heap_caps_malloc(frameSize,MALLOC_CAP_8BIT | MALLOC_CAP_DMA );
 
     if(framebuffer[0] == NULL){
         ESP_LOGW(TAG,"framebuffer[0] not enough DMA memory for allocate. \n Allocating on regular memory.");
-        framebuffer[0] = malloc(256 * 192);
+        framebuffer[0] = malloc(frameSize);
 
         if(framebuffer[0] == NULL){
             //If the framebuffer was not possible to allocated, it doesn't have sense to continue.
@@ -204,7 +303,7 @@ static void SMSTask(void *arg){
 
     if(framebuffer[1] == NULL){
         ESP_LOGW(TAG,"framebuffer[1] not enough DMA memory for allocate. \n Allocating on regular memory.");
-        framebuffer[1] = malloc(256 * 192);
+        framebuffer[1] = malloc(frameSize);
 
         if(framebuffer[1] == NULL){
             ESP_LOGE(TAG,"framebuffer[1] regular allocation error, abort emulator run.");
@@ -214,14 +313,12 @@ static void SMSTask(void *arg){
     ESP_LOGI(TAG,"framebuffer allocated successfully.\nDisplayBuffer[0]:%p\nDisplayBuffer[1]:%p",framebuffer[0], framebuffer[1]);
 
 
-    memset(framebuffer[0],0,256 * 192);
-    memset(framebuffer[1],0,256 * 192);
-
-    sms.use_fm = 0;
+    memset(framebuffer[0],0,frameSize);
+    memset(framebuffer[1],0,frameSize);
 
     //Set video configuration
-    bitmap.width = 240;
-    bitmap.height = 240;
+    bitmap.width = frameWidth;
+    bitmap.height = frameHeight;
     bitmap.pitch = bitmap.width;
     //bitmap.depth = 8;
     bitmap.data = framebuffer[0];
@@ -234,9 +331,25 @@ static void SMSTask(void *arg){
     option.bilinear = 0;
     option.aspect = 0;
 
+    //Only the Master System had the YM2413 FM unit.
+    option.fm = GAME_GEAR ? SND_NONE : SND_EMU2413;
+    sms.use_fm = (option.fm != SND_NONE);
+
     system_init2();
     system_reset();
 
+    if(save_data != NULL){
+        int64_t start_time = esp_timer_get_time();
+
+        if(system_load_state(save_data, save_size) == 0){
+            ESP_LOGI(TAG,"Save game restored in %lli us",esp_timer_get_time() - start_time);
+        }
+        else ESP_LOGE(TAG,"Error loading the save game, starting a new game.");
+
+        free(save_data);
+        save_data = NULL;
+    }
+
     uint32 frame = 0;
 
     size_t bufferSize = snd.sample_count * 2 * sizeof(int16_t);
@@ -268,6 +381,18 @@ static void SMSTask(void *arg){
 
     audioBufferCount = snd.sample_count;
 
+    if(sms.use_fm){
+        fmBuffer = malloc(snd.sample_count * sizeof(int16_t));
+
+        if(fmBuffer == NULL){
+            ESP_LOGE(TAG,"fmBuffer allocation error, abort emulator run.");
+            abort();
+        }
+    }
+
+
+    movie_init(movie_path, system_state_size(), rewind_save, rewind_load);
+    rewind_init(system_state_size(), rewind_save, rewind_load);
 
     uint startTime;
     uint stopTime;
@@ -276,30 +401,58 @@ static void SMSTask(void *arg){
         
         startTime = xthal_get_ccount();
         input_set();
+
+        if(rewind_held && !rewind_pop()){
+            // Keep the rewound frame on screen until the next snapshot is due.
+            vTaskDelay(1);
+            continue;
+        }
         //TODO: Coleco stuff
 
-        if ((frame % 2) == 0){
-            system_frame(0);
+        // The smsplus mixer writes the gain applied stereo frames straight into the audio buffer.
+        snd.output = (int16 *)audioBuffer[audioBuffer_num];
+        snd.gain = audio_gain_get() * 256;
+
+        bool shown;
+        if(rewind_held) shown = true;
+        else if(fast_forward) shown = (frame % FAST_FORWARD_SKIP) == 0;
+        else shown = (frame % 2) == 0;
+
+        // The VDP lines and the PSG are counted on their own phases.
+        // The frames the frameskip doesn't show are emulated without run-ahead, its output would be thrown away.
+        if(run_ahead_frames && shown && !rewind_held && !fast_forward && !movie_active()){
+            PROFILER_BEGIN();
+            system_frame(1);
+            PROFILER_END(PROFILER_CPU);
+            run_ahead();
+        }
+        else{
+            PROFILER_BEGIN();
+            system_frame(!shown);
+            PROFILER_END(PROFILER_CPU);
+        }
+
+        if(shown){
             xQueueSend(vidQueue, &bitmap.data, 0);
 
             currentFramebuffer = currentFramebuffer ? 0 : 1;
             bitmap.data = framebuffer[currentFramebuffer];
         }
-        else{
-            system_frame(1);
-        }
 
-        // Process audio
-        for (int x = 0; x < snd.sample_count; x++){
-             uint32_t sample;
+        // Only swap when the buffer was queued, otherwise the next frame would overwrite the one being played.
+        if(xQueueSend(audioQueue, &audioBuffer[audioBuffer_num], 0) == pdTRUE){
+            audioBuffer_num = audioBuffer_num ? 0 : 1;
+            FM_LogSelect(audioBuffer_num);
+        }
 
-            sample = (snd.output[0][x] << 16) + snd.output[1][x];
-   
-            audioBuffer[audioBuffer_num][x] = sample;
+        if(save_request){
+            save_request = false;
+            save_snapshot();
+            movie_flush();
+            if(save_waiter != NULL) xTaskNotifyGive(save_waiter);
         }
 
-        xQueueSend(audioQueue, &audioBuffer[audioBuffer_num], 0);
-        audioBuffer_num = audioBuffer_num ? 0 : 1;
+        if(!rewind_held && !movie_active()) rewind_push();
 
         stopTime = xthal_get_ccount();
 
@@ -311,12 +464,41 @@ static void SMSTask(void *arg){
 
         totalElapsedTime += elapsedTime;
         ++frame;
+        profiler_frame();
 
         if (frame == 60){
             float seconds = totalElapsedTime / (CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ * 1000000.0f);
             float fps = frame / seconds;
 
             printf("FPS:%f\n", fps);
+            if(fast_forward) printf("Fast-forward: x%.2f\n", fps / 60.0f);
+
+            if(run_ahead_frames){
+                printf("Run-ahead: %u frames, %u us/frame\n", run_ahead_frames, run_ahead_time / frame);
+
+                // Each extra frame is a full Z80 and VDP frame, below 59 FPS drop one of them.
+                if(fps < 59.0f){
+                    run_ahead_frames--;
+                    ESP_LOGW(TAG,"Run-ahead too slow, reduced to %u frames",run_ahead_frames);
+                }
+            }
+            run_ahead_time = 0;
+
+            rewind_report(60);
+#if RENDER_BENCHMARK
+            if(render_line_count) printf("Render line: %u cycles\n", render_line_cycles / render_line_count);
+            render_line_cycles = 0;
+            render_line_count = 0;
+#endif
+#if Z80_BENCHMARK
+            printf("Z80: %u cycles/frame\n", z80_benchmark_cycles / frame);
+            z80_benchmark_cycles = 0;
+#endif
+            if(sms.use_fm && fm_frames) printf("FM: %u cycles/frame\n", fm_cycles / fm_frames);
+            fm_cycles = 0;
+            fm_frames = 0;
+
+            profiler_report();
 
             frame = 0;
             totalElapsedTime = 0;
@@ -328,7 +510,9 @@ static void input_set(){
     int smsButtons = 0;
     int smsSystem = 0;
 
-    uint16_t inputs_value =  input_read();
+    uint16_t hotkeys = input_read();
+    // While a movie is recorded or replayed the hotkeys are ignored, they change the emulation.
+    uint16_t inputs_value = movie_input(hotkeys);
 #if 0
     if(!((inputs_value >> 0) & 0x01))  smsButtons |= INPUT_DOWN;
     if(!((inputs_value >> 1) & 0x01))  smsButtons |= INPUT_LEFT;
@@ -353,4 +537,85 @@ static void input_set(){
 
     input.pad[0] = smsButtons;
     input.system = smsSystem;
-}
\ No newline at end of file
+
+    rewind_held = !movie_active() && !((hotkeys >> REWIND_BUTTON) & 0x01);
+    fast_forward = !movie_active() && !((hotkeys >> FAST_FORWARD_BUTTON) & 0x01);
+}
+
+/* Function: save_snapshot
+ * ---------------------
+ * Copy the state of the emulator on RAM and queue it to the save task,
+ * the SD card is written on the other core.
+ */
+static void save_snapshot(){
+    int64_t start_time = esp_timer_get_time();
+
+    uint8_t *data = malloc(system_state_size());
+    if(data == NULL){
+        ESP_LOGE(TAG,"Not enough memory for the save snapshot.");
+        return;
+    }
+
+    int size = system_save_state(data);
+    ESP_LOGI(TAG,"Save snapshot: %i bytes in %lli us",size,esp_timer_get_time() - start_time);
+
+    if(!sd_save_write(save_rom_dir, data, size)) free(data);
+}
+
+/* Function: run_ahead
+ * ---------------------
+ * Emulate the run-ahead frames after a shown frame with the audio muted,
+ * rendering only the last one, and go back to the real state. The input
+ * shows up on screen that many frames earlier.
+ */
+static void run_ahead(){
+    int64_t start_time = esp_timer_get_time();
+
+    if(run_ahead_state == NULL){
+        // The internal RAM is left to the emulator, like the rewind and movie buffers.
+        run_ahead_state = heap_caps_malloc(system_state_size(), MALLOC_CAP_SPIRAM);
+
+        if(run_ahead_state == NULL){
+            ESP_LOGE(TAG,"Not enough PSRAM for run-ahead, disabled.");
+            run_ahead_frames = 0;
+            return;
+        }
+    }
+
+    // The leftover Z80 cycles aren't part of the state.
+    int cycles = z80_cycle_count;
+    int length = system_save_state(run_ahead_state);
+
+    int16 *output = snd.output;
+    snd.output = NULL;
+    FM_LogHold();
+
+    PROFILER_BEGIN();
+    for(int i = 1; i <= run_ahead_frames; i++) system_frame(i != run_ahead_frames);
+    PROFILER_END(PROFILER_CPU);
+
+    if(system_load_state(run_ahead_state, length) != 0) ESP_LOGE(TAG,"Error restoring the run-ahead state.");
+
+    FM_LogRelease();
+    snd.output = output;
+    z80_cycle_count = cycles;
+
+    run_ahead_time += esp_timer_get_time() - start_time;
+}
+
+/* Function: rewind_save
+ * ---------------------
+ * Rewind and movie snapshots use the same format as the save files, the buffer
+ * always holds system_state_size() bytes.
+ */
+static int rewind_save(void *buffer, int size){
+    return system_save_state(buffer);
+}
+
+/* Function: rewind_load
+ * ---------------------
+ * Restore a rewind or movie snapshot.
+ */
+static bool rewind_load(const void *buffer, int size){
+    return system_load_state(buffer, size) == 0;
+}
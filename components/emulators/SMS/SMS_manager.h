@@ -53,8 +53,24 @@ bool SMS_load_game(const char *game_name, uint8_t console);
  * Function:  SMS_save_game 
  * --------------------
  * 
- * Save the progress of the game into a file on the SD card.
+ * Save the progress of the game into a file on the SD card. A suspended game is
+ * resumed until the snapshot is taken.
  * 
  *  Returns: Nothing
  */
-void SMS_save_game();
\ No newline at end of file
+void SMS_save_game();
+
+/*
+ * Function:  SMS_run_ahead 
+ * --------------------
+ * 
+ * Emulate some frames ahead of the real one and show the last of them, removing
+ * that many frames of input latency. It costs a state save and load plus the extra
+ * frames on every shown frame, if the game can't keep 60 FPS the frames are reduced.
+ * 
+ * Arguments:
+ * -frames: Frames to run ahead, up to 3. 0 disables it.
+ * 
+ *  Returns: Nothing
+ */
+void SMS_run_ahead(uint8_t frames);
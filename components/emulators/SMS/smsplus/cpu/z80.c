@@ -142,11 +142,26 @@ int z80_cycle_count = 0;        /* running total of cycles executed */
 #define cpu_readop(a)           cpu_readmap[(a) >> 10][(a) & 0x03FF]
 #define cpu_readop_arg(a)       cpu_readmap[(a) >> 10][(a) & 0x03FF]
 
+/* opcodes are fetched through the 1 KB pages of cpu_readmap like the data. PC
+   and its page aren't cached: the mapper writes of sms.c and memz80.c change
+   the pages at any time and would have to invalidate them. */
+
 /* execute main opcodes inside a big switch statement */
 #ifndef BIG_SWITCH
 #define BIG_SWITCH      1
 #endif
 
+/* execute CB/DD/ED/FD prefixed opcodes inside big switch statements too */
+#ifndef BIG_SWITCH_PREFIX
+#define BIG_SWITCH_PREFIX 1
+#endif
+
+#if Z80_BENCHMARK
+#include "freertos/FreeRTOS.h"
+
+unsigned int z80_benchmark_cycles = 0;  /* host CPU cycles spent on z80_execute */
+#endif
+
 
 
 #define CF  0x01
@@ -675,6 +690,16 @@ INLINE void BURNODD(int cycles, int opcodes, int cyclesum)
 #define EXEC_INLINE EXEC
 #endif
 
+/***************************************************************
+ * execute a prefixed opcode. Chained DD/FD prefixes still use
+ * the function tables, they can't be inlined into themselves.
+ ***************************************************************/
+#if BIG_SWITCH_PREFIX
+#define EXEC_PREFIX EXEC_INLINE
+#else
+#define EXEC_PREFIX EXEC
+#endif
+
 
 /***************************************************************
  * Enter HALT state; write 1 to fake port on first execution
@@ -720,9 +745,16 @@ INLINE void RM16( UINT32 addr, PAIR *r )
 }
 
 /***************************************************************
- * Write a byte to given memory location
+ * Write a byte to given memory location. Only the pages with
+ * mapper registers go through the mapper write handler.
  ***************************************************************/
-#define WM(addr,value) cpu_writemem16(addr,value)
+INLINE void WM( UINT32 addr, UINT8 value )
+{
+  if (cpu_writetrap[addr >> 10])
+    cpu_writemem16(addr, value);
+  else
+    cpu_writemap[addr >> 10][addr & 0x03FF] = value;
+}
 
 /***************************************************************
  * Write a word to given memory location
@@ -2366,7 +2398,7 @@ OP(dd,c7) { illegal_1(); op_c7();                             } /* DB   DD
 OP(dd,c8) { illegal_1(); op_c8();                             } /* DB   DD       */
 OP(dd,c9) { illegal_1(); op_c9();                             } /* DB   DD       */
 OP(dd,ca) { illegal_1(); op_ca();                             } /* DB   DD       */
-OP(dd,cb) { EAX; EXEC(xycb,ARG());                            } /* **** DD CB xx */
+OP(dd,cb) { EAX; EXEC_PREFIX(xycb,ARG());                     } /* **** DD CB xx */
 OP(dd,cc) { illegal_1(); op_cc();                             } /* DB   DD       */
 OP(dd,cd) { illegal_1(); op_cd();                             } /* DB   DD       */
 OP(dd,ce) { illegal_1(); op_ce();                             } /* DB   DD       */
@@ -2657,7 +2689,7 @@ OP(fd,c7) { illegal_1(); op_c7();                             } /* DB   FD
 OP(fd,c8) { illegal_1(); op_c8();                             } /* DB   FD       */
 OP(fd,c9) { illegal_1(); op_c9();                             } /* DB   FD       */
 OP(fd,ca) { illegal_1(); op_ca();                             } /* DB   FD       */
-OP(fd,cb) { EAY; EXEC(xycb,ARG());                            } /* **** FD CB xx */
+OP(fd,cb) { EAY; EXEC_PREFIX(xycb,ARG());                     } /* **** FD CB xx */
 OP(fd,cc) { illegal_1(); op_cc();                             } /* DB   FD       */
 OP(fd,cd) { illegal_1(); op_cd();                             } /* DB   FD       */
 OP(fd,ce) { illegal_1(); op_ce();                             } /* DB   FD       */
@@ -3248,7 +3280,7 @@ OP(op,c7) { RST(0x00);
 OP(op,c8) { RET_COND( F & ZF, 0xc8 );                                                                      } /* RET  Z           */
 OP(op,c9) { POP( pc ); WZ=PCD;                                                                         } /* RET              */
 OP(op,ca) { JP_COND( F & ZF );                                                                             } /* JP   Z,a         */
-OP(op,cb) { R++; EXEC(cb,ROP());                                                                           } /* **** CB xx       */
+OP(op,cb) { R++; EXEC_PREFIX(cb,ROP());                                                                    } /* **** CB xx       */
 OP(op,cc) { CALL_COND( F & ZF, 0xcc );                                                                     } /* CALL Z,a         */
 OP(op,cd) { CALL();                                                                                        } /* CALL a           */
 OP(op,ce) { ADC(ARG());                                                                                    } /* ADC  A,n         */
@@ -3268,7 +3300,7 @@ OP(op,d9) { EXX;
 OP(op,da) { JP_COND( F & CF );                                                                             } /* JP   C,a         */
 OP(op,db) { unsigned n = ARG() | (A << 8); A = IN( n ); WZ = n + 1;                                    } /* IN   A,(n)       */
 OP(op,dc) { CALL_COND( F & CF, 0xdc );                                                                     } /* CALL C,a         */
-OP(op,dd) { R++; EXEC(dd,ROP());                                                                           } /* **** DD xx       */
+OP(op,dd) { R++; EXEC_PREFIX(dd,ROP());                                                                    } /* **** DD xx       */
 OP(op,de) { SBC(ARG());                                                                                    } /* SBC  A,n         */
 OP(op,df) { RST(0x18);                                                                                     } /* RST  3           */
 
@@ -3286,7 +3318,7 @@ OP(op,e9) { PC = HL;
 OP(op,ea) { JP_COND( F & PF );                                                                             } /* JP   PE,a        */
 OP(op,eb) { EX_DE_HL;                                                                                      } /* EX   DE,HL       */
 OP(op,ec) { CALL_COND( F & PF, 0xec );                                                                     } /* CALL PE,a        */
-OP(op,ed) { R++; EXEC(ed,ROP());                                                                           } /* **** ED xx       */
+OP(op,ed) { R++; EXEC_PREFIX(ed,ROP());                                                                    } /* **** ED xx       */
 OP(op,ee) { XOR(ARG());                                                                                    } /* XOR  n           */
 OP(op,ef) { RST(0x28);                                                                                     } /* RST  5           */
 
@@ -3304,7 +3336,7 @@ OP(op,f9) { SP = HL;
 OP(op,fa) { JP_COND(F & SF);                                                                               } /* JP   M,a         */
 OP(op,fb) { EI;                                                                                            } /* EI               */
 OP(op,fc) { CALL_COND( F & SF, 0xfc );                                                                     } /* CALL M,a         */
-OP(op,fd) { R++; EXEC(fd,ROP());                                                                           } /* **** FD xx       */
+OP(op,fd) { R++; EXEC_PREFIX(fd,ROP());                                                                    } /* **** FD xx       */
 OP(op,fe) { CP(ARG());                                                                                     } /* CP   n           */
 OP(op,ff) { RST(0x38);                                                                                     } /* RST  7           */
 
@@ -3515,6 +3547,9 @@ void z80_exit(void)
  ****************************************************************************/
 int z80_execute(int cycles)
 {
+#if Z80_BENCHMARK
+  unsigned int start = xthal_get_ccount();
+#endif
   z80_ICount = cycles;
   z80_requested_cycles = z80_ICount;
   z80_exec = 1;
@@ -3552,6 +3587,10 @@ int z80_execute(int cycles)
   z80_exec = 0;
   z80_cycle_count += (cycles - z80_ICount);
 
+#if Z80_BENCHMARK
+  z80_benchmark_cycles += xthal_get_ccount() - start;
+#endif
+
   return cycles - z80_ICount;
 }
 
@@ -73,9 +73,15 @@ typedef struct
 
   const struct z80_irq_daisy_chain *daisy;
   int (*irq_callback)(int irqline);
-} __attribute__((packed, aligned(1))) Z80_Regs;
+} Z80_Regs;
+
+/* Accumulate the host CPU cycles spent executing Z80 code */
+#define Z80_BENCHMARK 0
 
 extern int z80_cycle_count;
+#if Z80_BENCHMARK
+extern unsigned int z80_benchmark_cycles;
+#endif
 extern Z80_Regs Z80;
 
 void z80_init(int index, int clock, const void *config, int (*irqcallback)(int));
@@ -91,6 +97,7 @@ int z80_get_elapsed_cycles(void);
 
 unsigned char *cpu_readmap[64];
 unsigned char *cpu_writemap[64];
+unsigned char cpu_writetrap[64]; /* 1= page has mapper registers, write through cpu_writemem16 */
 
 void (*cpu_writemem16)(int address, int data);
 void (*cpu_writeport16)(uint16 port, uint8 data);
@@ -1,4 +1,3 @@
-#if 0
 /***********************************************************************************
 
   emu2413.c -- YM2413 emulator written by Mitsutaka Okazaki 2001
@@ -41,6 +40,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <math.h>
 
 #include "shared.h"
@@ -205,12 +205,19 @@ static uint32 dphaseARTable[16][16] ;
 /* Phase incr table for Decay and Release */
 static uint32 dphaseDRTable[16][16] ;
 
-/* KSL + TL Table */
-static uint32 tllTable[16][8][1<<TL_BITS][4] ;
+/* KSL Table, TL is added when the slot is updated */
+static uint32 tllTable[16][8][4] ;
 static int32 rksTable[2][8][2] ;
 
-/* Phase incr table for PG */
-static uint32 dphaseTable[512][8][16] ;
+/* Multiplier for PG, the phase increment is computed on register writes */
+static const uint32 mltable[16]={ 1,1*2,2*2,3*2,4*2,5*2,6*2,7*2,8*2,9*2,10*2,10*2,12*2,12*2,15*2,15*2 } ;
+
+/* Scratch buffers for OPLL_render */
+#define RENDER_BLOCK 64
+static int32 render_pm[RENDER_BLOCK] ;
+static int32 render_am[RENDER_BLOCK] ;
+static int32 render_inst[RENDER_BLOCK] ;
+static int32 render_perc[RENDER_BLOCK] ;
 
 /***************************************************
 
@@ -312,16 +319,12 @@ static void makeAmTable(void)
     amtable[i] = (int32)((double)AM_DEPTH/2/DB_STEP * (1.0 + sin(2.0*PI*i/PM_PG_WIDTH))) ;
 }
 
-/* Phase increment counter table */
-static void makeDphaseTable(void)
+/* Phase increment counter, same rounding as rate_adjust() in integer math */
+static uint32 calc_dphase(uint32 fnum, uint32 block, uint32 ML)
 {
-  uint32 fnum, block , ML ;
-  uint32 mltable[16]={ 1,1*2,2*2,3*2,4*2,5*2,6*2,7*2,8*2,9*2,10*2,10*2,12*2,12*2,15*2,15*2 } ;
+  uint64_t x = ((fnum * mltable[ML])<<block)>>(20-DP_BITS) ;
 
-  for(fnum=0; fnum<512; fnum++)
-    for(block=0; block<8; block++)
-      for(ML=0; ML<16; ML++)
-        dphaseTable[fnum][block][ML] = rate_adjust(((fnum * mltable[ML])<<block)>>(20-DP_BITS)) ;
+  return (uint32)((x * clk * 2 + 72 * rate) / (144 * rate)) ;
 }
 
 static void makeTllTable(void)
@@ -334,26 +337,18 @@ static void makeTllTable(void)
   } ;
 
   int32 tmp ;
-  int fnum, block ,TL , KL ;
+  int fnum, block , KL ;
 
   for(fnum=0; fnum<16; fnum++)
     for(block=0; block<8; block++)
-      for(TL=0; TL<64; TL++)
-        for(KL=0; KL<4; KL++)
-        {
-          if(KL==0)
-          {
-            tllTable[fnum][block][TL][KL] = TL2EG(TL) ;
-          }
-          else
-          {
-            tmp = kltable[fnum] - dB2(3.000) * (7 - block) ;
-            if(tmp <= 0)
-              tllTable[fnum][block][TL][KL] = TL2EG(TL) ;
-            else
-              tllTable[fnum][block][TL][KL] = (uint32)((tmp>>(3-KL))/EG_STEP) + TL2EG(TL) ;
-          }
-       }
+      for(KL=0; KL<4; KL++)
+      {
+        tmp = kltable[fnum] - dB2(3.000) * (7 - block) ;
+        if(KL==0 || tmp <= 0)
+          tllTable[fnum][block][KL] = 0 ;
+        else
+          tllTable[fnum][block][KL] = (uint32)((tmp>>(3-KL))/EG_STEP) ;
+      }
 }
 
 /* Rate Table for Attack */
@@ -510,9 +505,9 @@ INLINE static uint32 calc_eg_dphase(OPLL_SLOT *slot)
 #define SLOT_TOM 16
 #define SLOT_CYM 17
 
-#define UPDATE_PG(S) (S)->dphase = dphaseTable[(S)->fnum][(S)->block][(S)->patch->ML]
+#define UPDATE_PG(S) (S)->dphase = calc_dphase((S)->fnum,(S)->block,(S)->patch->ML)
 #define UPDATE_TLL(S) \
-  (((S)->type == 0) ? ((S)->tll = tllTable[((S)->fnum) >> 5][(S)->block][(S)->patch->TL][(S)->patch->KL]) : ((S)->tll = tllTable[((S)->fnum) >> 5][(S)->block][(S)->volume][(S)->patch->KL]))
+  (((S)->type == 0) ? ((S)->tll = tllTable[((S)->fnum) >> 5][(S)->block][(S)->patch->KL] + TL2EG((S)->patch->TL)) : ((S)->tll = tllTable[((S)->fnum) >> 5][(S)->block][(S)->patch->KL] + TL2EG((S)->volume)))
 #define UPDATE_RKS(S) (S)->rks = rksTable[((S)->fnum) >> 8][(S)->block][(S)->patch->KR]
 #define UPDATE_WF(S) (S)->sintbl = waveform[(S)->patch->WF]
 #define UPDATE_EG(S) (S)->eg_dphase = calc_eg_dphase(S)
@@ -889,7 +884,6 @@ void OPLL_setClock(uint32 c, uint32 r)
 {
   clk = c ;
   rate = r ;
-  makeDphaseTable() ;
   makeDphaseARTable() ;
   makeDphaseDRTable() ;
   pm_dphase = (uint32)rate_adjust(PM_SPEED * PM_DP_WIDTH / (clk/72) ) ;
@@ -1249,6 +1243,93 @@ int16 OPLL_calc(OPLL *opll)
 
 }
 
+/*
+  Block renderer used by the SMS audio task. Output matches OPLL_calc, but
+  LFO, noise and the rhythm section advance once per sample while each
+  melody channel is rendered over the whole block, so its slot state stays
+  in registers. Channels whose carrier envelope has finished are skipped
+  until the next key on, which can only happen between two calls.
+*/
+void OPLL_render(OPLL *opll, int16 *buffer, int length)
+{
+  int32 rythmC, rythmH, out ;
+  int i, j, n, melody ;
+
+  while(length > 0)
+  {
+    n = (length < RENDER_BLOCK) ? length : RENDER_BLOCK ;
+    melody = opll->rythm_mode ? 6 : 9 ;
+
+    for(j = 0 ; j < n ; j++)
+    {
+      update_ampm(opll) ;
+      update_noise(opll) ;
+      render_pm[j] = opll->lfo_pm ;
+      render_am[j] = opll->lfo_am ;
+      render_inst[j] = 0 ;
+      render_perc[j] = 0 ;
+
+      if(!opll->rythm_mode) continue ;
+
+      opll->MOD(7)->pgout = calc_phase(opll->MOD(7)) ;
+      opll->CAR(8)->pgout = calc_phase(opll->CAR(8)) ;
+      if(opll->MOD(7)->phase<256) rythmH = DB_NEG(12.0) ; else rythmH = DB_MUTE - 1 ;
+      if(opll->CAR(8)->phase<256) rythmC = DB_NEG(12.0) ; else rythmC = DB_MUTE - 1 ;
+
+      if(!(opll->mask&OPLL_MASK_BD)&&(opll->CAR(6)->eg_mode!=FINISH))
+        render_perc[j] += calc_slot_car(opll->CAR(6),calc_slot_mod(opll->MOD(6))) ;
+
+      if(!(opll->mask&OPLL_MASK_HH)&&(opll->MOD(7)->eg_mode!=FINISH))
+        render_perc[j] += calc_slot_hat(opll->MOD(7), opll->noiseA, opll->noiseB, rythmH, opll->whitenoise) ;
+
+      if(!(opll->mask&OPLL_MASK_SD)&&(opll->CAR(7)->eg_mode!=FINISH))
+        render_perc[j] += calc_slot_snare(opll->CAR(7), opll->whitenoise) ;
+
+      if(!(opll->mask&OPLL_MASK_TOM)&&(opll->MOD(8)->eg_mode!=FINISH))
+        render_perc[j] += calc_slot_tom(opll->MOD(8)) ;
+
+      if(!(opll->mask&OPLL_MASK_CYM)&&(opll->CAR(8)->eg_mode!=FINISH))
+        render_perc[j] += calc_slot_cym(opll->CAR(8), opll->noiseA, opll->noiseB, rythmC) ;
+    }
+
+    for(i = 0 ; i < melody ; i++)
+    {
+      OPLL_SLOT *mod = opll->MOD(i) ;
+      OPLL_SLOT *car = opll->CAR(i) ;
+
+      if((opll->mask&OPLL_MASK_CH(i))||(car->eg_mode==FINISH)) continue ;
+
+      for(j = 0 ; j < n ; j++)
+      {
+        opll->lfo_pm = render_pm[j] ;
+        opll->lfo_am = render_am[j] ;
+        render_inst[j] += calc_slot_car(car,calc_slot_mod(mod)) ;
+        if(car->eg_mode==FINISH) break ;
+      }
+    }
+
+    opll->lfo_pm = render_pm[n - 1] ;
+    opll->lfo_am = render_am[n - 1] ;
+
+    for(j = 0 ; j < n ; j++)
+    {
+#if SLOT_AMP_BITS > 8
+      out = (render_inst[j] >> (SLOT_AMP_BITS - 8)) + (render_perc[j] >> (SLOT_AMP_BITS - 9)) ;
+#else
+      out = (render_inst[j] << (8 - SLOT_AMP_BITS)) + (render_perc[j] << (9 - SLOT_AMP_BITS)) ;
+#endif
+      out = (out * opll->masterVolume) >> 2 ;
+
+      if(out>32767) out = 32767 ;
+      if(out<-32768) out = -32768 ;
+      buffer[j] = (int16)out ;
+    }
+
+    buffer += n ;
+    length -= n ;
+  }
+}
+
 uint32 OPLL_setMask(OPLL *opll, uint32 mask)
 {
   uint32 ret ;
@@ -1628,4 +1709,3 @@ void OPLL_update(OPLL *opll, int16 **buffer, int length)
         buffer[1][j] = (int16)percout ;
     }
 }
-#endif
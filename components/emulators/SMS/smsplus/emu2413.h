@@ -1,4 +1,3 @@
-#if 0
 #ifndef _EMU2413_H_
 #define _EMU2413_H_
 
@@ -166,6 +165,7 @@ EMU2413_API uint32 OPLL_setMask(OPLL *, uint32 mask) ;
 EMU2413_API uint32 OPLL_toggleMask(OPLL *, uint32 mask) ;
 
 EMU2413_API void OPLL_update(OPLL *opll, int16 **buffer, int length) ;
+EMU2413_API void OPLL_render(OPLL *opll, int16 *buffer, int length) ;
 EMU2413_API void OPLL_write(OPLL *opll, int offset, int data) ;
 
 #ifdef __cplusplus
@@ -173,4 +173,3 @@ EMU2413_API void OPLL_write(OPLL *opll, int offset, int data) ;
 #endif
 
 #endif
-#endif
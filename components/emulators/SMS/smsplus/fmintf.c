@@ -1,144 +1,205 @@
-#if 0
 /*
   fmintf.c --
   Interface to EMU2413 and YM2413 emulators.
+
+  The emulation core only logs register writes with their sample position
+  in the frame. Synthesis happens in the audio task on the other core,
+  which replays the log of each frame through FM_Render().
 */
+#include <stddef.h>
 #include "shared.h"
 
 static OPLL *opll;
 FM_Context fm_context;
 
-void FM_Init(void)
+/* One log per audio buffer, selected by the emulation core */
+static FM_Log fm_log[2];
+static FM_Log *fm_log_cur = &fm_log[0];
+/* Copy of the current log while frames that are thrown away are emulated */
+static FM_Log fm_log_hold;
+
+static void context_write(FM_Context *context, void (*write)(int offset, int data))
 {
-  switch(snd.fm_which)
+  int i;
+  uint8 *reg = context->reg;
+  uint8 latch = context->latch;
+
+  write(0, 0x0E);
+  write(1, reg[0x0E]);
+
+  for(i = 0x00; i <= 0x07; i++)
   {
-    case SND_EMU2413:
-      OPLL_init(snd.fm_clock, snd.sample_rate);
-      opll = OPLL_new();
-      OPLL_reset(opll);
-      OPLL_reset_patch(opll, 0);
-      break;
+    write(0, i);
+    write(1, reg[i]);
+  }
 
-    case SND_YM2413:
-      YM2413Init(1, snd.fm_clock, snd.sample_rate);
-      YM2413ResetChip(0);
-      break;
+  for(i = 0x10; i <= 0x18; i++)
+  {
+    write(0, i);
+    write(1, reg[i]);
+  }
+
+  for(i = 0x20; i <= 0x28; i++)
+  {
+    write(0, i);
+    write(1, reg[i]);
+  }
+
+  for(i = 0x30; i <= 0x38; i++)
+  {
+    write(0, i);
+    write(1, reg[i]);
   }
+
+  write(0, latch);
 }
 
-void FM_Shutdown(void)
+static void chip_write(int offset, int data)
+{
+  OPLL_write(opll, offset, data);
+}
+
+void FM_Init(void)
 {
   switch(snd.fm_which)
   {
     case SND_EMU2413:
-      if(opll)
+      /* The chip is owned by the audio task once created, later calls
+         (state load, sound reinit) only request a reset through the log. */
+      if(!opll)
       {
-        OPLL_delete(opll);
-        opll = NULL;
+        OPLL_init(snd.fm_clock, snd.sample_rate);
+        opll = OPLL_new();
+        if(!opll)
+          abort();
       }
-      OPLL_close();
-      break;
-
-    case SND_YM2413:
-      YM2413Shutdown();
+      FM_Reset();
       break;
   }
 }
 
-void FM_Reset(void)
+void FM_Shutdown(void)
 {
-  switch(snd.fm_which)
-  {
-    case SND_EMU2413:
-      OPLL_reset(opll);
-      OPLL_reset_patch(opll, 0);
-      break;
-
-    case SND_YM2413:
-      YM2413ResetChip(0);
-      break;
-    }
+  /* The audio task may still be rendering, only drop pending writes */
+  fm_log_cur->resync = 0;
+  fm_log_cur->count = 0;
 }
 
-void FM_Update(int16 **buffer, int length)
+void FM_Reset(void)
 {
-  switch(snd.fm_which)
-  {
-    case SND_EMU2413:
-      OPLL_update(opll, buffer, length);
-      break;
+  memset(&fm_context, 0, sizeof(FM_Context));
 
-    case SND_YM2413:
-      YM2413UpdateOne(0, buffer, length);
-      break;
-  }
+  fm_log_cur->reset = 1;
+  fm_log_cur->resync = 0;
+  fm_log_cur->count = 0;
 }
 
 void FM_Write(int offset, int data)
 {
+  FM_LogEntry *entry;
+
   if(offset & 1)
     fm_context.reg[ fm_context.latch & 0x3F] = data;
   else
     fm_context.latch = data;
 
-  switch(snd.fm_which)
-  {
-    case SND_EMU2413:
-      OPLL_write(opll, offset & 1, data);
-      break;
+  if(snd.fm_which != SND_EMU2413)
+    return;
 
-    case SND_YM2413:
-      YM2413Write(0, offset & 1, data);
-      break;
+  /* Too many writes this frame, let the audio task restore the whole context */
+  if(fm_log_cur->count == FM_LOG_SIZE)
+  {
+    memcpy(&fm_log_cur->context, &fm_context, sizeof(FM_Context));
+    fm_log_cur->resync = 1;
+    fm_log_cur->count = 0;
+    return;
   }
-}
 
+  entry = &fm_log_cur->entry[fm_log_cur->count++];
+  entry->pos = snd.done_so_far;
+  entry->offset = offset & 1;
+  entry->data = data;
+}
 
-void FM_GetContext(uint8 *data)
+/* Called by the emulation core once the log of the previous frame is handed over */
+void FM_LogSelect(int index)
 {
-  memcpy(data, &fm_context, sizeof(FM_Context));
+  fm_log_cur = &fm_log[index];
+  fm_log_cur->reset = 0;
+  fm_log_cur->resync = 0;
+  fm_log_cur->count = 0;
 }
 
-void FM_SetContext(uint8 *data)
+/* Called before emulating frames that won't be heard, like the run-ahead ones */
+void FM_LogHold(void)
 {
-  int i;
-  uint8 *reg = fm_context.reg;
-
-  memcpy(&fm_context, data, sizeof(FM_Context));
+  memcpy(&fm_log_hold, fm_log_cur, offsetof(FM_Log, entry) + fm_log_cur->count * sizeof(FM_LogEntry));
+}
 
-  /* If we are loading a save state, we want to update the YM2413 context
-     but not actually write to the current YM2413 emulator. */
-  if(!snd.enabled || !sms.use_fm)
-    return;
+/* Drop the writes logged since FM_LogHold(), the state load that follows also resets the chip */
+void FM_LogRelease(void)
+{
+  memcpy(fm_log_cur, &fm_log_hold, offsetof(FM_Log, entry) + fm_log_hold.count * sizeof(FM_LogEntry));
+}
 
-  FM_Write(0, 0x0E);
-  FM_Write(1, reg[0x0E]);
+/* Called by the audio task, synthesizes one frame from its register log */
+void FM_Render(int index, int16 *buffer, int length)
+{
+  FM_Log *log = &fm_log[index];
+  int pos = 0;
+  int at;
+  int i;
 
-  for(i = 0x00; i <= 0x07; i++)
+  if(!opll)
   {
-    FM_Write(0, i);
-    FM_Write(1, reg[i]);
+    memset(buffer, 0, length * sizeof(int16));
+    return;
   }
 
-  for(i = 0x10; i <= 0x18; i++)
+  if(log->reset)
   {
-    FM_Write(0, i);
-    FM_Write(1, reg[i]);
+    OPLL_reset(opll);
+    OPLL_reset_patch(opll, 0);
   }
 
-  for(i = 0x20; i <= 0x28; i++)
-  {
-    FM_Write(0, i);
-    FM_Write(1, reg[i]);
-  }
+  if(log->resync)
+    context_write(&log->context, chip_write);
 
-  for(i = 0x30; i <= 0x38; i++)
+  for(i = 0; i < log->count; i++)
   {
-    FM_Write(0, i);
-    FM_Write(1, reg[i]);
+    at = log->entry[i].pos;
+    if(at > length)
+      at = length;
+
+    /* Render up to the write, registers only change between blocks */
+    if(at > pos)
+    {
+      OPLL_render(opll, buffer + pos, at - pos);
+      pos = at;
+    }
+
+    OPLL_write(opll, log->entry[i].offset, log->entry[i].data);
   }
 
-  FM_Write(0, fm_context.latch);
+  if(pos < length)
+    OPLL_render(opll, buffer + pos, length - pos);
+}
+
+void FM_GetContext(uint8 *data)
+{
+  memcpy(data, &fm_context, sizeof(FM_Context));
+}
+
+void FM_SetContext(uint8 *data)
+{
+  memcpy(&fm_context, data, sizeof(FM_Context));
+
+  /* If we are loading a save state, we want to update the YM2413 context
+     but not actually write to the current YM2413 emulator. */
+  if(!snd.enabled || !sms.use_fm)
+    return;
+
+  context_write(&fm_context, FM_Write);
 }
 
 int FM_GetContextSize(void)
@@ -150,4 +211,3 @@ uint8 *FM_GetContextPtr(void)
 {
   return (uint8 *)&fm_context;
 }
-#endif
@@ -6,26 +6,43 @@ enum
 {
   SND_NONE,    /* YM2413 emulation disabled */
   SND_EMU2413, /* Mitsutaka Okazaki's YM2413 emulator */
-  SND_YM2413   /* Jarek Burczynski's YM2413 emulator */
+  SND_YM2413   /* Jarek Burczynski's YM2413 emulator (not built) */
 };
 
-#if 0
+/* Maximum number of register writes logged per frame */
+#define FM_LOG_SIZE 512
+
 typedef struct {
   uint8 latch;
   uint8 reg[0x40];
 } FM_Context;
 
+typedef struct {
+  uint16 pos;   /* Sample position in the frame */
+  uint8 offset; /* 0 = address latch, 1 = data */
+  uint8 data;
+} FM_LogEntry;
+
+typedef struct {
+  int reset;  /* Reset the chip before replaying */
+  int resync; /* Log overflowed, restore context before replaying */
+  int count;
+  FM_Context context;
+  FM_LogEntry entry[FM_LOG_SIZE];
+} FM_Log;
+
 /* Function prototypes */
 void FM_Init(void);
 void FM_Shutdown(void);
 void FM_Reset(void);
-void FM_Update(int16 **buffer, int length);
 void FM_Write(int offset, int data);
+void FM_LogSelect(int index);
+void FM_LogHold(void);
+void FM_LogRelease(void);
+void FM_Render(int index, int16 *buffer, int length);
 void FM_GetContext(uint8 *data);
 void FM_SetContext(uint8 *data);
 int FM_GetContextSize(void);
 uint8 *FM_GetContextPtr(void);
-void FM_WriteReg(int reg, int data);
-#endif
 
 #endif /* _FMINTF_H_ */
@@ -22,6 +22,7 @@
 
 #include "shared.h"
 #include "system_manager.h"
+#include "sd_storage.h"
 
 extern unsigned long crc32(crc, buf, len);
 
@@ -403,50 +404,34 @@ bool load_rom(char *filename, uint8_t console)
     if(console == SMS ) sprintf(dir_aux,"/sdcard/Master_System/%s",filename);
     else if(console == GG) sprintf(dir_aux,"/sdcard/Game_Gear/%s",filename);
 
-    fd = fopen(dir_aux, "rb");
-    if (!fd)
+    size_t actual_size = sd_file_size(dir_aux);
+    if (!actual_size)
         return false;
 
-    /* Seek to end of file, and get size */
+    /* Take care of image header, if present, by skipping it while loading */
+    size_t header = ((actual_size >= 0x4000) && ((actual_size / 512) & 1)) ? 512 : 0;
 
-    fseek(fd, 0, SEEK_END);
-    size_t actual_size = ftell(fd);
-    fseek(fd, 0, SEEK_SET);
+    //cart.rom = ESP32_PSRAM;
+    size_t rom_size;
+    cart.rom = sd_load_file(dir_aux, header, 0x4000, &rom_size);
+    if (!cart.rom)
+        return false;
 
-    cart.size = actual_size;
+    cart.size = rom_size;
     if (cart.size < 0x4000)
         cart.size = 0x4000;
 
-    //cart.rom = ESP32_PSRAM;
-    cart.rom = malloc(cart.size);
-    size_t cnt = fread(cart.rom, cart.size, 1, fd);
-    //if (cnt != 1) abort();
-    __asm__("nop");
-    __asm__("nop");
-    __asm__("nop");
-    __asm__("nop");
-    __asm__("memw");
-
-    fclose(fd);
-
     //cart.sram = ESP32_PSRAM + 0x280000;
 
-    /* Take care of image header, if present */
-    if ((cart.size / 512) & 1)
-    {
-        cart.size -= 512;
-        memcpy(cart.rom, cart.rom + 512, cart.size);
-    }
-
     /* 16k pages */
     cart.pages = cart.size / 0x4000;
 
-    cart.crc = crc32(0, cart.rom, option.console == 6 ? actual_size : cart.size);
+    cart.crc = crc32(0, cart.rom, option.console == 6 ? rom_size : cart.size);
     cart.loaded = 1;
 
     set_config();
 
-    printf("%s: OK. cart.crc=%#010lx\n", __func__, cart.crc);
+    printf("%s: OK. cart.crc=%#010" PRIx32 "\n", __func__, cart.crc);
 
     return true;
 }
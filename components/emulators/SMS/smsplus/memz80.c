@@ -35,7 +35,7 @@ uint8 z80_read_unmapped(void)
   int pc = Z80.pc.w.l;
   uint8 data;
   pc = (pc - 1) & 0xFFFF;
-  data = cpu_readmap[pc >> 13][pc & 0x03FF];
+  data = cpu_readmap[pc >> 10][pc & 0x03FF];
   return ((data | data_bus_pullup) & ~data_bus_pulldown);
 }
 
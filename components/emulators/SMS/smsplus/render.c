@@ -26,6 +26,9 @@
 
 #include "shared.h"
 #include <esp_attr.h>
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "profiler.h"
 
 //#include "sms_ntsc.h"
 
@@ -55,9 +58,14 @@ uint8 sms_cram_expand_table[4];
 uint8 gg_cram_expand_table[16];
 
 /* Dirty pattern info */
-//uint8 bg_name_dirty[0x200];     /* 1= This pattern is dirty */
-//uint16 bg_name_list[0x200];     /* List of modified pattern indices */
-//uint16 bg_list_index;           /* # of modified patterns in list */
+uint8 bg_name_dirty[0x200];     /* 1= This pattern is dirty */
+uint16 bg_name_list[0x200];     /* List of modified pattern indices */
+uint16 bg_list_index;           /* # of modified patterns in list */
+
+#if RENDER_BENCHMARK
+uint32 render_line_cycles;
+uint32 render_line_count;
+#endif
 
 /* Internal buffer for drawing non 8-bit displays */
 static uint8 internal_buffer[0x200];
@@ -65,7 +73,8 @@ static uint8 internal_buffer[0x200];
 /* Precalculated pixel table */
 static uint16 pixel[PALETTE_SIZE];
 
-//static uint8* bg_pattern_cache = ESP32_PSRAM + 0x300000; //[0x20000];/* Cached and flipped patterns */
+/* Cached and horizontally flipped patterns, the vertical flip is done selecting the row */
+static uint8 *bg_pattern_cache = NULL;
 
 /* Pixel look-up table */
 extern const uint8 lut[0x10000];
@@ -221,6 +230,11 @@ static __inline__ void write_dword(void *address, uint32 data)
 
 void render_shutdown(void)
 {
+  if (bg_pattern_cache)
+  {
+    heap_caps_free(bg_pattern_cache);
+    bg_pattern_cache = NULL;
+  }
 }
 
 /* Initialize the rendering data */
@@ -231,6 +245,21 @@ void render_init(void)
 
   make_tms_tables();
 
+  /* A screen of different tiles reads about 32 KB of the cache on each frame, as much as
+     the flash/PSRAM cache of the CPU, so the cache is only used on the internal RAM, and
+     a 16 KB margin is kept free for the audio buffers and the task stacks. Without it the
+     patterns are decoded from the VRAM on each line. */
+#if BG_PATTERN_CACHE
+  if (bg_pattern_cache == NULL)
+  {
+    if (heap_caps_get_free_size(MALLOC_CAP_INTERNAL) > (BG_PATTERN_CACHE_SIZE + 0x4000))
+      bg_pattern_cache = heap_caps_malloc(BG_PATTERN_CACHE_SIZE, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+
+    if (bg_pattern_cache == NULL)
+      printf("%s: not enough internal RAM, pattern cache disabled\n", __func__);
+  }
+#endif
+
 #if 0
   /* Generate 64k of data for the look up table */
   for(bx = 0; bx < 0x100; bx++)
@@ -347,10 +376,7 @@ void render_reset(void)
   }
 
   /* Invalidate pattern cache */
-  //memset(bg_name_dirty, 0, sizeof(bg_name_dirty));
-  //memset(bg_name_list, 0, sizeof(bg_name_list));
-  //bg_list_index = 0;
-  //memset(bg_pattern_cache, 0, 0x20000 /*sizeof(bg_pattern_cache)*/);
+  render_invalidate_cache();
 
   /* Pick default render routine */
   if (vdp.reg[0] & 4)
@@ -369,8 +395,24 @@ void render_reset(void)
 
 static int prev_line = -1;
 
+static void render_line_internal(int line);
+
 /* Draw a line of the display */
 IRAM_ATTR void render_line(int line)
+{
+  PROFILER_BEGIN();
+#if RENDER_BENCHMARK
+  uint32 start = xthal_get_ccount();
+  render_line_internal(line);
+  render_line_cycles += xthal_get_ccount() - start;
+  render_line_count++;
+#else
+  render_line_internal(line);
+#endif
+  PROFILER_END(PROFILER_RENDER);
+}
+
+static IRAM_ATTR void render_line_internal(int line)
 {
   int view = 1;
   int overscan = option.overscan;
@@ -494,7 +536,8 @@ IRAM_ATTR void render_line(int line)
   }
 }
 
-uint8 data[8];
+/* Decode a line of a pattern, used when there isn't a pattern cache */
+static uint8 tile_data[8];
 static IRAM_ATTR void *tile_get(short attr, short line)
 {
   // ---p cvhn nnnn nnnn
@@ -517,10 +560,10 @@ static IRAM_ATTR void *tile_get(short attr, short line)
   {
     const uint8 c = (temp >> (x << 2)) & 0x0F;
     const short index = (attr & 0x200) ? (x ^ 7) : x;
-    data[index] = (c);
+    tile_data[index] = (c);
   }
 
-  return data;
+  return tile_data;
 }
 
 /* Draw the Master System background */
@@ -542,8 +585,23 @@ IRAM_ATTR void render_bg_sms(int line)
   uint32 *linebuf_ptr = (uint32 *)&linebuf[0 - shift];
   uint8 *ctp;
 
+  /* Only the columns inside the viewport are drawn (Game Gear) */
+  int view_x = bitmap.viewport.x - (option.overscan ? 14 : 0);
+  int first = (view_x + shift) >> 3;
+  int last = (view_x + bitmap.viewport.w + shift + 7) >> 3;
+
+  if (last > 32)
+    last = 32;
+
+  if (first)
+  {
+    /* Hidden pixels are cleared so sprite collisions still see an empty line */
+    memset(linebuf, 0, view_x);
+    memset(linebuf + view_x + bitmap.viewport.w, 0, 256 - view_x - bitmap.viewport.w);
+    column = first;
+  }
   /* Draw first column (clipped) */
-  if (shift)
+  else if (shift)
   {
     int x;
 
@@ -554,7 +612,7 @@ IRAM_ATTR void render_bg_sms(int line)
   }
 
   /* Draw a line of the background */
-  for (; column < 32; column++)
+  for (; column < last; column++)
   {
     /* Stop vertical scrolling for leftmost eight columns */
     if ((vdp.reg[0] & 0x80) && (!locked) && (column >= 24))
@@ -573,9 +631,11 @@ IRAM_ATTR void render_bg_sms(int line)
     /* Expand priority and palette bits */
     atex_mask = atex[(attr >> 11) & 3];
 
-#if 0
-    /* Point to a line of pattern data in cache */
-    cache_ptr = (uint32 *)&bg_pattern_cache[((attr & 0x7FF) << 6) | (v_row)];
+#if BG_PATTERN_CACHE
+    if (bg_pattern_cache)
+      /* Point to a line of pattern data in cache */
+      cache_ptr = (uint32 *)&bg_pattern_cache[((attr & 0x3FF) << 6) | ((attr & 0x400) ? (v_row ^ 0x38) : v_row)];
+    else
 #else
     // ---p cvhn nnnn nnnn
 
@@ -603,10 +663,9 @@ IRAM_ATTR void render_bg_sms(int line)
     //   //dst[0x10000 | ((y ^ 7) << 3) | (x)] = (c);
     //   //dst[0x18000 | ((y ^ 7) << 3) | (x ^ 7)] = (c);
     // }
-
-    cache_ptr = tile_get(attr, v_row >> 3);
-
 #endif
+      cache_ptr = tile_get(attr, v_row >> 3);
+
     /* Copy the left half, adding the attribute bits in */
     write_dword(&linebuf_ptr[(column << 1)], read_dword(&cache_ptr[0]) | (atex_mask));
 
@@ -615,7 +674,7 @@ IRAM_ATTR void render_bg_sms(int line)
   }
 
   /* Draw last column (clipped) */
-  if (shift)
+  if (shift && (last == 32))
   {
     int x, c, a;
 
@@ -628,16 +687,17 @@ IRAM_ATTR void render_bg_sms(int line)
 #endif
     a = (attr >> 7) & 0x30;
 
-    uint8 *ptr = (uint8 *)tile_get(attr, v_row >> 3);
+    uint8 *ptr;
+#if BG_PATTERN_CACHE
+    if (bg_pattern_cache)
+      ptr = &bg_pattern_cache[((attr & 0x3FF) << 6) | ((attr & 0x400) ? (v_row ^ 0x38) : v_row)];
+    else
+#endif
+      ptr = (uint8 *)tile_get(attr, v_row >> 3);
     for (x = 0; x < shift; x++)
     {
-#if 0
-      c = bg_pattern_cache[((attr & 0x7FF) << 6) | (v_row) | (x)];
-      p[x] = ((c) | (a));
-#else
       c = *(ptr + x);
       p[x] = ((c) | (a));
-#endif
     }
   }
 }
@@ -698,12 +758,13 @@ IRAM_ATTR void render_obj_sms(int line)
     /* Draw double size sprite */
     if (vdp.reg[1] & 0x01)
     {
-#if 0
-      /* Retrieve tile data from cached nametable */
-      cache_ptr = (uint8 *)&bg_pattern_cache[(n << 6) | ((yp >> 1) << 3)];
-#else
-      cache_ptr = tile_get(n, yp >> 1);
+#if BG_PATTERN_CACHE
+      if (bg_pattern_cache)
+        /* Retrieve tile data from cached nametable */
+        cache_ptr = (uint8 *)&bg_pattern_cache[(n << 6) | ((yp >> 1) << 3)];
+      else
 #endif
+        cache_ptr = tile_get(n, yp >> 1);
 
       /* Draw sprite line (at 1/2 dot rate) */
       for (x = start; x < end; x += 2)
@@ -732,12 +793,13 @@ IRAM_ATTR void render_obj_sms(int line)
     }
     else /* Regular size sprite (8x8 / 8x16) */
     {
-#if 0
-      /* Retrieve tile data from cached nametable */
-      cache_ptr = (uint8 *)&bg_pattern_cache[(n << 6) | (yp << 3)];
-#else
-      cache_ptr = tile_get(n, yp);
+#if BG_PATTERN_CACHE
+      if (bg_pattern_cache)
+        /* Retrieve tile data from cached nametable */
+        cache_ptr = (uint8 *)&bg_pattern_cache[(n << 6) | (yp << 3)];
+      else
 #endif
+        cache_ptr = tile_get(n, yp);
 
       /* Draw sprite line */
       for (x = start; x < end; x++)
@@ -902,14 +964,14 @@ static IRAM_ATTR void parse_satb(int line)
 
 static IRAM_ATTR void update_bg_pattern_cache(void)
 {
-#if 1
+#if !BG_PATTERN_CACHE
   return;
 #else
   int i;
   uint8 x, y;
   uint16 name;
 
-  if (!bg_list_index)
+  if (!bg_list_index || !bg_pattern_cache)
     return;
 
   for (i = 0; i < bg_list_index; i++)
@@ -932,8 +994,6 @@ static IRAM_ATTR void update_bg_pattern_cache(void)
           uint8 c = (temp >> (x << 2)) & 0x0F;
           dst[0x00000 | (y << 3) | (x)] = (c);
           dst[0x08000 | (y << 3) | (x ^ 7)] = (c);
-          dst[0x10000 | ((y ^ 7) << 3) | (x)] = (c);
-          dst[0x18000 | ((y ^ 7) << 3) | (x ^ 7)] = (c);
         }
       }
     }
@@ -971,8 +1031,50 @@ static inline void remap_8_to_16(int line)
   // {
   //     *(dst++) = *(src++) & PIXEL_MASK;
   // }
-  int width = bitmap.viewport.w + 2 * bitmap.viewport.x;
-  memcpy(dst, internal_buffer, width);
+  /* Without overscan only the viewport is stored, 160 pixels wide on Game Gear */
+  if (option.overscan)
+    memcpy(dst, internal_buffer, bitmap.viewport.w + 2 * bitmap.viewport.x);
+  else
+    memcpy(dst, internal_buffer + bitmap.viewport.x, bitmap.viewport.w);
+#endif
+}
+
+/* Force a full pattern cache update on the next rendered line */
+void render_invalidate_cache(void)
+{
+  int i;
+
+  bg_list_index = 0x200;
+  for (i = 0; i < 0x200; i++)
+  {
+    bg_name_list[i] = i;
+    bg_name_dirty[i] = 0xFF;
+  }
+}
+
+/* Mark the pattern rows that differ from the VRAM about to be loaded, so a
+   state load doesn't have to decode the whole cache again */
+void render_update_cache(const uint8 *vram)
+{
+#if BG_PATTERN_CACHE
+  int addr, row, name;
+
+  for (addr = 0; addr < 0x4000; addr += 32)
+  {
+    if (memcmp(&vdp.vram[addr], &vram[addr], 32) == 0)
+      continue;
+
+    name = (addr >> 5) & 0x1FF;
+    for (row = 0; row < 8; row++)
+    {
+      if (memcmp(&vdp.vram[addr + row * 4], &vram[addr + row * 4], 4) == 0)
+        continue;
+
+      if (bg_name_dirty[name] == 0)
+        bg_name_list[bg_list_index++] = name;
+      bg_name_dirty[name] |= (1 << row);
+    }
+  }
 #endif
 }
 
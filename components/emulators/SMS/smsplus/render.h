@@ -31,14 +31,31 @@
 /* Used for blanking a line in whole or in part */
 #define BACKDROP_COLOR (0x10 | (vdp.reg[7] & 0x0F))
 
+/* Use the decoded background pattern cache instead of decoding each tile on the fly */
+#ifndef BG_PATTERN_CACHE
+#define BG_PATTERN_CACHE 1
+#endif
+
+/* Accumulate the CPU cycles spent on render_line() */
+#ifndef RENDER_BENCHMARK
+#define RENDER_BENCHMARK 0
+#endif
+
+/* Decoded patterns: 512 names x 8 rows x 8 pixels, normal and horizontally flipped */
+#define BG_PATTERN_CACHE_SIZE 0x10000
+
 extern void (*render_bg)(int line);
 extern void (*render_obj)(int line);
 extern uint8 *linebuf;
 extern uint8 sms_cram_expand_table[4];
 extern uint8 gg_cram_expand_table[16];
-//extern uint8 bg_name_dirty[0x200];
-//extern uint16 bg_name_list[0x200];
-//extern uint16 bg_list_index;
+extern uint8 bg_name_dirty[0x200];
+extern uint16 bg_name_list[0x200];
+extern uint16 bg_list_index;
+#if RENDER_BENCHMARK
+extern uint32 render_line_cycles;
+extern uint32 render_line_count;
+#endif
 
 extern void render_shutdown(void);
 extern void render_init(void);
@@ -48,5 +65,7 @@ extern void render_bg_sms(int line);
 extern void render_obj_sms(int line);
 extern void palette_sync(int index);
 extern void render_copy_palette(uint16 *palette);
+extern void render_invalidate_cache(void);
+extern void render_update_cache(const uint8 *vram);
 
 #endif /* _RENDER_H_ */
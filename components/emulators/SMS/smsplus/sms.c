@@ -94,6 +94,9 @@ static void writemem_mapper_korea(int offset, int data)
 
 void mapper_reset(void)
 {
+  /* Writes are done straight on cpu_writemap, except on the pages with mapper registers */
+  memset(cpu_writetrap, 0, sizeof(cpu_writetrap));
+
   switch (slot.mapper)
   {
   case MAPPER_NONE:
@@ -102,18 +105,24 @@ void mapper_reset(void)
 
   case MAPPER_CODIES:
     cpu_writemem16 = writemem_mapper_codies;
+    cpu_writetrap[0x0000 >> 10] = 1;
+    cpu_writetrap[0x4000 >> 10] = 1;
+    cpu_writetrap[0x8000 >> 10] = 1;
     break;
 
   case MAPPER_KOREA:
     cpu_writemem16 = writemem_mapper_korea;
+    cpu_writetrap[0xA000 >> 10] = 1;
     break;
 
   case MAPPER_KOREA_MSX:
     cpu_writemem16 = writemem_mapper_korea_msx;
+    cpu_writetrap[0x0000 >> 10] = 1;
     break;
 
   default:
     cpu_writemem16 = writemem_mapper_sega;
+    cpu_writetrap[0xFFFC >> 10] = 1;
     break;
   }
 }
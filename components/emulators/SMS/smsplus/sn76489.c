@@ -35,7 +35,7 @@ static SN76489_Context SN76489[MAX_SN76489];
 void SN76489_Init(int which, int PSGClockValue, int SamplingRate)
 {
     SN76489_Context *p = &SN76489[which];
-    p->dClock = (float)PSGClockValue / 16 / SamplingRate;
+    p->dClock = (INT32)(((long long)PSGClockValue << 12) / SamplingRate); /* clock / 16, in 16.16 */
     SN76489_Config(which, MUTE_ALLON, BOOST_ON, VOL_FULL, FB_SEGAVDP);
     SN76489_Reset(which);
 }
@@ -59,18 +59,12 @@ void SN76489_Reset(int which)
 
         /* Set flip-flops to 1 */
         p->ToneFreqPos[i] = 1;
-
-        /* Set intermediate positions to do-not-use value */
-        p->IntermediatePos[i] = LONG_MIN;
     }
 
     p->LatchedRegister = 0;
 
     /* Initialise noise generator */
     p->NoiseShiftRegister = NoiseInitialState;
-
-    /* Zero clock */
-    p->Clock = 0;
 }
 
 void SN76489_Shutdown(void)
@@ -152,116 +146,220 @@ void SN76489_GGStereoWrite(int which, int data)
     p->PSGStereo = data;
 }
 
-void SN76489_Update(int which, INT16 **buffer, int length)
+/* Add a constant level to samples [start, end) of the enabled outputs */
+static inline void SN76489_AddSpan(INT16 *left, INT16 *right, int start, int end, int value)
 {
-    SN76489_Context *p = &SN76489[which];
-    int i, j;
+    int j;
+
+    if (!value)
+        return;
+
+    if (left)
+        for (j = start; j < end; j++)
+            left[j] += value;
+
+    if (right)
+        for (j = start; j < end; j++)
+            right[j] += value;
+}
 
-    for (j = 0; j < length; j++)
+/* Reload a counter which ran out, the flip-flop only changes once */
+static inline INT32 SN76489_Reload(INT32 counter, INT32 period)
+{
+    return counter + period * ((-counter) / period + 1);
+}
+
+/* Run a counter for a number of PSG clocks, returns how many times it ran out */
+static inline int SN76489_Advance(INT32 *counter, INT32 period, INT32 elapsed)
+{
+    INT32 rem;
+
+    if (elapsed < *counter)
     {
-        for (i = 0; i <= 2; ++i)
-            if (p->IntermediatePos[i] != LONG_MIN)
-                p->Channels[i] = (p->Mute >> i & 0x1) * PSGVolumeValues[p->VolumeArray][p->Registers[2 * i + 1]] * p->IntermediatePos[i] / 65536;
-            else
-                p->Channels[i] = (p->Mute >> i & 0x1) * PSGVolumeValues[p->VolumeArray][p->Registers[2 * i + 1]] * p->ToneFreqPos[i];
+        *counter -= elapsed;
+        return 0;
+    }
 
-        p->Channels[3] = (short)((p->Mute >> 3 & 0x1) * PSGVolumeValues[p->VolumeArray][p->Registers[7]] * (p->NoiseShiftRegister & 0x1));
+    rem = elapsed - *counter;
+    *counter = period - (rem % period);
+    return 1 + (rem / period);
+}
 
-        if (p->BoostNoise)
-            p->Channels[3] <<= 1; /* Double noise volume to make some people happy */
+static inline UINT16 SN76489_NoiseShift(SN76489_Context *p, UINT16 nsr)
+{
+    int Feedback;
 
-        buffer[0][j] = 0;
-        buffer[1][j] = 0;
-        for (i = 0; i <= 3; ++i)
+    if (p->Registers[6] & 0x4)
+    { /* White noise */
+        /* Calculate parity of fed-back bits for feedback */
+        switch (p->WhiteNoiseFeedback)
         {
-            buffer[0][j] += (p->PSGStereo >> (i + 4) & 0x1) * p->Channels[i]; /* left */
-            buffer[1][j] += (p->PSGStereo >> i & 0x1) * p->Channels[i];       /* right */
+            /* Do some optimised calculations for common (known) feedback values */
+        case 0x0006: /* SC-3000      %00000110 */
+        case 0x0009: /* SMS, GG, MD  %00001001 */
+            /* If two bits fed back, I can do Feedback=(nsr & fb) && (nsr & fb ^ fb) */
+            /* since that's (one or more bits set) && (not all bits set) */
+            Feedback = ((nsr & p->WhiteNoiseFeedback) && ((nsr & p->WhiteNoiseFeedback) ^ p->WhiteNoiseFeedback));
+            break;
+        case 0x8005: /* BBC Micro */
+            /* fall through :P can't be bothered to think too much */
+        default: /* Default handler for all other feedback values */
+            Feedback = nsr & p->WhiteNoiseFeedback;
+            Feedback ^= Feedback >> 8;
+            Feedback ^= Feedback >> 4;
+            Feedback ^= Feedback >> 2;
+            Feedback ^= Feedback >> 1;
+            Feedback &= 1;
+            break;
         }
+    }
+    else /* Periodic noise */
+        Feedback = nsr & 1;
 
-        p->Clock += p->dClock;
-        p->NumClocksForSample = (int)p->Clock; /* truncates */
-        p->Clock -= p->NumClocksForSample;     /* remove integer part */
-        /* Looks nicer in Delphi... */
-        /*  Clock:=Clock+p->dClock; */
-        /*  NumClocksForSample:=Trunc(Clock); */
-        /*  Clock:=Frac(Clock); */
-
-        /* Decrement tone channel counters */
-        for (i = 0; i <= 2; ++i)
-            p->ToneFreqVals[i] -= p->NumClocksForSample;
-
-        /* Noise channel: match to tone2 or decrement its counter */
-        if (p->NoiseFreq == 0x80)
-            p->ToneFreqVals[3] = p->ToneFreqVals[2];
-        else
-            p->ToneFreqVals[3] -= p->NumClocksForSample;
+    return (nsr >> 1) | (Feedback << 15);
+}
+
+/* Tone channel: constant runs between flips, the sample holding a flip is
+   weighted by the time spent on each side of it. */
+static void SN76489_RenderTone(SN76489_Context *p, int i, INT16 *left, INT16 *right, int length)
+{
+    INT32 d = p->dClock;
+    INT32 period = p->Registers[i * 2] << 16;
+    INT32 c = p->ToneFreqVals[i];
+    int level = (p->Mute >> i & 0x1) * PSGVolumeValues[p->VolumeArray][p->Registers[2 * i + 1]];
+    int j = 0;
+    int k;
+
+    if (!(p->PSGStereo >> (i + 4) & 0x1))
+        left = NULL;
+    if (!(p->PSGStereo >> i & 0x1))
+        right = NULL;
+
+    if (p->Registers[i * 2] <= PSG_CUTOFF)
+    {
+        /* Above the cutoff the output is stuck high */
+        p->ToneFreqPos[i] = 1;
+        SN76489_AddSpan(left, right, 0, length, level);
+        SN76489_Advance(&p->ToneFreqVals[i], period, length * d);
+        return;
+    }
 
-        /* Tone channels: */
-        for (i = 0; i <= 2; ++i)
+    if (!level || (!left && !right))
+    {
+        /* Silent, only keep the phase running */
+        if (SN76489_Advance(&p->ToneFreqVals[i], period, length * d) & 1)
+            p->ToneFreqPos[i] = -p->ToneFreqPos[i];
+        return;
+    }
+
+    while (j < length)
+    {
+        /* Whole samples before the flip */
+        k = (c - 1) / d;
+        if (k > length - j)
+            k = length - j;
+
+        SN76489_AddSpan(left, right, j, j + k, level * p->ToneFreqPos[i]);
+        c -= k * d;
+        j += k;
+
+        if (j == length)
+            break;
+
+        /* Sample holding the flip */
+        SN76489_AddSpan(left, right, j, j + 1, level * p->ToneFreqPos[i] * ((2 * c - d) >> 4) / (d >> 4));
+        p->ToneFreqPos[i] = -p->ToneFreqPos[i];
+        c = SN76489_Reload(c - d, period);
+        j++;
+    }
+
+    p->ToneFreqVals[i] = c;
+}
+
+/* Noise channel: constant runs between shifts, the LFSR is advanced in bulk
+   while the channel is silent. */
+static void SN76489_RenderNoise(SN76489_Context *p, INT32 tone2, INT16 *left, INT16 *right, int length)
+{
+    INT32 d = p->dClock;
+    INT32 period = ((p->NoiseFreq == 0x80) ? p->Registers[4] : p->NoiseFreq) << 16;
+    INT32 c = (p->NoiseFreq == 0x80) ? tone2 : p->ToneFreqVals[3];
+    UINT16 nsr = p->NoiseShiftRegister;
+    int level = (p->Mute >> 3 & 0x1) * PSGVolumeValues[p->VolumeArray][p->Registers[7]];
+    int j = 0;
+    int k, n;
+
+    if (p->BoostNoise)
+        level <<= 1; /* Double noise volume to make some people happy */
+
+    if (!(p->PSGStereo >> 7 & 0x1))
+        left = NULL;
+    if (!(p->PSGStereo >> 3 & 0x1))
+        right = NULL;
+
+    if (!level || (!left && !right))
+    {
+        /* Shift once per cycle of the flip-flop */
+        n = SN76489_Advance(&c, period, length * d);
+        k = (p->ToneFreqPos[3] == 1) ? (n >> 1) : ((n + 1) >> 1);
+        if (n & 1)
+            p->ToneFreqPos[3] = -p->ToneFreqPos[3];
+
+        if (!(p->Registers[6] & 0x4))
         {
-            if (p->ToneFreqVals[i] <= 0)
-            { /* If it gets below 0... */
-                if (p->Registers[i * 2] > PSG_CUTOFF)
-                {
-                    /* Calculate how much of the sample is + and how much is - */
-                    /* Go to floating point and include the clock fraction for extreme accuracy :D */
-                    /* Store as long int, maybe it's faster? I'm not very good at this */
-                    p->IntermediatePos[i] = (long)((p->NumClocksForSample - p->Clock + 2 * p->ToneFreqVals[i]) * p->ToneFreqPos[i] / (p->NumClocksForSample + p->Clock) * 65536);
-                    p->ToneFreqPos[i] = -p->ToneFreqPos[i]; /* Flip the flip-flop */
-                }
-                else
-                {
-                    p->ToneFreqPos[i] = 1; /* stuck value */
-                    p->IntermediatePos[i] = LONG_MIN;
-                }
-                p->ToneFreqVals[i] += p->Registers[i * 2] * (p->NumClocksForSample / p->Registers[i * 2] + 1);
-            }
-            else
-                p->IntermediatePos[i] = LONG_MIN;
+            /* Periodic noise is a rotation */
+            k &= 15;
+            if (k)
+                nsr = (nsr >> k) | (nsr << (16 - k));
         }
+        else
+        {
+            while (k--)
+                nsr = SN76489_NoiseShift(p, nsr);
+        }
+    }
+    else
+    {
+        while (j < length)
+        {
+            /* Samples up to and including the one where the counter runs out */
+            k = (c - 1) / d + 1;
+            if (k > length - j)
+            {
+                k = length - j;
+                SN76489_AddSpan(left, right, j, length, level * (nsr & 0x1));
+                c -= k * d;
+                break;
+            }
+
+            SN76489_AddSpan(left, right, j, j + k, level * (nsr & 0x1));
+            c = SN76489_Reload(c - k * d, period);
+            j += k;
 
-        /* Noise channel */
-        if (p->ToneFreqVals[3] <= 0)
-        {                                           /* If it gets below 0... */
             p->ToneFreqPos[3] = -p->ToneFreqPos[3]; /* Flip the flip-flop */
-            if (p->NoiseFreq != 0x80)               /* If not matching tone2, decrement counter */
-                p->ToneFreqVals[3] += p->NoiseFreq * (p->NumClocksForSample / p->NoiseFreq + 1);
-            if (p->ToneFreqPos[3] == 1)
-            { /* Only once per cycle... */
-                int Feedback;
-                if (p->Registers[6] & 0x4)
-                { /* White noise */
-                    /* Calculate parity of fed-back bits for feedback */
-                    switch (p->WhiteNoiseFeedback)
-                    {
-                        /* Do some optimised calculations for common (known) feedback values */
-                    case 0x0006: /* SC-3000      %00000110 */
-                    case 0x0009: /* SMS, GG, MD  %00001001 */
-                        /* If two bits fed back, I can do Feedback=(nsr & fb) && (nsr & fb ^ fb) */
-                        /* since that's (one or more bits set) && (not all bits set) */
-                        /* which one?         Feedback=((p->NoiseShiftRegister&p->WhiteNoiseFeedback) && (p->NoiseShiftRegister&p->WhiteNoiseFeedback^p->WhiteNoiseFeedback)); */
-                        Feedback = ((p->NoiseShiftRegister & p->WhiteNoiseFeedback) && ((p->NoiseShiftRegister & p->WhiteNoiseFeedback) ^ p->WhiteNoiseFeedback));
-                        break;
-                    case 0x8005: /* BBC Micro */
-                        /* fall through :P can't be bothered to think too much */
-                    default: /* Default handler for all other feedback values */
-                        Feedback = p->NoiseShiftRegister & p->WhiteNoiseFeedback;
-                        Feedback ^= Feedback >> 8;
-                        Feedback ^= Feedback >> 4;
-                        Feedback ^= Feedback >> 2;
-                        Feedback ^= Feedback >> 1;
-                        Feedback &= 1;
-                        break;
-                    }
-                }
-                else /* Periodic noise */
-                    Feedback = p->NoiseShiftRegister & 1;
-
-                p->NoiseShiftRegister = (p->NoiseShiftRegister >> 1) | (Feedback << 15);
-
-                /* Original code: */
-                /*          p->NoiseShiftRegister=(p->NoiseShiftRegister>>1) | ((p->Registers[6]&0x4?((p->NoiseShiftRegister&0x9) && (p->NoiseShiftRegister&0x9^0x9)):p->NoiseShiftRegister&1)<<15); */
-            }
+            if (p->ToneFreqPos[3] == 1)             /* Only once per cycle... */
+                nsr = SN76489_NoiseShift(p, nsr);
         }
     }
+
+    p->ToneFreqVals[3] = c;
+    p->NoiseShiftRegister = nsr;
+}
+
+void SN76489_Update(int which, INT16 **buffer, int length)
+{
+    SN76489_Context *p = &SN76489[which];
+    INT32 tone2 = p->ToneFreqVals[2];
+    int i;
+
+    if (length <= 0)
+        return;
+
+    memset(buffer[0], 0, length * sizeof(INT16));
+    memset(buffer[1], 0, length * sizeof(INT16));
+
+    /* Noise matching tone2 follows its counter from the start of the span */
+    SN76489_RenderNoise(p, tone2, buffer[0], buffer[1], length);
+
+    for (i = 0; i <= 2; ++i)
+        SN76489_RenderTone(p, i, buffer[0], buffer[1], length);
 }
@@ -45,10 +45,8 @@ typedef struct
     int VolumeArray;
 
     /* Variables */
-    float Clock;
-    float dClock;
+    INT32 dClock; /* PSG clocks per sample, 16.16 fixed point */
     int PSGStereo;
-    int NumClocksForSample;
     int WhiteNoiseFeedback;
 
     /* PSG registers: */
@@ -58,10 +56,8 @@ typedef struct
     INT16 NoiseFreq; /* Noise channel signal generator frequency */
 
     /* Output calculation variables */
-    INT16 ToneFreqVals[4];    /* Frequency register values (counters) */
-    INT8 ToneFreqPos[4];      /* Frequency channel flip-flops */
-    INT16 Channels[4];        /* Value of each channel, before stereo is applied */
-    INT32 IntermediatePos[4]; /* intermediate values used at boundaries between + and - */
+    INT32 ToneFreqVals[4]; /* PSG clocks left before each flip-flop changes, 16.16 fixed point */
+    INT8 ToneFreqPos[4];   /* Frequency channel flip-flops */
 
 } SN76489_Context;
 
@@ -29,6 +29,7 @@
 snd_t snd;
 static int16 **fm_buffer;
 static int16 **psg_buffer;
+static int psg_done_so_far;
 int *smptab;
 int smptab_len;
 
@@ -45,6 +46,7 @@ int sound_init(void)
   snd.psg_clock = (sms.display == DISPLAY_NTSC) ? CLOCK_NTSC : CLOCK_PAL;
   snd.sample_rate = option.sndrate;
   snd.mixer_callback = NULL;
+  snd.gain = 0x100;
 
   /* Save register settings */
   if (snd.enabled)
@@ -56,10 +58,12 @@ int sound_init(void)
       abort();
 
     memcpy(psgbuf, SN76489_GetContextPtr(0), SN76489_GetContextSize());
-#if 0
+
     fmbuf = malloc(FM_GetContextSize());
+    if (!fmbuf)
+      abort();
+
     FM_GetContext(fmbuf);
-#endif
   }
 
   /* If we are reinitializing, shut down sound emulation */
@@ -98,6 +102,7 @@ int sound_init(void)
 
   /* Prepare incremental info */
   snd.done_so_far = 0;
+  psg_done_so_far = 0;
   smptab_len = (sms.display == DISPLAY_NTSC) ? 262 : 313;
   smptab = malloc(smptab_len * sizeof(int));
   if (!smptab)
@@ -119,14 +124,6 @@ int sound_init(void)
     memset(snd.stream[i], 0, snd.buffer_size);
   }
 
-#ifndef NGC
-  /* Allocate sound output streams */
-  snd.output[0] = malloc(snd.buffer_size);
-  snd.output[1] = malloc(snd.buffer_size);
-  if (!snd.output[0] || !snd.output[1])
-    abort();
-#endif
-
   /* Set up buffer pointers */
   fm_buffer = (int16 **)&snd.stream[STREAM_FM_MO];
   psg_buffer = (int16 **)&snd.stream[STREAM_PSG_L];
@@ -135,16 +132,14 @@ int sound_init(void)
   SN76489_Init(0, snd.psg_clock, snd.sample_rate);
   SN76489_Config(0, MUTE_ALLON, BOOST_OFF /*BOOST_ON*/, VOL_FULL, (sms.console < CONSOLE_SMS) ? FB_SC3000 : FB_SEGAVDP);
 
-#if 0
   /* Set up YM2413 emulation */
   FM_Init();
-#endif
 
   /* Restore YM2413 register settings */
   if (restore_sound)
   {
     memcpy(SN76489_GetContextPtr(0), psgbuf, SN76489_GetContextSize());
-    //FM_SetContext(fmbuf);
+    FM_SetContext(fmbuf);
     free(fmbuf);
     free(psgbuf);
   }
@@ -172,25 +167,11 @@ void sound_shutdown(void)
     }
   }
 
-#ifndef NGC
-  /* Free sound output buffers */
-  for (i = 0; i < 2; i++)
-  {
-    if (snd.output[i])
-    {
-      free(snd.output[i]);
-      snd.output[i] = NULL;
-    }
-  }
-#endif
-
   /* Shut down SN76489 emulation */
   SN76489_Shutdown();
 
-#if 0
   /* Shut down YM2413 emulation */
   FM_Shutdown();
-#endif
 }
 
 void sound_reset(void)
@@ -201,76 +182,60 @@ void sound_reset(void)
   /* Reset SN76489 emulator */
   SN76489_Reset(0);
 
-#if 0
   /* Reset YM2413 emulator */
   FM_Reset();
-#endif
 }
 
 void sound_update(int line)
 {
-  int16 *fm[2], *psg[2];
-
   if (!snd.enabled)
     return;
 
   /* Finish buffers at end of frame */
   if (line == smptab_len - 1)
   {
-    psg[0] = psg_buffer[0] + snd.done_so_far;
-    psg[1] = psg_buffer[1] + snd.done_so_far;
-    fm[0] = fm_buffer[0] + snd.done_so_far;
-    fm[1] = fm_buffer[1] + snd.done_so_far;
-
-    /* Generate SN76489 sample data */
-    SN76489_Update(0, psg, snd.sample_count - snd.done_so_far);
+    /* Generate remaining SN76489 sample data */
+    stream_update(STREAM_PSG_L, snd.sample_count);
 
-#if 0
-    /* Generate YM2413 sample data */
-    FM_Update(fm, snd.sample_count - snd.done_so_far);
-#endif
+    /* YM2413 sample data is generated by the audio task from the register log */
 
-    /* Mix streams into output buffer */
-    snd.mixer_callback(snd.stream, snd.output, snd.sample_count);
+    /* Mix streams into the host output buffer */
+    if (snd.output)
+      snd.mixer_callback(snd.stream, snd.output, snd.sample_count);
 
     /* Reset */
     snd.done_so_far = 0;
+    psg_done_so_far = 0;
   }
   else
   {
-    int tinybit;
-
-    tinybit = smptab[line] - snd.done_so_far;
-
-    /* Do a tiny bit */
-    psg[0] = psg_buffer[0] + snd.done_so_far;
-    psg[1] = psg_buffer[1] + snd.done_so_far;
-    fm[0] = fm_buffer[0] + snd.done_so_far;
-    fm[1] = fm_buffer[1] + snd.done_so_far;
-
-    /* Generate SN76489 sample data */
-    SN76489_Update(0, psg, tinybit);
-
-#if 0
-    /* Generate YM2413 sample data */
-    FM_Update(fm, tinybit);
-#endif
-
-    /* Sum total */
-    snd.done_so_far += tinybit;
+    /* SN76489 output is only generated when its registers change */
+    snd.done_so_far = smptab[line];
   }
 }
 
-/* Generic FM+PSG stereo mixer callback */
-void sound_mixer_callback(int16 **stream, int16 **output, int length)
+/* PSG stereo mixer callback, writes interleaved right/left frames.
+   The PSG is boosted by 2.75 (11/4) on top of the host gain, FM is
+   mixed later by the audio task. */
+void sound_mixer_callback(int16 **stream, int16 *output, int length)
 {
   int i;
+  int gain = snd.gain * 11;
+  int32 l, r;
+
   for (i = 0; i < length; i++)
   {
-    //int16 temp = (fm_buffer[0][i] + fm_buffer[1][i]) / 2;
-    //int16 temp = psg_buffer[1][i];
-    output[0][i] = psg_buffer[0][i] * 2.75f;
-    output[1][i] = psg_buffer[1][i] * 2.75f;
+    r = (psg_buffer[1][i] * gain) >> 10;
+    l = (psg_buffer[0][i] * gain) >> 10;
+
+    if (r > 32767) r = 32767;
+    else if (r < -32768) r = -32768;
+    if (l > 32767) l = 32767;
+    else if (l < -32768) l = -32768;
+
+    output[0] = r;
+    output[1] = l;
+    output += 2;
   }
 }
 
@@ -282,17 +247,32 @@ void psg_stereo_w(int data)
 {
   if (!snd.enabled)
     return;
+  stream_update(STREAM_PSG_L, snd.done_so_far);
   SN76489_GGStereoWrite(0, data);
 }
 
+/* Bring the PSG streams up to a sample position with the current registers */
 void stream_update(int which, int position)
 {
+  int16 *psg[2];
+
+  if (which != STREAM_PSG_L || position <= psg_done_so_far)
+    return;
+
+  psg[0] = psg_buffer[0] + psg_done_so_far;
+  psg[1] = psg_buffer[1] + psg_done_so_far;
+
+  /* Generate SN76489 sample data */
+  SN76489_Update(0, psg, position - psg_done_so_far);
+
+  psg_done_so_far = position;
 }
 
 void psg_write(int data)
 {
   if (!snd.enabled)
     return;
+  stream_update(STREAM_PSG_L, snd.done_so_far);
   SN76489_Write(0, data);
 }
 
@@ -316,5 +296,5 @@ void fmunit_write(int offset, int data)
 {
   if (!snd.enabled || !sms.use_fm)
     return;
-  abort(); //FM_Write(offset, data);
+  FM_Write(offset, data);
 }
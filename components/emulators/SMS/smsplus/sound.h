@@ -37,8 +37,9 @@ enum
 /* Sound emulation structure */
 typedef struct
 {
-  void (*mixer_callback)(int16 **stream, int16 **output, int length);
-  int16 *output[2];
+  void (*mixer_callback)(int16 **stream, int16 *output, int length);
+  int16 *output; /* Interleaved stereo output buffer, set by the host before each frame */
+  int gain;      /* Output gain in 8.8 fixed point, set by the host */
   int16 *stream[STREAM_MAX];
   int fm_which;
   int enabled;
@@ -57,6 +58,7 @@ extern snd_t snd;
 /* Function prototypes */
 void psg_write(int data);
 void psg_stereo_w(int data);
+void stream_update(int which, int position);
 int fmunit_detect_r(void);
 void fmunit_detect_w(int data);
 void fmunit_write(int offset, int data);
@@ -64,6 +66,6 @@ int sound_init(void);
 void sound_shutdown(void);
 void sound_reset(void);
 void sound_update(int line);
-void sound_mixer_callback(int16 **stream, int16 **output, int length);
+void sound_mixer_callback(int16 **stream, int16 *output, int length);
 
 #endif /* _SOUND_H_ */
@@ -24,125 +24,377 @@
 
 #include "shared.h"
 
-//static unsigned char* state = (unsigned char*)ESP32_PSRAM + 0x100000; //[0x10000];
-//static unsigned int bufferptr;
-
 /*
-system_load_state: sizeof sms=8216
-system_load_state: sizeof vdp=16524
-system_load_state: sizeof Z80=72
-system_load_state: sizeof SN76489_Context=92
-
-system_save_state: sizeof sms=8216
-system_save_state: sizeof vdp=16524
-system_save_state: sizeof Z80=72
-system_save_state: sizeof SN76489_Context=92
+  Compact state layout, all the values are little endian and packed:
+
+  header  "SST\0", version (16), flags (16)
+  sms     wram, machine registers
+  vdp     vram, cram, registers and counters
+  cart    mapper registers, used SRAM length (16) and data if STATE_SRAM
+  z80     registers without the pointers to the callbacks, cycles run past
+          the last frame (16, since version 2.1)
+  psg     registers and generators, the clock comes from the running emulator
+  fm      YM2413 latch and registers if STATE_FM
 */
 
-int system_save_state(void *mem)
+#define STATE_SRAM  0x01
+#define STATE_FM    0x02
+
+/* Machine registers of the SMS context, in the order they are stored */
+static uint8 *const sms_context[] =
 {
-  int i;
+  &sms.paused, &sms.save, &sms.territory, &sms.console,
+  &sms.display, &sms.fm_detect, &sms.glasses_3d, &sms.hlatch,
+  &sms.memctrl, &sms.ioctrl,
+  &sms.sio.pdr, &sms.sio.ddr, &sms.sio.txdata, &sms.sio.rxdata, &sms.sio.sctrl,
+  &sms.device[0], &sms.device[1], &sms.gun_offset
+};
+
+#define SMS_CONTEXT_SIZE  (sizeof(sms_context) / sizeof(sms_context[0]))
 
-  printf("%s: sizeof sms=%d\n", __func__, sizeof(sms));
-  printf("%s: sizeof vdp=%d\n", __func__, sizeof(vdp));
-  printf("%s: sizeof Z80=%d\n", __func__, sizeof(Z80));
-  printf("%s: sizeof SN76489_Context=%d\n", __func__, sizeof(SN76489_Context));
+static uint8 *state_ptr;
+static const uint8 *state_end;
+static int state_error;
 
-  /*** Save SMS Context ***/
-  fwrite(&sms, sizeof(sms), 1, mem);
+static void put8(int data)
+{
+  *state_ptr++ = data;
+}
 
-  /*** Save VDP state ***/
-  fwrite(&vdp, sizeof(vdp), 1, mem);
+static void put16(int data)
+{
+  put8(data);
+  put8(data >> 8);
+}
 
-  /*** Save cart info ***/
-  for (i = 0; i < 4; i++)
+static void put32(uint32 data)
+{
+  put16(data);
+  put16(data >> 16);
+}
+
+static void put(const void *data, int size)
+{
+  memcpy(state_ptr, data, size);
+  state_ptr += size;
+}
+
+static int get8(void)
+{
+  if (state_ptr >= state_end)
+  {
+    state_error = 1;
+    return 0;
+  }
+  return *state_ptr++;
+}
+
+static int get16(void)
+{
+  int data = get8();
+  return data | (get8() << 8);
+}
+
+static uint32 get32(void)
+{
+  uint32 data = get16();
+  return data | ((uint32)get16() << 16);
+}
+
+static void get(void *data, int size)
+{
+  if (state_ptr + size > state_end)
   {
-    fwrite(&cart.fcr[i], 1, 1, mem);
+    state_error = 1;
+    return;
   }
+  if (data)
+    memcpy(data, state_ptr, size);
+  state_ptr += size;
+}
 
-  /*** Save SRAM ***/
-  fwrite(&cart.sram[0], 0x8000, 1, mem);
+/* Length of the SRAM up to its last used KByte */
+static int sram_used(void)
+{
+  int size = sizeof(cart.sram);
 
-  /*** Save Z80 Context ***/
-  fwrite(&Z80, sizeof(Z80), 1, mem);
+  if (!sms.save)
+    return 0;
 
-#if 0
-  /*** Save YM2413 ***/
-  memcpy (&state[bufferptr], FM_GetContextPtr (), FM_GetContextSize ());
-  bufferptr += FM_GetContextSize ();
-#endif
+  while (size > 0 && cart.sram[size - 1] == 0)
+    size--;
 
-  /*** Save SN76489 ***/
-  fwrite(SN76489_GetContextPtr(0), SN76489_GetContextSize(), 1, mem);
+  return (size + 0x3FF) & ~0x3FF;
+}
 
-  return 0;
+int system_state_size(void)
+{
+  return 8 + sizeof(sms) + sizeof(vdp) + 6 + sizeof(cart.sram) + 64 +
+         sizeof(SN76489_Context) + FM_GetContextSize();
 }
 
-void system_load_state(void *mem)
+int system_save_state(uint8 *state)
 {
+  SN76489_Context *psg = (SN76489_Context *)SN76489_GetContextPtr(0);
+  int sram_size = sram_used();
   int i;
-  uint8 *buf;
 
-  printf("%s: sizeof sms=%d\n", __func__, sizeof(sms));
-  printf("%s: sizeof vdp=%d\n", __func__, sizeof(vdp));
-  printf("%s: sizeof Z80=%d\n", __func__, sizeof(Z80));
-  printf("%s: sizeof SN76489_Context=%d\n", __func__, sizeof(SN76489_Context));
+  state_ptr = state;
+
+  /*** Header ***/
+  put(STATE_HEADER, 4);
+  put16(STATE_VERSION);
+  put16((sram_size ? STATE_SRAM : 0) | (sms.use_fm ? STATE_FM : 0));
+
+  /*** SMS Context ***/
+  put(sms.wram, sizeof(sms.wram));
+  for (i = 0; i < SMS_CONTEXT_SIZE; i++)
+    put8(*sms_context[i]);
+
+  /*** VDP state ***/
+  put(vdp.vram, sizeof(vdp.vram));
+  put(vdp.cram, sizeof(vdp.cram));
+  put(vdp.reg, sizeof(vdp.reg));
+  put8(vdp.vscroll);
+  put8(vdp.status);
+  put8(vdp.latch);
+  put8(vdp.pending);
+  put16(vdp.addr);
+  put8(vdp.code);
+  put8(vdp.buffer);
+  put16(vdp.pn);
+  put16(vdp.ct);
+  put16(vdp.pg);
+  put16(vdp.sa);
+  put16(vdp.sg);
+  put16(vdp.ntab);
+  put16(vdp.satb);
+  put16(vdp.line);
+  put16(vdp.left);
+  put16(vdp.lpf);
+  put8(vdp.height);
+  put8(vdp.extended);
+  put8(vdp.mode);
+  put8(vdp.irq);
+  put8(vdp.vint_pending);
+  put8(vdp.hint_pending);
+  put16(vdp.cram_latch);
+  put16(vdp.spr_col);
+  put8(vdp.spr_ovr);
+  put8(vdp.bd);
 
-  /* Initialize everything */
-  system_reset();
+  /*** Cart info ***/
+  put(cart.fcr, 4);
+  put16(sram_size);
+  put(cart.sram, sram_size);
 
-  /*** Set SMS Context ***/
-  sms_t sms_tmp;
-  fread(&sms_tmp, sizeof(sms_tmp), 1, mem);
-  if (sms.console != sms_tmp.console)
+  /*** Z80 Context ***/
+  put16(Z80.pc.w.l);
+  put16(Z80.sp.w.l);
+  put16(Z80.af.w.l);
+  put16(Z80.bc.w.l);
+  put16(Z80.de.w.l);
+  put16(Z80.hl.w.l);
+  put16(Z80.ix.w.l);
+  put16(Z80.iy.w.l);
+  put16(Z80.wz.w.l);
+  put16(Z80.af2.w.l);
+  put16(Z80.bc2.w.l);
+  put16(Z80.de2.w.l);
+  put16(Z80.hl2.w.l);
+  put8(Z80.r);
+  put8(Z80.r2);
+  put8(Z80.iff1);
+  put8(Z80.iff2);
+  put8(Z80.halt);
+  put8(Z80.im);
+  put8(Z80.i);
+  put8(Z80.nmi_state);
+  put8(Z80.nmi_pending);
+  put8(Z80.irq_state);
+  put8(Z80.after_ei);
+  put16(z80_cycle_count);
+
+  /*** SN76489 ***/
+  put8(psg->PSGStereo);
+  for (i = 0; i < 8; i++)
+    put16(psg->Registers[i]);
+  put8(psg->LatchedRegister);
+  put16(psg->NoiseShiftRegister);
+  put16(psg->NoiseFreq);
+  for (i = 0; i < 4; i++)
+    put32(psg->ToneFreqVals[i]);
+  for (i = 0; i < 4; i++)
+    put8(psg->ToneFreqPos[i]);
+
+  /*** YM2413 ***/
+  if (sms.use_fm)
+    put(FM_GetContextPtr(), FM_GetContextSize());
+
+  return state_ptr - state;
+}
+
+int system_load_state(const uint8 *state, int size)
+{
+  SN76489_Context *psg = (SN76489_Context *)SN76489_GetContextPtr(0);
+  uint8 display = sms.display;
+  uint8 use_fm = sms.use_fm;
+  uint8 fm[sizeof(FM_Context)];
+  uint8 context[SMS_CONTEXT_SIZE];
+  const uint8 *wram;
+  int version, flags, sram_size;
+  int i;
+
+  state_ptr = (uint8 *)state;
+  state_end = state + size;
+  state_error = 0;
+
+  /*** Header ***/
+  version = size < 8 ? 0 : state[4] | (state[5] << 8);
+  if (size < 8 || memcmp(state, STATE_HEADER, 4) != 0 || (version != STATE_VERSION && version != STATE_VERSION_2_0))
+  {
+    printf("%s: Unknown save data version\n", __func__);
+    return -1;
+  }
+  state_ptr += 6;
+  flags = get16();
+
+  /*** SMS Context, kept aside until the reset and checked against this machine ***/
+  wram = state_ptr;
+  get(NULL, sizeof(sms.wram));
+  get(context, SMS_CONTEXT_SIZE);
+  for (i = 0; i < SMS_CONTEXT_SIZE; i++)
+  {
+    if (sms_context[i] == &sms.console && context[i] != sms.console)
+      state_error = 1;
+  }
+
+  if (state_error)
   {
-    system_reset();
     printf("%s: Bad save data\n", __func__);
-    return;
+    return -1;
   }
-  sms = sms_tmp;
 
-  /*** Set vdp state ***/
-  fread(&vdp, sizeof(vdp), 1, mem);
+  /* Only the patterns changed by the load are decoded again, the VRAM is next */
+  if (state_ptr + sizeof(vdp.vram) <= state_end)
+    render_update_cache(state_ptr);
+  else
+    render_invalidate_cache();
 
-  /** restore video & audio settings (needed if timing changed) ***/
-  vdp_init();
-  sound_init();
+  /* Initialize everything, the renderer keeps its frame and pattern cache */
+  sms_reset();
+  pio_reset();
+  vdp_reset();
+  sound_reset();
 
-  /*** Set cart info ***/
-  for (i = 0; i < 4; i++)
+  memcpy(sms.wram, wram, sizeof(sms.wram));
+  for (i = 0; i < SMS_CONTEXT_SIZE; i++)
+    *sms_context[i] = context[i];
+
+  /*** VDP state ***/
+  get(vdp.vram, sizeof(vdp.vram));
+  get(vdp.cram, sizeof(vdp.cram));
+  get(vdp.reg, sizeof(vdp.reg));
+  vdp.vscroll = get8();
+  vdp.status = get8();
+  vdp.latch = get8();
+  vdp.pending = get8();
+  vdp.addr = get16();
+  vdp.code = get8();
+  vdp.buffer = get8();
+  vdp.pn = get16();
+  vdp.ct = get16();
+  vdp.pg = get16();
+  vdp.sa = get16();
+  vdp.sg = get16();
+  vdp.ntab = get16();
+  vdp.satb = get16();
+  vdp.line = get16();
+  vdp.left = get16();
+  vdp.lpf = get16();
+  vdp.height = get8();
+  vdp.extended = get8();
+  vdp.mode = get8();
+  vdp.irq = get8();
+  vdp.vint_pending = get8();
+  vdp.hint_pending = get8();
+  vdp.cram_latch = get16();
+  vdp.spr_col = get16();
+  vdp.spr_ovr = get8();
+  vdp.bd = get8();
+
+  /** restore video & audio settings, only needed if the timing changed ***/
+  if (sms.display != display)
   {
-    fread(&cart.fcr[i], 1, 1, mem);
+    vdp_init();
+    sound_init();
   }
 
-  /*** Set SRAM ***/
-  fread(&cart.sram[0], 0x8000, 1, mem);
-
-  /*** Set Z80 Context ***/
-  int (*irq_cb)(int) = Z80.irq_callback;
-  fread(&Z80, sizeof(Z80), 1, mem);
-  Z80.irq_callback = irq_cb;
+  /*** Cart info ***/
+  get(cart.fcr, 4);
+  sram_size = get16();
+  if (sram_size > sizeof(cart.sram))
+    state_error = 1;
+  else
+  {
+    get(cart.sram, sram_size);
+    memset(cart.sram + sram_size, 0, sizeof(cart.sram) - sram_size);
+  }
 
-#if 0
-  /*** Set YM2413 ***/
-  buf = malloc(FM_GetContextSize());
-  memcpy (buf, &state[bufferptr], FM_GetContextSize ());
-  FM_SetContext(buf);
-  free(buf);
-  bufferptr += FM_GetContextSize ();
-#endif
+  /*** Z80 Context ***/
+  Z80.pc.d = get16();
+  Z80.sp.d = get16();
+  Z80.af.d = get16();
+  Z80.bc.d = get16();
+  Z80.de.d = get16();
+  Z80.hl.d = get16();
+  Z80.ix.d = get16();
+  Z80.iy.d = get16();
+  Z80.wz.d = get16();
+  Z80.af2.d = get16();
+  Z80.bc2.d = get16();
+  Z80.de2.d = get16();
+  Z80.hl2.d = get16();
+  Z80.r = get8();
+  Z80.r2 = get8();
+  Z80.iff1 = get8();
+  Z80.iff2 = get8();
+  Z80.halt = get8();
+  Z80.im = get8();
+  Z80.i = get8();
+  Z80.nmi_state = get8();
+  Z80.nmi_pending = get8();
+  Z80.irq_state = get8();
+  Z80.after_ei = get8();
+  if (version != STATE_VERSION_2_0)
+    z80_cycle_count = (INT16)get16();
 
-  // Preserve clock rate
-  SN76489_Context *psg = (SN76489_Context *)SN76489_GetContextPtr(0);
-  float psg_Clock = psg->Clock;
-  float psg_dClock = psg->dClock;
+  /*** SN76489, the clock and the configuration are kept ***/
+  psg->PSGStereo = get8();
+  for (i = 0; i < 8; i++)
+    psg->Registers[i] = get16();
+  psg->LatchedRegister = get8();
+  psg->NoiseShiftRegister = get16();
+  psg->NoiseFreq = (INT16)get16();
+  for (i = 0; i < 4; i++)
+    psg->ToneFreqVals[i] = get32();
+  for (i = 0; i < 4; i++)
+    psg->ToneFreqPos[i] = (INT8)get8();
 
-  /*** Set SN76489 ***/
-  fread(SN76489_GetContextPtr(0), SN76489_GetContextSize(), 1, mem);
+  /*** YM2413, only if this machine has it ***/
+  if (flags & STATE_FM)
+  {
+    get(fm, FM_GetContextSize());
+    if (use_fm && !state_error)
+      FM_SetContext(fm);
+  }
 
-  // Restore clock rate
-  psg->Clock = psg_Clock;
-  psg->dClock = psg_dClock;
+  if (state_error)
+  {
+    printf("%s: Truncated save data\n", __func__);
+    system_reset();
+    return -1;
+  }
 
   if ((sms.console != CONSOLE_COLECO) && (sms.console != CONSOLE_SG1000))
   {
@@ -171,15 +423,9 @@ void system_load_state(void *mem)
     }
   }
 
-  // /* Force full pattern cache update */
-  // bg_list_index = 0x200;
-  // for(i = 0; i < 0x200; i++)
-  // {
-  //   bg_name_list[i] = i;
-  //   bg_name_dirty[i] = -1;
-  // }
-
   /* Restore palette */
   for (i = 0; i < PALETTE_SIZE; i++)
     palette_sync(i);
+
+  return 0;
 }
@@ -25,11 +25,13 @@
 #ifndef _STATE_H_
 #define _STATE_H_
 
-#define STATE_VERSION 0x0104 /* Version 1.4 (BCD) */
+#define STATE_VERSION 0x0201 /* Version 2.1 (BCD), compact layout */
+#define STATE_VERSION_2_0 0x0200 /* Without the Z80 cycle count, still loaded */
 #define STATE_HEADER "SST\0" /* State file header */
 
 /* Function prototypes */
-extern int system_save_state(void *mem);
-extern void system_load_state(void *mem);
+extern int system_state_size(void);
+extern int system_save_state(uint8 *state);
+extern int system_load_state(const uint8 *state, int size);
 
 #endif /* _STATE_H_ */
@@ -23,6 +23,7 @@
  ******************************************************************************/
 
 #include "shared.h"
+#include "profiler.h"
 
 bitmap_t bitmap;
 cart_t cart;
@@ -114,7 +115,9 @@ void system_frame(int skip_render)
     }
 
     /* Run sound chips */
+    PROFILER_BEGIN();
     sound_update(vdp.line);
+    PROFILER_END(PROFILER_AUDIO);
   }
 
   /* Adjust Z80 cycle count for next frame */
@@ -143,7 +146,6 @@ void system_shutdown(void)
 
 void system_reset(void)
 {
-  printf("system reset\r\n");
   sms_reset();
   pio_reset();
   vdp_reset();
@@ -28,8 +28,8 @@
 
 #include "freertos/FreeRTOS.h"
 
-#if 0
-/* Mark a pattern as dirty */
+#if BG_PATTERN_CACHE
+/* Mark a pattern row as dirty */
 #define MARK_BG_DIRTY(addr)                          \
   {                                                  \
     int name = (addr >> 5) & 0x1FF;                  \
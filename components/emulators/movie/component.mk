@@ -0,0 +1,3 @@
+CFLAGS +=  -DIS_LITTLE_ENDIAN
+COMPONENT_ADD_INCLUDEDIRS := .
+COMPONENT_SRCDIRS := .
\ No newline at end of file
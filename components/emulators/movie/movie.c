@@ -0,0 +1,294 @@
+/*********************
+ *      INCLUDES
+ *********************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp32/rom/crc.h"
+
+#include "sd_storage.h"
+#include "movie.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+// Header of the movie files, "MOVI".
+#define MOVIE_MAGIC         0x49564F4D
+#define MOVIE_VERSION       1
+
+// Longest recording, 30 minutes at 60 FPS.
+#define MOVIE_MAX_FRAMES    (30 * 60 * 60)
+// Frames between two CRCs of the state.
+#define CHECK_PERIOD        60
+
+#define MOVIE_OFF           0
+#define MOVIE_REC           1
+#define MOVIE_PLAY          2
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+
+// Followed by the starting state padded to a word, the input of each frame and the CRCs.
+typedef struct{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t check_period;
+    uint32_t frames;
+    uint32_t state_length;
+}movie_header_t;
+
+/**********************
+ *  STATIC PROTOTYPES
+ **********************/
+static void movie_check(void);
+static void movie_end(void);
+
+/**********************
+ *   STATIC VARIABLES
+ **********************/
+static const char *TAG = "movie";
+
+static uint8_t mode = MOVIE_OFF;
+static char *movie_path = NULL;
+
+static movie_save_t save_state = NULL;
+static int state_max = 0;
+static uint8_t *state = NULL;   // Scratch buffer for the CRCs of the state.
+
+// While replaying they point to the movie file.
+static uint8_t *file = NULL;
+static uint8_t *start_state = NULL;
+static uint32_t start_length = 0;
+static uint16_t *inputs = NULL;
+static uint32_t *crcs = NULL;
+static uint32_t frames = 0;
+static uint32_t position = 0;
+
+static uint32_t mismatches = 0;
+static uint32_t first_mismatch = 0;
+static int64_t start_time = 0;
+
+/**********************
+ *   GLOBAL FUNCTIONS
+ **********************/
+
+bool movie_init(const char *path, int state_size, movie_save_t save, movie_load_t load){
+    save_state = save;
+    state_max = state_size;
+
+    state = heap_caps_malloc(state_max, MALLOC_CAP_SPIRAM);
+    if(state == NULL){
+        ESP_LOGE(TAG,"Not enough memory for the movie state.");
+        return false;
+    }
+
+    size_t size = 0;
+    file = sd_save_read(path, &size);
+
+    if(file != NULL){
+        movie_header_t header = {0};
+        if(size >= sizeof(header)) memcpy(&header, file, sizeof(header));
+
+        uint32_t state_size = (header.state_length + 3) & ~3;
+        uint32_t input_size = (header.frames * sizeof(uint16_t) + 3) & ~3;
+        uint32_t crc_size = ((header.frames + CHECK_PERIOD - 1) / CHECK_PERIOD) * sizeof(uint32_t);
+
+        if(header.magic != MOVIE_MAGIC || header.version != MOVIE_VERSION || header.check_period != CHECK_PERIOD ||
+           header.state_length > state_max || header.frames > MOVIE_MAX_FRAMES ||
+           size < sizeof(header) + state_size + input_size + crc_size){
+            ESP_LOGE(TAG,"Invalid movie file: %s",path);
+            goto fail;
+        }
+
+        start_state = file + sizeof(header);
+        start_length = header.state_length;
+        inputs = (uint16_t *)(start_state + state_size);
+        crcs = (uint32_t *)((uint8_t *)inputs + input_size);
+        frames = header.frames;
+
+        if(!load(start_state, start_length)){
+            ESP_LOGE(TAG,"Error restoring the starting state of the movie.");
+            goto fail;
+        }
+
+        ESP_LOGI(TAG,"Replaying movie of %u frames",frames);
+        mode = MOVIE_PLAY;
+    }
+    else if(MOVIE_RECORD){
+        start_state = heap_caps_malloc(state_max, MALLOC_CAP_SPIRAM);
+        inputs = heap_caps_malloc(MOVIE_MAX_FRAMES * sizeof(uint16_t), MALLOC_CAP_SPIRAM);
+        crcs = heap_caps_malloc((MOVIE_MAX_FRAMES / CHECK_PERIOD + 1) * sizeof(uint32_t), MALLOC_CAP_SPIRAM);
+        movie_path = strdup(path);
+
+        if(start_state == NULL || inputs == NULL || crcs == NULL || movie_path == NULL){
+            ESP_LOGE(TAG,"Not enough memory to record a movie.");
+            goto fail;
+        }
+
+        int length = save(start_state, state_max);
+        if(length < 0){
+            ESP_LOGE(TAG,"Error creating the starting state of the movie.");
+            goto fail;
+        }
+        start_length = length;
+        frames = 0;
+
+        ESP_LOGI(TAG,"Recording movie: %s",path);
+        mode = MOVIE_REC;
+    }
+    else goto fail;
+
+    position = 0;
+    mismatches = 0;
+    start_time = esp_timer_get_time();
+    return true;
+
+fail:
+    if(file == NULL){
+        free(start_state);
+        free(inputs);
+        free(crcs);
+    }
+    free(file);
+    free(movie_path);
+    free(state);
+    file = start_state = state = NULL;
+    inputs = NULL;
+    crcs = NULL;
+    movie_path = NULL;
+    return false;
+}
+
+uint16_t movie_input(uint16_t input){
+    if(mode == MOVIE_OFF) return input;
+
+    if(mode == MOVIE_PLAY && position == frames){
+        movie_end();
+        return input;
+    }
+
+    if(position % CHECK_PERIOD == 0) movie_check();
+
+    if(mode == MOVIE_PLAY){
+        input = inputs[position++];
+        // The next frame already takes the live input.
+        if(position == frames) movie_end();
+        return input;
+    }
+
+    if(position == MOVIE_MAX_FRAMES){
+        ESP_LOGW(TAG,"Movie full, recording stopped.");
+        movie_flush();
+        movie_end();
+        return input;
+    }
+
+    inputs[position++] = input;
+    frames = position;
+    return input;
+}
+
+bool movie_active(void){
+    return mode != MOVIE_OFF;
+}
+
+void movie_flush(void){
+    if(mode != MOVIE_REC) return;
+
+    uint32_t state_size = (start_length + 3) & ~3;
+    uint32_t input_size = (frames * sizeof(uint16_t) + 3) & ~3;
+    uint32_t crc_size = ((frames + CHECK_PERIOD - 1) / CHECK_PERIOD) * sizeof(uint32_t);
+    size_t size = sizeof(movie_header_t) + state_size + input_size + crc_size;
+
+    uint8_t *data = heap_caps_calloc(1, size, MALLOC_CAP_SPIRAM);
+    if(data == NULL){
+        ESP_LOGE(TAG,"Not enough memory to save the movie.");
+        return;
+    }
+
+    movie_header_t header = {
+        .magic = MOVIE_MAGIC,
+        .version = MOVIE_VERSION,
+        .check_period = CHECK_PERIOD,
+        .frames = frames,
+        .state_length = start_length,
+    };
+
+    uint8_t *ptr = data;
+    memcpy(ptr, &header, sizeof(header));
+    ptr += sizeof(header);
+    memcpy(ptr, start_state, start_length);
+    ptr += state_size;
+    memcpy(ptr, inputs, frames * sizeof(uint16_t));
+    ptr += input_size;
+    memcpy(ptr, crcs, crc_size);
+
+    ESP_LOGI(TAG,"Saving movie of %u frames, %u bytes",frames,size);
+
+    if(!sd_save_write(movie_path, data, size)) free(data);
+}
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+/* Function: movie_check
+ * ---------------------
+ * Store the CRC of the state while recording, or compare it with the
+ * recorded one while replaying.
+ */
+static void movie_check(void){
+    int length = save_state(state, state_max);
+    if(length < 0) return;
+
+    uint32_t crc = crc32_le(0, state, length);
+    uint32_t index = position / CHECK_PERIOD;
+
+    if(mode == MOVIE_REC) crcs[index] = crc;
+    else if(crc != crcs[index]){
+        if(mismatches == 0){
+            first_mismatch = position;
+            ESP_LOGW(TAG,"State differs from the recording at frame %u",position);
+        }
+        mismatches++;
+    }
+}
+
+/* Function: movie_end
+ * ---------------------
+ * Report the replay and give the pad back to the player.
+ */
+static void movie_end(void){
+    int64_t elapsed = esp_timer_get_time() - start_time;
+
+    if(mode == MOVIE_PLAY){
+        uint32_t checks = (frames + CHECK_PERIOD - 1) / CHECK_PERIOD;
+
+        printf("Movie: %u frames in %lli ms, %.2f FPS\n", frames, elapsed / 1000,
+               elapsed ? frames * 1000000.0f / elapsed : 0.0f);
+        if(mismatches) printf("Movie: %u of %u state checks differ, first at frame %u\n", mismatches, checks, first_mismatch);
+        else printf("Movie: all %u state checks match\n", checks);
+
+        free(file);
+    }
+    else{
+        free(start_state);
+        free(inputs);
+        free(crcs);
+    }
+
+    free(state);
+    free(movie_path);
+    file = start_state = state = NULL;
+    inputs = NULL;
+    crcs = NULL;
+    movie_path = NULL;
+    mode = MOVIE_OFF;
+}
@@ -0,0 +1,80 @@
+/*********************
+ *      INCLUDES
+ *********************/
+#include "stdint.h"
+#include "stdbool.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+// Set to 1 to record a movie of the games that don't have one yet, it's saved with the game.
+#define MOVIE_RECORD    0
+
+// Serializes the emulator on the buffer, returns the length of the state or -1 on error.
+typedef int (*movie_save_t)(void *buffer, int size);
+// Restores a state created by the save function, returns false on error.
+typedef bool (*movie_load_t)(const void *buffer, int size);
+
+/*********************
+ *      FUNCTIONS
+ *********************/
+
+/*
+ * Function:  movie_init
+ * --------------------
+ *
+ * If there is a movie on the path, restore its starting state and replay it. Otherwise,
+ * if MOVIE_RECORD is enabled, take the starting state and record a new one. Call it
+ * once the game is loaded and before the first frame.
+ *
+ * Arguments:
+ *  -path: Valid path to the movie file.
+ *  -state_size: Maximum size of the states of the emulator.
+ *  -save: Function to serialize the emulator.
+ *  -load: Function to restore the emulator.
+ *
+ * Returns: True if a movie is being recorded or replayed.
+ *
+ */
+bool movie_init(const char *path, int state_size, movie_save_t save, movie_load_t load);
+
+/*
+ * Function:  movie_input
+ * --------------------
+ *
+ * Call it with the value of input_read() each time the emulator reads the pad, once per
+ * frame. While recording the value is stored, while replaying the recorded one is
+ * returned instead. Every second the CRC of the state is stored or compared with the
+ * recorded one. At the end of the replay the time and mismatches are reported.
+ *
+ * Arguments:
+ *  -input: Value of the buttons read from the hardware.
+ *
+ * Returns: Value of the buttons the emulator has to use.
+ *
+ */
+uint16_t movie_input(uint16_t input);
+
+/*
+ * Function:  movie_active
+ * --------------------
+ *
+ * Rewind, run-ahead and fast-forward change the emulation, they are disabled while
+ * a movie is recorded or replayed.
+ *
+ * Returns: True if a movie is being recorded or replayed.
+ *
+ */
+bool movie_active(void);
+
+/*
+ * Function:  movie_flush
+ * --------------------
+ *
+ * Queue the movie recorded so far to the save task, call it when the game is saved.
+ *
+ * Returns: Nothing.
+ *
+ */
+void movie_flush(void);
@@ -0,0 +1,387 @@
+/*********************
+ *      INCLUDES
+ *********************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+#include "rewind.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+// The buffer is halved from the largest size until the allocation succeeds.
+#define RING_SIZE_MAX       (1024 * 1024)
+#define RING_SIZE_MIN       (64 * 1024)
+#define MAX_SNAPSHOTS       512
+
+#define INTERVAL_MIN        4
+#define INTERVAL_MAX        60
+// Snapshots between two checks of the time budget.
+#define BUDGET_WINDOW       8
+// Time per frame the snapshots can use, 3% of a 60 Hz frame.
+#define BUDGET_US           500
+// The interval gets longer if the buffer can't hold this history, and only gets shorter
+// again while the buffer is less than half full.
+#define HISTORY_MIN_FRAMES  (20 * 60)
+// Frames played backwards for each frame shown while rewinding.
+#define REWIND_SPEED        3
+
+// Each delta is a list of tokens, with the number of unchanged words on the low half and
+// the number of changed words that follow the token on the high half.
+#define TOKEN(zeros, literals)  ((uint32_t)(zeros) | (uint32_t)(literals) << 16)
+#define TOKEN_ZEROS(token)      ((token) & 0xFFFF)
+#define TOKEN_LITERALS(token)   ((token) >> 16)
+#define RUN_MAX                 0xFFFF
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct{
+    uint32_t offset;        // Position of the delta on the ring, always word aligned.
+    uint32_t size;          // Bytes of the delta.
+    uint32_t words;         // Words of the state covered by the delta.
+    uint32_t prev_length;   // Length of the state this delta goes back to.
+    uint16_t frames;        // Frames between the previous state and this one.
+    bool raw;               // The delta is stored as a plain XOR, it didn't compress.
+}rewind_entry_t;
+
+/**********************
+ *  STATIC PROTOTYPES
+ **********************/
+static int delta_encode(const uint32_t *cur, const uint32_t *prev, int words, uint32_t *out);
+static void delta_apply(uint32_t *state, const uint32_t *delta, const rewind_entry_t *entry);
+static bool ring_store(const uint32_t *delta, rewind_entry_t *entry);
+static void ring_drop_oldest(void);
+static void budget_check(int64_t elapsed);
+
+/**********************
+ *   STATIC VARIABLES
+ **********************/
+static const char *TAG = "rewind";
+
+static rewind_save_t save_state = NULL;
+static rewind_load_t load_state = NULL;
+
+static bool enabled = false;
+static bool primed = false;     // The last state holds a snapshot.
+
+// The newest state and the one being created, swapped after each snapshot.
+static uint32_t *last = NULL;
+static uint32_t *work = NULL;
+static uint32_t *delta = NULL;
+static int state_max = 0;
+static int last_length = 0;
+static int work_length = 0;     // Bytes of the work buffer which may be non zero.
+
+static uint8_t *ring = NULL;
+static uint32_t ring_size = 0;
+static uint32_t ring_head = 0;
+
+static rewind_entry_t *entries = NULL;
+static uint16_t entry_first = 0;
+static uint16_t entry_count = 0;
+static uint32_t history_frames = 0;
+static uint32_t ring_used = 0;
+
+static uint16_t interval = INTERVAL_MIN;
+static uint16_t frame_count = 0;
+static uint16_t pop_wait = 0;
+
+static int64_t budget_time = 0;
+static uint16_t budget_count = 0;
+static uint32_t push_us = 0;
+
+/**********************
+ *   GLOBAL FUNCTIONS
+ **********************/
+
+bool rewind_init(int state_size, rewind_save_t save, rewind_load_t load){
+    if(state_size <= 0 || save == NULL || load == NULL) return false;
+
+    state_max = (state_size + 3) & ~3;
+    save_state = save;
+    load_state = load;
+
+    last = heap_caps_calloc(1, state_max, MALLOC_CAP_SPIRAM);
+    work = heap_caps_calloc(1, state_max, MALLOC_CAP_SPIRAM);
+    delta = heap_caps_malloc(state_max, MALLOC_CAP_SPIRAM);
+    entries = heap_caps_malloc(MAX_SNAPSHOTS * sizeof(rewind_entry_t), MALLOC_CAP_SPIRAM);
+
+    if(last == NULL || work == NULL || delta == NULL || entries == NULL){
+        ESP_LOGW(TAG,"Not enough PSRAM for the state buffers, rewind disabled.");
+        goto fail;
+    }
+
+    for(ring_size = RING_SIZE_MAX; ring_size >= RING_SIZE_MIN; ring_size /= 2){
+        ring = heap_caps_malloc(ring_size, MALLOC_CAP_SPIRAM);
+        if(ring != NULL) break;
+    }
+
+    if(ring == NULL){
+        ESP_LOGW(TAG,"Not enough PSRAM for the rewind buffer, rewind disabled.");
+        goto fail;
+    }
+
+    ESP_LOGI(TAG,"Rewind buffer of %u KB for states of %i bytes",ring_size / 1024, state_size);
+
+    enabled = true;
+    return true;
+
+fail:
+    free(last);
+    free(work);
+    free(delta);
+    free(entries);
+    last = work = delta = NULL;
+    entries = NULL;
+    return false;
+}
+
+void rewind_push(void){
+    if(!enabled) return;
+
+    pop_wait = 0;
+    if(++frame_count < interval) return;
+    frame_count = 0;
+
+    int64_t start_time = esp_timer_get_time();
+
+    int length = save_state(work, state_max);
+    if(length < 0 || length > state_max){
+        ESP_LOGE(TAG,"Error creating the rewind snapshot.");
+        return;
+    }
+
+    // Both buffers must be zero after their states, the delta doesn't store the tails.
+    if(work_length > length) memset((uint8_t *)work + length, 0, work_length - length);
+    int words = ((length > last_length ? length : last_length) + 3) / 4;
+    if(length & 3) memset((uint8_t *)work + length, 0, 4 - (length & 3));
+
+    if(primed){
+        rewind_entry_t entry;
+        entry.words = words;
+        entry.prev_length = last_length;
+        entry.frames = interval;
+
+        int encoded = delta_encode(work, last, words, delta);
+        if(encoded < 0){
+            // It would be larger than the state itself, store the plain difference.
+            for(int i = 0; i < words; i++) delta[i] = work[i] ^ last[i];
+            encoded = words;
+            entry.raw = true;
+        }
+        else entry.raw = false;
+
+        entry.size = encoded * 4;
+
+        if(!ring_store(delta, &entry)){
+            // Without this delta the older snapshots can't be reached.
+            entry_count = 0;
+            history_frames = 0;
+            ring_used = 0;
+        }
+    }
+
+    uint32_t *aux = last;
+    last = work;
+    work = aux;
+    work_length = last_length;
+    last_length = length;
+    primed = true;
+
+    budget_check(esp_timer_get_time() - start_time);
+}
+
+bool rewind_pop(void){
+    if(!enabled || entry_count == 0) return false;
+
+    uint16_t newest = (entry_first + entry_count - 1) % MAX_SNAPSHOTS;
+    rewind_entry_t *entry = &entries[newest];
+
+    // Each snapshot is shown for a part of the frames it covers.
+    if(pop_wait){
+        pop_wait--;
+        return false;
+    }
+    pop_wait = entry->frames / REWIND_SPEED;
+
+    delta_apply(last, (const uint32_t *)(ring + entry->offset), entry);
+    last_length = entry->prev_length;
+
+    entry_count--;
+    history_frames -= entry->frames;
+    ring_used -= entry->size;
+    ring_head = entry->offset;
+    frame_count = 0;
+
+    if(!load_state(last, last_length)){
+        ESP_LOGE(TAG,"Error restoring the rewind snapshot.");
+        return false;
+    }
+
+    return true;
+}
+
+void rewind_stats(rewind_stats_t *stats){
+    stats->snapshots = entry_count;
+    stats->interval = interval;
+    stats->frames = history_frames;
+    stats->used = ring_used;
+    stats->size = ring_size;
+    stats->push_us = push_us;
+}
+
+void rewind_report(uint16_t refresh_rate){
+    if(!enabled || entry_count == 0) return;
+
+    printf("Rewind: %u s on %u KB, snapshot every %u frames, %u us/frame\n",
+           history_frames / refresh_rate, ring_used / 1024, interval, push_us / interval);
+}
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+/* Function: delta_encode
+ * ---------------------
+ * Run length encode the XOR of two states. Returns the words written to the
+ * output or -1 if the encoded delta would be as large as the state.
+ */
+static int delta_encode(const uint32_t *cur, const uint32_t *prev, int words, uint32_t *out){
+    int pos = 0;
+    int i = 0;
+
+    while(i < words){
+        uint32_t zeros = 0;
+        while(i < words && zeros < RUN_MAX && cur[i] == prev[i]){
+            zeros++;
+            i++;
+        }
+
+        if(pos >= words) return -1;
+        int token = pos++;
+
+        uint32_t literals = 0;
+        while(i < words && literals < RUN_MAX && cur[i] != prev[i]){
+            if(pos >= words) return -1;
+            out[pos++] = cur[i] ^ prev[i];
+            literals++;
+            i++;
+        }
+
+        out[token] = TOKEN(zeros, literals);
+    }
+
+    return pos;
+}
+
+/* Function: delta_apply
+ * ---------------------
+ * XOR a delta over the newest state, which turns it into the previous one.
+ */
+static void delta_apply(uint32_t *state, const uint32_t *delta, const rewind_entry_t *entry){
+    if(entry->raw){
+        for(uint32_t i = 0; i < entry->words; i++) state[i] ^= delta[i];
+        return;
+    }
+
+    const uint32_t *end = delta + entry->size / 4;
+    uint32_t i = 0;
+
+    while(delta < end){
+        uint32_t token = *delta++;
+        i += TOKEN_ZEROS(token);
+        for(uint32_t n = TOKEN_LITERALS(token); n > 0; n--) state[i++] ^= *delta++;
+    }
+}
+
+/* Function: ring_store
+ * ---------------------
+ * Copy a delta after the newest one, wrapping to the start of the ring when it
+ * doesn't fit at the end and dropping the oldest deltas in its way.
+ */
+static bool ring_store(const uint32_t *delta, rewind_entry_t *entry){
+    if(entry->size > ring_size) return false;
+
+    uint32_t offset = ring_head;
+    bool dropped = false;
+
+    if(offset + entry->size > ring_size){
+        // The deltas after the head are the oldest ones, they go before the ones at the start.
+        while(entry_count > 0 && entries[entry_first].offset >= ring_head){
+            ring_drop_oldest();
+            dropped = true;
+        }
+        offset = 0;
+    }
+
+    while(entry_count > 0){
+        rewind_entry_t *oldest = &entries[entry_first];
+        bool overlap = oldest->offset < offset + entry->size && offset < oldest->offset + oldest->size;
+        if(!overlap && entry_count < MAX_SNAPSHOTS) break;
+        ring_drop_oldest();
+        dropped = true;
+    }
+
+    // The buffer is full before holding enough history, take the snapshots less often.
+    if(dropped && history_frames < HISTORY_MIN_FRAMES && interval < INTERVAL_MAX){
+        interval *= 2;
+        if(interval > INTERVAL_MAX) interval = INTERVAL_MAX;
+        ESP_LOGI(TAG,"Rewind buffer full, snapshot every %u frames",interval);
+    }
+
+    memcpy(ring + offset, delta, entry->size);
+    entry->offset = offset;
+
+    entries[(entry_first + entry_count) % MAX_SNAPSHOTS] = *entry;
+    entry_count++;
+    history_frames += entry->frames;
+    ring_used += entry->size;
+    ring_head = offset + entry->size;
+
+    return true;
+}
+
+/* Function: ring_drop_oldest
+ * ---------------------
+ * Forget the oldest delta, the history starts on the state it led to.
+ */
+static void ring_drop_oldest(void){
+    history_frames -= entries[entry_first].frames;
+    ring_used -= entries[entry_first].size;
+    entry_first = (entry_first + 1) % MAX_SNAPSHOTS;
+    entry_count--;
+}
+
+/* Function: budget_check
+ * ---------------------
+ * Every few snapshots compare their average cost per frame with the budget,
+ * doubling the interval when it's over and halving it when it's well below.
+ */
+static void budget_check(int64_t elapsed){
+    budget_time += elapsed;
+    if(++budget_count < BUDGET_WINDOW) return;
+
+    push_us = budget_time / budget_count;
+    budget_time = 0;
+    budget_count = 0;
+
+    uint32_t frame_us = push_us / interval;
+
+    if(frame_us > BUDGET_US && interval < INTERVAL_MAX){
+        interval *= 2;
+        if(interval > INTERVAL_MAX) interval = INTERVAL_MAX;
+        ESP_LOGI(TAG,"Snapshot takes %u us, snapshot every %u frames",push_us,interval);
+    }
+    else if(frame_us * 4 < BUDGET_US && interval > INTERVAL_MIN && ring_used < ring_size / 2){
+        interval /= 2;
+        if(interval < INTERVAL_MIN) interval = INTERVAL_MIN;
+    }
+}
@@ -0,0 +1,102 @@
+/*********************
+ *      INCLUDES
+ *********************/
+#include "stdint.h"
+#include "stdbool.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+// Bit of input_read() that rewinds the game while it's held, the L shoulder button.
+#define REWIND_BUTTON   9
+
+// Serializes the emulator on the buffer, returns the length of the state or -1 on error.
+typedef int (*rewind_save_t)(void *buffer, int size);
+// Restores a state created by the save function, returns false on error.
+typedef bool (*rewind_load_t)(const void *buffer, int size);
+
+typedef struct{
+    uint16_t snapshots;     // Snapshots on the buffer.
+    uint16_t interval;      // Frames between two snapshots.
+    uint32_t frames;        // Frames of history that can be rewound.
+    uint32_t used;          // Bytes of the buffer used by the snapshots.
+    uint32_t size;          // Size of the buffer.
+    uint32_t push_us;       // Average time spent on each snapshot.
+}rewind_stats_t;
+
+/*********************
+ *      FUNCTIONS
+ *********************/
+
+/*
+ * Function:  rewind_init
+ * --------------------
+ *
+ * Allocate the rewind buffer on the PSRAM. If there isn't enough memory the buffer is
+ * halved until it fits, if even the smallest one doesn't fit rewind is disabled.
+ *
+ * Arguments:
+ *  -state_size: Maximum size of the states of the emulator.
+ *  -save: Function to serialize the emulator.
+ *  -load: Function to restore the emulator.
+ *
+ * Returns: True if rewind is available.
+ *
+ */
+bool rewind_init(int state_size, rewind_save_t save, rewind_load_t load);
+
+/*
+ * Function:  rewind_push
+ * --------------------
+ *
+ * Call it after each emulated frame. Every few frames the state is stored on the buffer
+ * as the difference with the previous one, the oldest snapshots are dropped when it's full.
+ * The number of frames between snapshots grows when they cost too much time or the
+ * buffer can't hold enough history, and shrinks back when they are cheap.
+ *
+ * Returns: Nothing.
+ *
+ */
+void rewind_push(void);
+
+/*
+ * Function:  rewind_pop
+ * --------------------
+ *
+ * Call it on each frame while the rewind button is held. The emulator goes back one
+ * snapshot every few calls, so the game plays backwards a bit faster than real time.
+ *
+ * Returns: True if a state was restored and a frame should be rendered.
+ *
+ */
+bool rewind_pop(void);
+
+/*
+ * Function:  rewind_stats
+ * --------------------
+ *
+ * Get the memory and time used by the rewind buffer.
+ *
+ * Arguments:
+ *  -stats: Returns the statistics.
+ *
+ * Returns: Nothing.
+ *
+ */
+void rewind_stats(rewind_stats_t *stats);
+
+/*
+ * Function:  rewind_report
+ * --------------------
+ *
+ * Print the history held by the buffer and the time the snapshots take on each frame,
+ * nothing is printed until the first snapshot is stored.
+ *
+ * Arguments:
+ *  -refresh_rate: Frames per second of the console, to print the history in seconds.
+ *
+ * Returns: Nothing.
+ *
+ */
+void rewind_report(uint16_t refresh_rate);
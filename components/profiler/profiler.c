@@ -0,0 +1,296 @@
+/*********************
+ *      INCLUDES
+ *********************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "sdkconfig.h"
+
+#include "profiler.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+// Scopes that can be open at the same time on a task.
+#define DEPTH_MAX       4
+
+// The histograms have 1 ms buckets, the last one holds the longer frames.
+#define BUCKETS         34
+#define BUCKET_US       1000
+
+// Overlay: full width for 20 ms, a 4 pixel bar and a gap for each task and the frame time.
+#define SCALE_US        20000
+#define BUDGET_US       16667
+#define BAR_HEIGHT      4
+#define BAR_PITCH       5
+#define OVERLAY_LINES   ((PROFILER_TASKS + 1) * BAR_PITCH)
+
+#define SWAP(color)     ((uint16_t)(((color) >> 8) | ((color) << 8)))
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct{
+    TaskHandle_t handle;
+    uint8_t depth;
+    uint32_t start[DEPTH_MAX];          // Cycle count when each open scope began.
+    uint32_t child[DEPTH_MAX];          // Cycles of the scopes nested inside each open one.
+    volatile uint32_t cycles[PROFILER_PHASES];  // Running totals, only written by the task.
+}task_scopes_t;
+
+typedef struct{
+    uint16_t window[PROFILER_WINDOW];   // Microseconds on each frame of the window.
+    uint32_t sum;
+}rolling_t;
+
+/**********************
+ *  STATIC PROTOTYPES
+ **********************/
+static task_scopes_t * current_task(void);
+static void rolling_add(rolling_t *rolling, uint32_t us);
+static void rolling_range(const rolling_t *rolling, uint16_t *min, uint16_t *max);
+static void histogram_print(const char *name, const uint16_t *histogram);
+static void overlay_bar(uint16_t *line, int width, int from_us, int to_us, uint16_t color);
+
+/**********************
+ *   STATIC VARIABLES
+ **********************/
+static const char *task_names[PROFILER_TASKS] = {"Emulator (core 0)", "Video (core 1)", "Audio (core 1)"};
+static const char *phase_names[PROFILER_PHASES] = {"cpu", "render", "audio", "scaler", "spi", "input", "wait"};
+
+// RGB565 color of each phase on the overlay.
+static const uint16_t phase_colors[PROFILER_PHASES] = {0xF800, 0x07E0, 0x001F, 0x07FF, 0xF81F, 0xFFE0, 0x8410};
+
+static task_scopes_t tasks[PROFILER_TASKS];
+
+// Only used by the emulator task, on profiler_frame() and profiler_report().
+static uint32_t last_cycles[PROFILER_TASKS][PROFILER_PHASES];
+static rolling_t phases[PROFILER_TASKS][PROFILER_PHASES];
+static rolling_t frame_time;
+static uint16_t task_histogram[PROFILER_TASKS][BUCKETS];
+static uint16_t frame_histogram[BUCKETS];
+static uint32_t last_frame = 0;
+static uint32_t position = 0;
+static uint32_t frames = 0;
+
+// Read by the video task to draw the overlay.
+static volatile uint16_t average_us[PROFILER_TASKS][PROFILER_PHASES];
+static volatile uint16_t frame_average_us = 0;
+static volatile uint16_t frame_max_us = 0;
+
+/**********************
+ *   GLOBAL FUNCTIONS
+ **********************/
+
+void profiler_register(profiler_task_t task){
+    if(!PROFILER) return;
+
+    tasks[task].depth = 0;
+    tasks[task].handle = xTaskGetCurrentTaskHandle();
+}
+
+void IRAM_ATTR profiler_begin(void){
+    task_scopes_t *task = current_task();
+    if(task == NULL) return;
+
+    // The scopes past the maximum depth are counted on their parent.
+    if(task->depth < DEPTH_MAX){
+        task->start[task->depth] = xthal_get_ccount();
+        task->child[task->depth] = 0;
+    }
+    task->depth++;
+}
+
+void IRAM_ATTR profiler_end(profiler_phase_t phase){
+    task_scopes_t *task = current_task();
+    if(task == NULL || task->depth == 0) return;
+
+    task->depth--;
+    if(task->depth >= DEPTH_MAX) return;
+
+    uint32_t elapsed = xthal_get_ccount() - task->start[task->depth];
+    task->cycles[phase] += elapsed - task->child[task->depth];
+
+    if(task->depth) task->child[task->depth - 1] += elapsed;
+}
+
+void profiler_frame(void){
+    if(!PROFILER) return;
+
+    uint32_t now = xthal_get_ccount();
+    uint32_t frame_us = last_frame ? (now - last_frame) / CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ : 0;
+    last_frame = now;
+
+    for(int t = 0; t < PROFILER_TASKS; t++){
+        uint32_t busy_us = 0;
+
+        for(int p = 0; p < PROFILER_PHASES; p++){
+            // The other tasks keep adding to their totals, only the difference is taken.
+            uint32_t cycles = tasks[t].cycles[p];
+            uint32_t us = (cycles - last_cycles[t][p]) / CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+            last_cycles[t][p] = cycles;
+
+            rolling_add(&phases[t][p], us);
+            average_us[t][p] = phases[t][p].sum / PROFILER_WINDOW;
+
+            // The waits aren't work, they are left out of the busy time.
+            if(p != PROFILER_WAIT) busy_us += us;
+        }
+
+        if(tasks[t].handle != NULL){
+            int bucket = busy_us / BUCKET_US;
+            task_histogram[t][bucket < BUCKETS ? bucket : BUCKETS - 1]++;
+        }
+    }
+
+    if(frame_us){
+        int bucket = frame_us / BUCKET_US;
+        frame_histogram[bucket < BUCKETS ? bucket : BUCKETS - 1]++;
+    }
+
+    rolling_add(&frame_time, frame_us);
+    frame_average_us = frame_time.sum / PROFILER_WINDOW;
+
+    uint16_t min, max;
+    rolling_range(&frame_time, &min, &max);
+    frame_max_us = max;
+
+    position = (position + 1) % PROFILER_WINDOW;
+    frames++;
+}
+
+void profiler_report(void){
+    if(!PROFILER || frames == 0) return;
+
+    uint16_t min, max;
+    rolling_range(&frame_time, &min, &max);
+    printf("Profiler: %u frames, frame %u us (min %u, max %u)\n", frames, frame_time.sum / PROFILER_WINDOW, min, max);
+
+    for(int t = 0; t < PROFILER_TASKS; t++){
+        if(tasks[t].handle == NULL) continue;
+
+        printf("  %s\n", task_names[t]);
+        for(int p = 0; p < PROFILER_PHASES; p++){
+            rolling_range(&phases[t][p], &min, &max);
+            if(max == 0) continue;
+            printf("    %-7s avg %5u us, min %5u us, max %5u us\n", phase_names[p], phases[t][p].sum / PROFILER_WINDOW, min, max);
+        }
+    }
+
+    histogram_print("Frame time", frame_histogram);
+    for(int t = 0; t < PROFILER_TASKS; t++){
+        if(tasks[t].handle != NULL) histogram_print(task_names[t], task_histogram[t]);
+    }
+
+    memset(frame_histogram, 0, sizeof(frame_histogram));
+    memset(task_histogram, 0, sizeof(task_histogram));
+    frames = 0;
+}
+
+void profiler_overlay(uint16_t *buffer, int width, int lines){
+    if(!PROFILER) return;
+
+    if(lines > OVERLAY_LINES) lines = OVERLAY_LINES;
+    int budget_x = BUDGET_US * width / SCALE_US;
+
+    for(int y = 0; y < lines; y++){
+        uint16_t *line = &buffer[y * width];
+        int row = y / BAR_PITCH;
+
+        memset(line, 0, width * sizeof(uint16_t));
+
+        if(y % BAR_PITCH < BAR_HEIGHT){
+            if(row < PROFILER_TASKS){
+                // The phases of the task one after the other.
+                int from_us = 0;
+                for(int p = 0; p < PROFILER_PHASES; p++){
+                    int to_us = from_us + average_us[row][p];
+                    overlay_bar(line, width, from_us, to_us, phase_colors[p]);
+                    from_us = to_us;
+                }
+            }
+            else{
+                // Average frame time, with the longest frame of the window in red.
+                overlay_bar(line, width, 0, frame_average_us, 0xFFFF);
+                overlay_bar(line, width, frame_max_us - 200, frame_max_us, 0xF800);
+            }
+        }
+
+        if(budget_x < width) line[budget_x] = SWAP(0xFFFF);
+    }
+}
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+/* Function: current_task
+ * ---------------------
+ * Scopes of the calling task, NULL if it isn't registered.
+ */
+static IRAM_ATTR task_scopes_t * current_task(void){
+    TaskHandle_t handle = xTaskGetCurrentTaskHandle();
+
+    for(int i = 0; i < PROFILER_TASKS; i++){
+        if(tasks[i].handle == handle) return &tasks[i];
+    }
+    return NULL;
+}
+
+/* Function: rolling_add
+ * ---------------------
+ * Replace the oldest frame of the window.
+ */
+static void rolling_add(rolling_t *rolling, uint32_t us){
+    if(us > UINT16_MAX) us = UINT16_MAX;
+
+    rolling->sum -= rolling->window[position];
+    rolling->window[position] = us;
+    rolling->sum += us;
+}
+
+/* Function: rolling_range
+ * ---------------------
+ * Shortest and longest frames of the window.
+ */
+static void rolling_range(const rolling_t *rolling, uint16_t *min, uint16_t *max){
+    *min = UINT16_MAX;
+    *max = 0;
+
+    for(int i = 0; i < PROFILER_WINDOW; i++){
+        if(rolling->window[i] < *min) *min = rolling->window[i];
+        if(rolling->window[i] > *max) *max = rolling->window[i];
+    }
+}
+
+/* Function: histogram_print
+ * ---------------------
+ * Print the buckets with frames as "ms:frames", the last one is for the
+ * frames of that length or longer.
+ */
+static void histogram_print(const char *name, const uint16_t *histogram){
+    printf("  %s ms:", name);
+    for(int i = 0; i < BUCKETS; i++){
+        if(histogram[i]) printf(" %i%s:%u", i, i == BUCKETS - 1 ? "+" : "", histogram[i]);
+    }
+    printf("\n");
+}
+
+/* Function: overlay_bar
+ * ---------------------
+ * Fill the pixels of a line between two times of the scale.
+ */
+static void overlay_bar(uint16_t *line, int width, int from_us, int to_us, uint16_t color){
+    int from = from_us * width / SCALE_US;
+    int to = to_us * width / SCALE_US;
+
+    if(from < 0) from = 0;
+    if(to > width) to = width;
+
+    for(int x = from; x < to; x++) line[x] = SWAP(color);
+}
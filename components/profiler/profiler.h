@@ -0,0 +1,130 @@
+/*********************
+ *      INCLUDES
+ *********************/
+#include "stdint.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+// Enable the frame profiler, the scopes compile to nothing when it's disabled.
+#define PROFILER        0
+
+// Frames of the rolling window, the serial dump is printed once per window.
+#define PROFILER_WINDOW 60
+
+// Where the time of a frame goes. A scope only counts its own time, the scopes nested
+// inside it are counted on their own phase.
+typedef enum{
+    PROFILER_CPU = 0,   // CPU core emulation.
+    PROFILER_RENDER,    // PPU, VDP or LCD line rendering.
+    PROFILER_AUDIO,     // Audio synthesis and mixing.
+    PROFILER_SCALER,    // Scaling and color conversion of the frame to the display lines.
+    PROFILER_SPI,       // Sending the lines to the display.
+    PROFILER_INPUT,     // Reading the buttons.
+    PROFILER_WAIT,      // Blocked on the queues between the tasks or on the I2S DMA.
+    PROFILER_PHASES
+}profiler_phase_t;
+
+// Tasks of the emulators, the emulator runs on core 0, video and audio on core 1.
+typedef enum{
+    PROFILER_EMULATOR_TASK = 0,
+    PROFILER_VIDEO_TASK,
+    PROFILER_AUDIO_TASK,
+    PROFILER_TASKS
+}profiler_task_t;
+
+#if PROFILER
+#define PROFILER_BEGIN()        profiler_begin()
+#define PROFILER_END(phase)     profiler_end(phase)
+#else
+#define PROFILER_BEGIN()
+#define PROFILER_END(phase)
+#endif
+
+/*********************
+ *      FUNCTIONS
+ *********************/
+
+/*
+ * Function:  profiler_register
+ * --------------------
+ *
+ * Call it at the start of each emulator task, only the scopes of the registered tasks
+ * are counted.
+ *
+ * Arguments:
+ *  -task: Role of the calling task.
+ *
+ * Returns: Nothing.
+ *
+ */
+void profiler_register(profiler_task_t task);
+
+/*
+ * Function:  profiler_begin
+ * --------------------
+ *
+ * Open a scope on the calling task, use the PROFILER_BEGIN() macro instead so it's
+ * removed when the profiler is disabled.
+ *
+ * Returns: Nothing.
+ *
+ */
+void profiler_begin(void);
+
+/*
+ * Function:  profiler_end
+ * --------------------
+ *
+ * Close the last scope opened by the calling task and add its time to a phase. Use the
+ * PROFILER_END() macro instead so it's removed when the profiler is disabled.
+ *
+ * Arguments:
+ *  -phase: Phase the time of the scope belongs to.
+ *
+ * Returns: Nothing.
+ *
+ */
+void profiler_end(profiler_phase_t phase);
+
+/*
+ * Function:  profiler_frame
+ * --------------------
+ *
+ * Call it from the emulator task after each frame. The time of every task since the
+ * previous call is added to the rolling window and the histograms.
+ *
+ * Returns: Nothing.
+ *
+ */
+void profiler_frame(void);
+
+/*
+ * Function:  profiler_report
+ * --------------------
+ *
+ * Print the rolling min/avg/max of each phase and task and the histograms of the frame
+ * time on the serial port, then clear the histograms. The managers call it with the FPS.
+ *
+ * Returns: Nothing.
+ *
+ */
+void profiler_report(void);
+
+/*
+ * Function:  profiler_overlay
+ * --------------------
+ *
+ * Draw the average time of each phase as a bar per task on a stripe of display lines,
+ * with a mark on the 60 FPS budget. The scale is 20 ms for the whole width.
+ *
+ * Arguments:
+ *  -buffer: Byte swapped RGB565 lines, as sent to the display.
+ *  -width: Width of the lines.
+ *  -lines: Number of lines of the stripe, the overlay uses up to 20 of them.
+ *
+ * Returns: Nothing.
+ *
+ */
+void profiler_overlay(uint16_t *buffer, int width, int lines);
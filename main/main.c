@@ -37,6 +37,12 @@ TaskHandle_t gui_handler;
 TaskHandle_t intro_handler;
 TimerHandle_t timer;
 
+// The running game is saved with this period, the SD card is written on the background.
+#define AUTOSAVE_PERIOD_MS  30000
+
+// Run-ahead frames chosen on the game menu, every game starts with them.
+static uint8_t run_ahead_frames = 0;
+
 
 static const char *TAG = "microByte_main";
 
@@ -45,15 +51,13 @@ void intro_taks(void *arg){
    boot_screen_task();
 }
 
-static void timer_isr(void){
-    printf("save\r\n");
-    //gnuboy_save();
+static void timer_isr(TimerHandle_t xTimer){
     struct SYSTEM_MODE emulator;
     emulator.mode = MODE_SAVE_GAME;
-   // emulator.console = emulator_selected;
 
-    if( xQueueSend( modeQueue,&emulator, ( TickType_t ) 10) != pdPASS ){
-        ESP_LOGE(TAG,"modeQueue send error");
+    // The timer task can't block, if the queue is busy this save is skipped.
+    if( xQueueSend( modeQueue,&emulator, 0) != pdPASS ){
+        ESP_LOGW(TAG,"modeQueue busy, autosave skipped");
     }
 }
 
@@ -92,6 +96,9 @@ void app_main(void){
 
     bool game_running = false;
     bool game_executed = false;
+
+    timer = xTimerCreate("autosave", pdMS_TO_TICKS(AUTOSAVE_PERIOD_MS), pdTRUE, NULL, timer_isr);
+    if(timer == NULL) ESP_LOGE(TAG,"Save timer initialization fail.");
     while(1){
         struct SYSTEM_MODE management;
 
@@ -105,19 +112,11 @@ void app_main(void){
                         if(management.console == GAMEBOY_COLOR || management.console == GAMEBOY){
                             vTaskSuspend(gui_handler);
                             gnuboy_load_game(management.game_name,management.console);
-                                
-                                gnuboy_start();
-                                game_executed = true;
-                                game_running=true;
-                                console_running = management.console;
-                           /* timer = xTimerCreate("nes", pdMS_TO_TICKS( 30000 ), pdTRUE, NULL, timer_isr);
-                            if(timer != pdPASS) xTimerStart(timer, 0);
-                            else{
-                                ESP_LOGE(TAG,"Save timer initialization fail.");
-                            }*/
-	                        
-                            
-                            
+                            gnuboy_run_ahead(run_ahead_frames);
+                            gnuboy_start();
+                            game_executed = true;
+                            game_running=true;
+                            console_running = management.console;
                         }
                         else if(management.console == NES){
                             vTaskSuspend(gui_handler);
@@ -131,14 +130,19 @@ void app_main(void){
                             vTaskSuspend(gui_handler);
 
                             SMS_load_game(management.game_name,management.console);
+                            SMS_run_ahead(run_ahead_frames);
                             SMS_start();
                             game_executed = true;
                             game_running=true;
                             console_running = management.console;
                         }
+
+                        if(timer != NULL) xTimerStart(timer, 0);
                     }
                     else{
                         if(game_running && game_executed){
+                            // A suspended game has nothing new to save.
+                            if(timer != NULL) xTimerStop(timer, 0);
                            if(console_running == GAMEBOY_COLOR || console_running == GAMEBOY ) gnuboy_suspend();
                            else if(console_running == NES) NES_suspend();
                            else if(console_running == SMS || console_running == GG) SMS_suspend();
@@ -159,6 +163,7 @@ void app_main(void){
                             if(console_running == GAMEBOY_COLOR || console_running == GAMEBOY ) gnuboy_resume();
                            else if(console_running == NES) NES_resume();
                            else if(console_running == SMS || console_running == GG) SMS_resume();
+                            if(timer != NULL) xTimerStart(timer, 0);
                             game_running=true;
                         }
 
@@ -166,12 +171,15 @@ void app_main(void){
                 break;
 
                 case MODE_SAVE_GAME:
-
-                        ESP_LOGI(TAG,"Saving data GameBoy Color");
-                      //  gnuboy_save();
-                      SMS_save_game();
-                        printf("guardado\r\n");
-                    
+                    // A running game takes the snapshot at the end of its frame, a suspended one is resumed until then.
+                    if(game_executed){
+                        if(console_running == GAMEBOY_COLOR || console_running == GAMEBOY ) gnuboy_save();
+                        else if(console_running == NES) NES_save_game();
+                        else if(console_running == SMS || console_running == GG) SMS_save_game();
+
+                        // The audio of the frame run to take the snapshot isn't played on the menu.
+                        if(!game_running) audio_terminate();
+                    }
                 break;
 
                 case MODE_EXT_APP:
@@ -180,6 +188,8 @@ void app_main(void){
                     external_app_init(management.game_name);
                     display_HAL_clear();
                    //update_init(management.game_name);
+                   // The saves still queued would be lost with the restart.
+                   sd_save_sync();
                    esp_restart();
                    
                 break;
@@ -187,6 +197,7 @@ void app_main(void){
                 case MODE_BATTERY_ALERT:
                     //If in play mode, pause game and show if you wanna save
                     //If in the menu just show the message
+                    if(timer != NULL) xTimerStop(timer, 0);
                     gnuboy_suspend();
                     audio_terminate();
                             // Is necessary this delay to avoid bouncing between suspend and delay state.
@@ -201,6 +212,15 @@ void app_main(void){
                     audio_volume_set((float)management.volume_level);
                 break;
 
+                case MODE_CHANGE_RUN_AHEAD:
+                    run_ahead_frames = management.run_ahead_frames;
+
+                    if(game_executed){
+                        if(console_running == GAMEBOY_COLOR || console_running == GAMEBOY ) gnuboy_run_ahead(run_ahead_frames);
+                        else if(console_running == SMS || console_running == GG) SMS_run_ahead(run_ahead_frames);
+                    }
+                break;
+
                 case MODE_CHANGE_BRIGHT:
                     //st7789_backlight_set(management.brightness_level);
                 break;
@@ -210,6 +230,7 @@ void app_main(void){
 
                     if(battery_get_percentage() >= 70){
                         update_init(management.game_name);
+                        sd_save_sync();
                         esp_restart();
                     }
                     else{
@@ -220,6 +241,7 @@ void app_main(void){
                 break;
 
                 case MODE_OUT:
+                    sd_save_sync();
                     esp_restart();
                 break;
             }
@@ -0,0 +1,325 @@
+/*********************
+ *      INCLUDES
+ *********************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp32/rom/crc.h"
+
+#include "system_manager.h"
+#include "movie.h"
+#include "rewind.h"
+#include "bench.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+// One minute of game when there isn't a movie.
+#define DEFAULT_FRAMES  3600
+
+/**********************
+ *  STATIC PROTOTYPES
+ **********************/
+static void usage(const char *name);
+static bool state_round_trip(const bench_core_t *core, uint8_t *first, uint8_t *second);
+
+/**********************
+ *   STATIC VARIABLES
+ **********************/
+static uint64_t phase_ns[PHASE_MAX];
+
+static uint32_t video_crc = 0;
+static uint32_t audio_crc = 0;
+static uint64_t audio_samples = 0;
+
+// Frame being emulated and the hashes of its output, for the input script and the golden file.
+static long current_frame = 0;
+static uint32_t frame_hashes[GOLDEN_MAX];
+
+static const char *phase_names[PHASE_MAX] = {
+    "Emulation",
+    "Audio",
+    "Input",
+    "Sinks",
+};
+
+/**********************
+ *   GLOBAL FUNCTIONS
+ **********************/
+
+int main(int argc, char *argv[]){
+    const char *sd_root = ".";
+    const char *movie_path = NULL;
+    const char *script_path = NULL;
+    const char *golden_path = NULL;
+    long frames = -1;
+    bool draw_all = false;
+    bool update_golden = false;
+    bool rewind = false;
+    bool round_trip = false;
+    int opt;
+
+    while((opt = getopt(argc, argv, "s:n:m:i:g:uarth")) != -1){
+        switch(opt){
+            case 's': sd_root = optarg; break;
+            case 'n': frames = atol(optarg); break;
+            case 'm': movie_path = optarg; break;
+            case 'i': script_path = optarg; break;
+            case 'g': golden_path = optarg; break;
+            case 'u': update_golden = true; break;
+            case 'a': draw_all = true; break;
+            case 'r': rewind = true; break;
+            case 't': round_trip = true; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    if(argc - optind != 2 || (update_golden && golden_path == NULL)){
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *console_name = argv[optind];
+    const char *game_name = argv[optind + 1];
+
+    const bench_core_t *core;
+    uint8_t console;
+    if(!strcmp(console_name, "gb")) { core = &bench_gnuboy; console = GAMEBOY; }
+    else if(!strcmp(console_name, "gbc")) { core = &bench_gnuboy; console = GAMEBOY_COLOR; }
+    else if(!strcmp(console_name, "nes")) { core = &bench_nofrendo; console = NES; }
+    else if(!strcmp(console_name, "sms")) { core = &bench_smsplus; console = SMS; }
+    else if(!strcmp(console_name, "gg")) { core = &bench_smsplus; console = GG; }
+    else{
+        usage(argv[0]);
+        return 1;
+    }
+
+    sd_host_root = sd_root;
+
+    if(core->load(game_name, console) != 0){
+        fprintf(stderr, "Error loading %s from %s\n", game_name, sd_root);
+        return 1;
+    }
+
+    if(movie_path != NULL && !movie_init(movie_path, core->state_size(), core->state_save, core->state_load)){
+        fprintf(stderr, "Error loading the movie %s\n", movie_path);
+        return 1;
+    }
+
+    if(script_path != NULL && !bench_script_load(script_path)) return 1;
+
+    if(rewind && !rewind_init(core->state_size(), core->state_save, core->state_load)){
+        fprintf(stderr, "Error creating the rewind buffer\n");
+        return 1;
+    }
+
+    // With a movie and without a number of frames, the whole movie is replayed.
+    if(frames < 0) frames = movie_path != NULL ? 0 : DEFAULT_FRAMES;
+
+    uint8_t *state = NULL;
+    if(golden_path != NULL){
+        char header[512];
+        snprintf(header, sizeof(header), "# host_bench golden: %s %s, %li frames, %s drawn", console_name,
+                 game_name, frames, draw_all ? "all" : "every other frame");
+
+        state = malloc(core->state_size());
+        if(state == NULL){
+            fprintf(stderr, "Not enough memory for the state hash\n");
+            return 1;
+        }
+
+        if(!bench_golden_open(golden_path, update_golden, header)) return 1;
+    }
+
+    uint8_t *round_trip_states = NULL;
+    if(round_trip){
+        round_trip_states = malloc(core->state_size() * 2);
+        if(round_trip_states == NULL){
+            fprintf(stderr, "Not enough memory for the state round trip\n");
+            return 1;
+        }
+    }
+
+    uint64_t drawn_ns = 0;
+    uint64_t skipped_ns = 0;
+    long drawn = 0;
+    long count = 0;
+
+    uint64_t start_time = bench_clock();
+
+    // The devices draw every other frame, the movie ends the run when there isn't a frame count.
+    while(frames ? count < frames : movie_active()){
+        bool shown = draw_all || (count % 2) == 0;
+        uint64_t emulation = phase_ns[PHASE_EMULATION];
+
+        current_frame = count;
+        memset(frame_hashes, 0, sizeof(frame_hashes));
+
+        core->frame(shown);
+
+        // Like the managers, the snapshots are part of the emulation and stop during a movie.
+        if(rewind && !movie_active()) rewind_push();
+
+        // The game goes on from the loaded state, the golden hashes show what it lost.
+        if(round_trip){
+            uint64_t start = bench_clock();
+            if(!state_round_trip(core, round_trip_states, round_trip_states + core->state_size())){
+                fprintf(stderr, "State round trip failed on frame %li\n", count);
+                return 3;
+            }
+            bench_phase(PHASE_SINK, start);
+        }
+
+        if(golden_path != NULL){
+            uint64_t start = bench_clock();
+            int length = core->state_save(state, core->state_size());
+            if(length > 0) frame_hashes[GOLDEN_STATE] = crc32_le(0, state, length);
+            bench_golden_frame(count, frame_hashes);
+            bench_phase(PHASE_SINK, start);
+        }
+
+        if(shown){
+            drawn_ns += phase_ns[PHASE_EMULATION] - emulation;
+            drawn++;
+        }
+        else skipped_ns += phase_ns[PHASE_EMULATION] - emulation;
+        count++;
+    }
+
+    uint64_t elapsed = bench_clock() - start_time;
+
+    // Only writes when the movie component is built to record.
+    movie_flush();
+    if(count == 0 || elapsed == 0){
+        fprintf(stderr, "No frames emulated\n");
+        return 1;
+    }
+
+    // The video and audio tasks of the device run on the other core, the sinks that
+    // stand in for them are left out of the speed.
+    uint64_t emulated = elapsed - phase_ns[PHASE_SINK];
+    double fps = count * 1e9 / emulated;
+
+    printf("Game: %s (%s, %s)\n", game_name, console_name, core->name);
+    printf("Frames: %li, %li drawn, %.3f s\n", count, drawn, elapsed / 1e9);
+    printf("Speed: %.1f frames/s, %llu ns/frame, x%.2f real time\n", fps,
+           (unsigned long long)(emulated / count), fps / core->refresh_rate);
+
+    for(int i = 0; i < PHASE_MAX; i++){
+        printf("%-10s %10llu ns/frame  %5.1f%%\n", phase_names[i], (unsigned long long)(phase_ns[i] / count),
+               100.0 * phase_ns[i] / elapsed);
+    }
+
+    if(core->report) core->report();
+    if(rewind) rewind_report(core->refresh_rate);
+
+    // The cost of drawing is the difference between the frames drawn and the skipped ones.
+    if(drawn && count > drawn){
+        uint64_t drawn_avg = drawn_ns / drawn;
+        uint64_t skipped_avg = skipped_ns / (count - drawn);
+        printf("Emulation: %llu ns drawn, %llu ns skipped, %lli ns to draw a frame\n",
+               (unsigned long long)drawn_avg, (unsigned long long)skipped_avg,
+               (long long)drawn_avg - (long long)skipped_avg);
+    }
+
+    printf("Hash: video %08x, audio %08x (%llu samples)\n", video_crc, audio_crc, (unsigned long long)audio_samples);
+
+    free(state);
+    free(round_trip_states);
+
+    // A different exit code than the errors, the regression script reports them apart.
+    if(bench_golden_close()) return 2;
+    return 0;
+}
+
+uint64_t bench_clock(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void bench_phase(uint8_t phase, uint64_t start){
+    phase_ns[phase] += bench_clock() - start;
+}
+
+uint16_t bench_input(void){
+    uint64_t start = bench_clock();
+    // The movie replaces the buttons of the script, like the ones of the device.
+    uint16_t input = movie_input(bench_script_input(current_frame));
+    bench_phase(PHASE_INPUT, start);
+    return input;
+}
+
+void bench_video(const void *data, size_t size){
+    uint64_t start = bench_clock();
+    video_crc = crc32_le(video_crc, data, size);
+    frame_hashes[GOLDEN_VIDEO] = crc32_le(frame_hashes[GOLDEN_VIDEO], data, size);
+    bench_phase(PHASE_SINK, start);
+}
+
+void bench_audio(const int16_t *samples, size_t count){
+    uint64_t start = bench_clock();
+    audio_crc = crc32_le(audio_crc, (const uint8_t *)samples, count * sizeof(int16_t));
+    frame_hashes[GOLDEN_AUDIO] = crc32_le(frame_hashes[GOLDEN_AUDIO], (const uint8_t *)samples, count * sizeof(int16_t));
+    audio_samples += count;
+    bench_phase(PHASE_SINK, start);
+}
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+/* Function: usage
+ * ---------------------
+ * Print the command line options.
+ */
+static void usage(const char *name){
+    fprintf(stderr,
+            "Usage: %s [options] <gb|gbc|nes|sms|gg> <game>\n"
+            "  -s <dir>    Copy of the SD card, the game is read from its console folder (default .)\n"
+            "  -n <frames> Frames to emulate, 0 runs the whole movie (default %i, or the movie)\n"
+            "  -m <file>   Movie to replay, recorded on the device\n"
+            "  -i <file>   Input script, lines of \"<frame> [start|select|up|down|left|right|a|b]...\"\n"
+            "  -g <file>   Compare the hashes of every frame with a golden file, exits with 2 if they differ\n"
+            "  -u          Write the golden file of -g instead of comparing it\n"
+            "  -a          Draw every frame, the device draws every other one\n"
+            "  -r          Take the rewind snapshots like the device and report their cost\n"
+            "  -t          Save and load the state after every frame, exits with 3 if saving it again differs\n",
+            name, DEFAULT_FRAMES);
+}
+
+/* Function: state_round_trip
+ * ---------------------
+ * Save the state, load it and save it again, both states must be the same.
+ * The first different byte is printed.
+ */
+static bool state_round_trip(const bench_core_t *core, uint8_t *first, uint8_t *second){
+    int size = core->state_size();
+    int length = core->state_save(first, size);
+
+    if(length <= 0 || !core->state_load(first, length)){
+        fprintf(stderr, "State: the save or the load failed\n");
+        return false;
+    }
+
+    int again = core->state_save(second, size);
+    if(again != length){
+        fprintf(stderr, "State: %i bytes saved, %i after the load\n", length, again);
+        return false;
+    }
+
+    for(int i = 0; i < length; i++){
+        if(first[i] != second[i]){
+            fprintf(stderr, "State: byte %i is %02x, %02x after the load\n", i, first[i], second[i]);
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,192 @@
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+#include <stddef.h>
+
+/*********************
+ *      DEFINES
+ *********************/
+
+// Parts of the frame time reported by the benchmark.
+#define PHASE_EMULATION     0   // CPU, video chip and the sound chips mixed by the core.
+#define PHASE_AUDIO         1   // Sound synthesis and mixing done by the platform layer.
+#define PHASE_INPUT         2   // Pad reading and movie replay.
+#define PHASE_SINK          3   // Hash of the frames and samples, the display and I2S work of the device.
+#define PHASE_MAX           4
+
+// Value of input_read() with all the buttons released, they are active low.
+#define INPUT_RELEASED      0xFFFF
+
+// Parts of the output hashed on every frame and checked against the golden file.
+#define GOLDEN_STATE        0   // Save state of the machine: CPU, memory and the video and sound chips.
+#define GOLDEN_VIDEO        1   // Frame buffer and palette, only on the drawn frames.
+#define GOLDEN_AUDIO        2   // Samples of the frame.
+#define GOLDEN_MAX          3
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+
+// Platform layer of an emulator core, it does the work of the manager of the device.
+typedef struct{
+    const char *name;
+    uint8_t refresh_rate;
+    // Load the ROM from the folder of the console, like the device. Returns 0 on success.
+    int (*load)(const char *game_name, uint8_t console);
+    // Emulate one frame, drawing it only if shown is set.
+    void (*frame)(int shown);
+    // In-RAM states for the movies, the same functions used by the rewind.
+    int (*state_size)(void);
+    int (*state_save)(void *buffer, int size);
+    _Bool (*state_load)(const void *buffer, int size);
+    // Counters of the core printed after the speed, it can be NULL.
+    void (*report)(void);
+}bench_core_t;
+
+// Folder with a copy of the SD card, it replaces its mount point on the paths.
+extern const char *sd_host_root;
+
+extern const bench_core_t bench_gnuboy;
+extern const bench_core_t bench_smsplus;
+extern const bench_core_t bench_nofrendo;
+
+/*********************
+ *      FUNCTIONS
+ *********************/
+
+/*
+ * Function:  bench_clock
+ * --------------------
+ *
+ * Returns: Nanoseconds of the monotonic clock.
+ *
+ */
+uint64_t bench_clock(void);
+
+/*
+ * Function:  bench_phase
+ * --------------------
+ *
+ * Add the time since start to one of the parts of the frame.
+ *
+ * Arguments:
+ *  -phase: One of the PHASE_ defines.
+ *  -start: Value of bench_clock() when the phase started.
+ *
+ * Returns: Nothing.
+ *
+ */
+void bench_phase(uint8_t phase, uint64_t start);
+
+/*
+ * Function:  bench_input
+ * --------------------
+ *
+ * Replacement of input_read(), call it where the manager of the emulator reads the pad.
+ *
+ * Returns: The buttons of the movie being replayed, or all of them released.
+ *
+ */
+uint16_t bench_input(void);
+
+/*
+ * Function:  bench_video
+ * --------------------
+ *
+ * In-memory display, the data of each shown frame is added to the video hash.
+ *
+ * Arguments:
+ *  -data: Frame buffer, or any other data which changes the image like the palette.
+ *  -size: Bytes of data.
+ *
+ * Returns: Nothing.
+ *
+ */
+void bench_video(const void *data, size_t size);
+
+/*
+ * Function:  bench_audio
+ * --------------------
+ *
+ * In-memory audio output, the samples of each frame are added to the audio hash.
+ *
+ * Arguments:
+ *  -samples: Samples generated on the frame.
+ *  -count: Number of samples.
+ *
+ * Returns: Nothing.
+ *
+ */
+void bench_audio(const int16_t *samples, size_t count);
+
+/*
+ * Function:  bench_golden_open
+ * --------------------
+ *
+ * Open the golden file with the hashes of every frame of a run. The first line describes
+ * the run, a file made with other options is rejected instead of reporting every frame.
+ *
+ * Arguments:
+ *  -path: Golden file.
+ *  -update: Write the hashes of this run instead of comparing them.
+ *  -header: Console, game, frames and options of the run.
+ *
+ * Returns: True on success.
+ *
+ */
+_Bool bench_golden_open(const char *path, _Bool update, const char *header);
+
+/*
+ * Function:  bench_golden_frame
+ * --------------------
+ *
+ * Write or compare the hashes of a frame.
+ *
+ * Arguments:
+ *  -frame: Number of the frame, from 0.
+ *  -hashes: CRC32 of each GOLDEN_ part of the output of the frame.
+ *
+ * Returns: Nothing.
+ *
+ */
+void bench_golden_frame(long frame, const uint32_t hashes[GOLDEN_MAX]);
+
+/*
+ * Function:  bench_golden_close
+ * --------------------
+ *
+ * Close the golden file and print the first frame each part of the output diverged on.
+ *
+ * Returns: Number of frames that don't match the golden file.
+ *
+ */
+long bench_golden_close(void);
+
+/*
+ * Function:  bench_script_load
+ * --------------------
+ *
+ * Load an input script, a text file with a frame number and the buttons held from that
+ * frame on each line, like "120 start" or "300 right a". A line without buttons releases
+ * them, the lines starting with # are comments.
+ *
+ * Arguments:
+ *  -path: Input script.
+ *
+ * Returns: True on success.
+ *
+ */
+_Bool bench_script_load(const char *path);
+
+/*
+ * Function:  bench_script_input
+ * --------------------
+ *
+ * Arguments:
+ *  -frame: Frame being emulated, from 0. The frames must not go backwards.
+ *
+ * Returns: Buttons of the script on that frame, all released without script.
+ *
+ */
+uint16_t bench_script_input(long frame);
@@ -0,0 +1,169 @@
+/*********************
+ *      INCLUDES
+ *********************/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "system_manager.h"
+#include "bench.h"
+
+// GNUBoy libraries
+
+#include <loader.h>
+#include <hw.h>
+#include <lcd.h>
+#include <fb.h>
+#include <cpu.h>
+#include <pcm.h>
+#include <regs.h>
+#include <mem.h>
+#include <rtc.h>
+#include <gnuboy.h>
+#include <sound.h>
+
+/*********************
+ *      DEFINES
+ *********************/
+
+#define AUDIO_SAMPLE_RATE (16000)
+
+/**********************
+ *  STATIC PROTOTYPES
+ **********************/
+static int gnuboy_load(const char *game_name, uint8_t console);
+static void gnuboy_frame(int shown);
+static void input_set();
+
+/**********************
+ *   GLOBAL VARIABLES
+ **********************/
+
+// Used by the core, defined by gnuboy_manager.c on the device.
+struct fb fb;
+struct pcm pcm;
+int frame = 0;
+
+uint16_t *displayBuffer[2];
+
+const bench_core_t bench_gnuboy = {
+    .name = "gnuboy",
+    .refresh_rate = 60,
+    .load = gnuboy_load,
+    .frame = gnuboy_frame,
+    .state_size = gbc_state_size,
+    .state_save = gbc_state_snapshot,
+    .state_load = gbc_state_restore,
+};
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+/* Function: gnuboy_load
+ * ---------------------
+ * Load the ROM and set up the emulator like gnuBoyTask(), with a single
+ * frame buffer and audio buffer, the sinks copy them straight away.
+ */
+static int gnuboy_load(const char *game_name, uint8_t console){
+    if(!gbc_rom_load(game_name, console)) return -1;
+
+    displayBuffer[0] = calloc(1, 160 * 144 * 2);
+    displayBuffer[1] = displayBuffer[0];
+
+    emu_reset();
+
+    //Set RTC configuration
+    rtc.d = 1;
+    rtc.h = 1;
+    rtc.m = 1;
+    rtc.s = 1;
+    rtc.t = 1;
+
+    // Emulator video configuration
+    memset(&fb, 0, sizeof(fb));
+    fb.w = 160;
+    fb.h = 144;
+    fb.pelsize = 2;
+    fb.pitch = fb.w * fb.pelsize;
+    fb.indexed = 0;
+    fb.ptr = (byte *)displayBuffer[0];
+    fb.enabled = 1;
+    fb.dirty = 0;
+
+    //Audio configuration
+    const int audioBufferLength = AUDIO_SAMPLE_RATE / 10 + 1;
+
+    memset(&pcm, 0, sizeof(pcm));
+    pcm.hz = AUDIO_SAMPLE_RATE;
+    pcm.stereo = 1;
+    pcm.len = audioBufferLength;
+    pcm.buf = calloc(audioBufferLength, sizeof(int16_t) * 2);
+    pcm.pos = 0;
+
+    gbc_sound_reset();
+
+    lcd_begin();
+
+    return 0;
+}
+
+/* Function: gnuboy_frame
+ * ---------------------
+ * Same steps as run_to_vblank() followed by input_set() on gnuBoyTask(),
+ * with the queues of the video and audio tasks replaced by the sinks.
+ */
+static void gnuboy_frame(int shown){
+    uint64_t start = bench_clock();
+
+    fb.enabled = shown;
+
+    cpu_emulate(32832);
+
+    while (R_LY > 0 && R_LY < 144) emu_step(); // Step through visible line scanning phase
+
+    rtc_tick();
+
+    bench_phase(PHASE_EMULATION, start);
+
+    if (fb.enabled) bench_video(fb.ptr, 160 * 144 * 2);
+
+    //Generate the sound for each frame
+    start = bench_clock();
+    sound_mix();
+    bench_phase(PHASE_AUDIO, start);
+
+    if (pcm.pos > 100){
+        bench_audio((const int16_t *)pcm.buf, pcm.pos);
+        pcm.pos = 0;
+    }
+
+    start = bench_clock();
+
+    if (!(R_LCDC & 0x80)) cpu_emulate(32832);
+
+    while (R_LY > 0) emu_step(); // Step through vblank phase
+
+    bench_phase(PHASE_EMULATION, start);
+
+    input_set();
+}
+
+/* Function: input_set
+ * ---------------------
+ * Same mapping of the buttons as gnuboy_manager.c.
+ */
+static void input_set(){
+    uint16_t inputs_value = bench_input();
+
+    pad_set(PAD_DOWN,!((inputs_value >> 3) & 0x01));
+    pad_set(PAD_LEFT,!((inputs_value >> 4) & 0x01));
+    pad_set(PAD_UP,!((inputs_value >> 2) & 0x01));
+    pad_set(PAD_RIGHT,!((inputs_value >> 5) & 0x01));
+    pad_set(PAD_B,!((inputs_value >> 7) & 0x01));
+    pad_set(PAD_A,!((inputs_value >> 6) & 0x01));
+    pad_set(PAD_START,!((inputs_value >> 0) & 0x01));
+    pad_set(PAD_SELECT,!((inputs_value >> 1) & 0x01));
+}
@@ -0,0 +1,153 @@
+/*********************
+ *      INCLUDES
+ *********************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "bench.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+#define LINE_MAX_LENGTH 512
+
+/**********************
+ *   STATIC VARIABLES
+ **********************/
+static FILE *golden = NULL;
+static bool update_golden = false;
+static bool golden_ended = false;
+
+static long frames = 0;
+static long diverged = 0;
+
+// First frame each part of the output diverged on, with the hashes of that frame.
+static long first_frame[GOLDEN_MAX];
+static uint32_t first_expected[GOLDEN_MAX];
+static uint32_t first_got[GOLDEN_MAX];
+
+static const char *part_names[GOLDEN_MAX] = {
+    "State",
+    "Video",
+    "Audio",
+};
+
+// What a difference on each part points to, the state diverges first when the core does.
+static const char *part_hints[GOLDEN_MAX] = {
+    "CPU core, memory or chip emulation",
+    "video chip rendering",
+    "sound synthesis or mixing",
+};
+
+/**********************
+ *   GLOBAL FUNCTIONS
+ **********************/
+
+bool bench_golden_open(const char *path, bool update, const char *header){
+    update_golden = update;
+    golden_ended = false;
+    frames = 0;
+    diverged = 0;
+    for(int i = 0; i < GOLDEN_MAX; i++) first_frame[i] = -1;
+
+    golden = fopen(path, update ? "w" : "r");
+    if(golden == NULL){
+        fprintf(stderr, "Error opening the golden file %s\n", path);
+        return false;
+    }
+
+    if(update){
+        fprintf(golden, "%s\n", header);
+        return true;
+    }
+
+    // Comparing a run with other options would report every frame.
+    char line[LINE_MAX_LENGTH];
+    if(fgets(line, sizeof(line), golden) == NULL) line[0] = '\0';
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if(strcmp(line, header)){
+        fprintf(stderr, "The golden file %s is from another run:\n  %s\nThis run:\n  %s\n", path, line, header);
+        fclose(golden);
+        golden = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void bench_golden_frame(long frame, const uint32_t hashes[GOLDEN_MAX]){
+    if(golden == NULL) return;
+    frames++;
+
+    if(update_golden){
+        fprintf(golden, "%li %08x %08x %08x\n", frame, hashes[GOLDEN_STATE], hashes[GOLDEN_VIDEO], hashes[GOLDEN_AUDIO]);
+        return;
+    }
+
+    long golden_frame = -1;
+    uint32_t expected[GOLDEN_MAX];
+
+    if(!golden_ended && fscanf(golden, "%li %x %x %x", &golden_frame, &expected[GOLDEN_STATE],
+                               &expected[GOLDEN_VIDEO], &expected[GOLDEN_AUDIO]) != 4){
+        golden_ended = true;
+    }
+
+    // A truncated file differs on every part.
+    if(golden_ended || golden_frame != frame){
+        golden_ended = true;
+        for(int i = 0; i < GOLDEN_MAX; i++) expected[i] = ~hashes[i];
+    }
+
+    bool differs = false;
+    for(int i = 0; i < GOLDEN_MAX; i++){
+        if(expected[i] == hashes[i]) continue;
+        differs = true;
+
+        if(first_frame[i] < 0){
+            first_frame[i] = frame;
+            first_expected[i] = expected[i];
+            first_got[i] = hashes[i];
+        }
+    }
+
+    if(differs) diverged++;
+}
+
+long bench_golden_close(void){
+    if(golden == NULL) return 0;
+
+    fclose(golden);
+    golden = NULL;
+
+    if(update_golden){
+        printf("Golden: %li frames written\n", frames);
+        return 0;
+    }
+
+    if(!diverged){
+        printf("Golden: all %li frames match\n", frames);
+        return 0;
+    }
+
+    // The part that diverged first is the one to look at, the others follow from it.
+    int first = -1;
+    for(int i = 0; i < GOLDEN_MAX; i++){
+        if(first_frame[i] >= 0 && (first < 0 || first_frame[i] < first_frame[first])) first = i;
+    }
+
+    printf("Golden: %li of %li frames differ, first on frame %li (%s: %s)\n", diverged, frames,
+           first_frame[first], part_names[first], part_hints[first]);
+    if(golden_ended) printf("  The golden file ends before the run\n");
+
+    for(int i = 0; i < GOLDEN_MAX; i++){
+        if(first_frame[i] < 0) printf("  %-6s matches\n", part_names[i]);
+        else printf("  %-6s differs from frame %li, expected %08x got %08x\n", part_names[i],
+                    first_frame[i], first_expected[i], first_got[i]);
+    }
+
+    return diverged;
+}
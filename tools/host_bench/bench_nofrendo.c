@@ -0,0 +1,295 @@
+/*********************
+ *      INCLUDES
+ *********************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <noftypes.h>
+#include "nes6502.h"
+#include <log.h>
+#include <osd.h>
+#include <nes.h>
+#include <nes_apu.h>
+#include <nes_ppu.h>
+#include <nesinput.h>
+#include <vid_drv.h>
+#include <event.h>
+#include <nofconfig.h>
+#include <nesstate.h>
+
+#include "sd_storage.h"
+#include "system_manager.h"
+#include "bench.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+#define DEFAULT_SAMPLERATE 16000
+
+// Mono samples generated by the APU on every emulated frame.
+#define AUDIO_FRAME_SAMPLES (DEFAULT_SAMPLERATE / NES_REFRESH_RATE)
+
+#define DEFAULT_WIDTH 240
+#define DEFAULT_HEIGHT 240
+
+#define  NES_CLOCK_DIVIDER    12
+#define  NES_MASTER_CLOCK     (236250000 / 11)
+#define  NES_FIQ_PERIOD       (NES_MASTER_CLOCK / NES_CLOCK_DIVIDER / 60)
+
+/**********************
+ *  STATIC PROTOTYPES
+ **********************/
+static int nofrendo_load(const char *game_name, uint8_t console);
+static void nofrendo_frame(int shown);
+static _Bool nofrendo_restore(const void *buffer, int size);
+
+static int init(int width, int height);
+static void shutdown(void);
+static int set_mode(int width, int height);
+static void clear(uint8 color);
+static void set_palette(rgb_t *pal);
+static void custom_blit(bitmap_t *bmp, int num_dirties, rect_t *dirty_rects);
+static bitmap_t *lock_write(void);
+static void free_write(int num_dirties, rect_t *dirty_rects);
+
+/**********************
+ *   STATIC VARIABLES
+ **********************/
+static nes_t *nes;
+static char *data = NULL;
+
+static void (*audio_callback)(void *buffer, int length) = NULL;
+static int16_t audio_frame[AUDIO_FRAME_SAMPLES];
+
+static uint16 myPalette[256];
+static char fb[1]; //dummy
+static bitmap_t *myBitmap = NULL;
+// Only the frames drawn by the loop go to the sink.
+static int blit_frame = 0;
+
+static viddriver_t benchDriver =
+	{
+		"In-memory frame sink",     // name
+		init,						// init
+		shutdown,					// shutdown
+		set_mode,					// set_mode
+		set_palette,				// set_palette
+		clear,						// clear
+		lock_write,					// lock_write
+		free_write,					// free_write
+		custom_blit,				// custom_blit
+		false						// invalidate flag
+};
+
+/**********************
+ *   GLOBAL VARIABLES
+ **********************/
+
+const bench_core_t bench_nofrendo = {
+    .name = "nofrendo",
+    .refresh_rate = NES_REFRESH_RATE,
+    .load = nofrendo_load,
+    .frame = nofrendo_frame,
+    .state_size = state_size,
+    .state_save = state_save_mem,
+    .state_load = nofrendo_restore,
+};
+
+/**********************
+ *   GLOBAL FUNCTIONS
+ **********************/
+
+bitmap_t *__real_bmp_create(int width, int height, int overdraw);
+
+// _make_bitmap() aligns the first line of the bitmaps through a uint32 cast, which
+// truncates the pointer on a 64 bit host. The line pointers are made again from the
+// full one, the same values the ESP32 gets.
+bitmap_t *__wrap_bmp_create(int width, int height, int overdraw){
+    bitmap_t *bitmap = __real_bmp_create(width, height, overdraw);
+    if(bitmap == NULL) return NULL;
+
+    bitmap->line[0] = (uint8 *)(((uintptr_t)bitmap->data + overdraw + 3) & ~(uintptr_t)3);
+    for(int i = 1; i < height; i++) bitmap->line[i] = bitmap->line[i - 1] + bitmap->pitch;
+
+    return bitmap;
+}
+
+char *osd_getromdata() {
+    return data;
+}
+
+void osd_getvideoinfo(vidinfo_t *info){
+	info->default_width = DEFAULT_WIDTH;
+	info->default_height = DEFAULT_HEIGHT;
+	info->driver = &benchDriver;
+}
+
+void osd_setsound(void (*playfunc)(void *buffer, int length)){
+	audio_callback = playfunc;
+}
+
+void osd_getsoundinfo(sndinfo_t *info){
+	info->sample_rate = DEFAULT_SAMPLERATE;
+	info->bps = 16;
+}
+
+// The frames are paced by the benchmark, there isn't a timer.
+int osd_installtimer(int frequency, void *func){
+	return 0;
+}
+
+void osd_getinput(void)
+{
+	uint16_t b = bench_input();
+
+	const int ev[16] = {
+        event_joypad1_start, event_joypad1_select, event_joypad1_up, event_joypad1_down, event_joypad1_left, event_joypad1_right, event_joypad1_a, event_joypad1_b,
+		0, 0, 0, 0, 0, 0, 0, 0
+        };
+	static int oldb = 0xffff;
+	int chg = b ^ oldb;
+	int x;
+	oldb = b;
+	event_t evh;
+
+	for (x = 0; x < 16; x++)
+	{
+		if (chg & 1)
+		{
+			evh = event_get(ev[x]);
+			if (evh)
+				evh((b & 1) ? INP_STATE_BREAK : INP_STATE_MAKE);
+		}
+		chg >>= 1;
+		b >>= 1;
+	}
+}
+
+void osd_shutdown(){
+	audio_callback = NULL;
+}
+
+int osd_init(){
+    return 0;
+}
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+/* Function: nofrendo_load
+ * ---------------------
+ * Load the ROM and create the machine like nofrendoTask(), including the
+ * frames it emulates before the loop.
+ */
+static int nofrendo_load(const char *game_name, uint8_t console){
+    char game_route[256];
+	sprintf(game_route,"/sdcard/NES/%s",game_name);
+
+	data = sd_load_file(game_route,0,0,NULL);
+	if(data == NULL) return -1;
+
+    if (log_init()) return -1;
+
+    event_init();
+
+    vidinfo_t video;
+
+    if (config.open()) return -1;
+
+    if (osd_init()) return -1;
+
+    osd_getvideoinfo(&video);
+    if (vid_init(video.default_width, video.default_height, video.driver)) return -1;
+
+    /* set up the event system for this system type */
+    event_set_system(system_nes);
+
+    nes = nes_create();
+    if (NULL == nes) return -1;
+
+    if (nes_insertcart("foo",nes)) return -1;
+
+    // The PPU draws all the scanlines, a NES_VISIBLE_HEIGHT bitmap like the
+    // device one has no line pointers for the last ones.
+    vid_setmode(NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT);
+
+    osd_setsound(nes->apu->process);
+
+    nes->scanline_cycles = 0;
+    nes->fiq_cycles = (int) NES_FIQ_PERIOD;
+
+    for (int i = 0; i < 4; ++i){
+        nes_renderframe(1);
+        system_video(1);
+    }
+
+    return 0;
+}
+
+/* Function: nofrendo_frame
+ * ---------------------
+ * Same steps as the loop of nofrendoTask(), the APU synthesis of
+ * do_audio_frame() is timed as audio.
+ */
+static void nofrendo_frame(int shown){
+    uint64_t start = bench_clock();
+    nes_renderframe(shown);
+    bench_phase(PHASE_EMULATION, start);
+
+    // Blits the frame to the sink and reads the input.
+    blit_frame = shown;
+    system_video(shown);
+
+    start = bench_clock();
+    audio_callback(audio_frame, AUDIO_FRAME_SAMPLES);
+    bench_phase(PHASE_AUDIO, start);
+
+    bench_audio(audio_frame, AUDIO_FRAME_SAMPLES);
+}
+
+/* Function: nofrendo_restore
+ * ---------------------
+ * Restore a movie snapshot, they use the same SNSS format as the save files.
+ */
+static _Bool nofrendo_restore(const void *buffer, int size){
+    return state_load_mem((void *)buffer, size) == 0;
+}
+
+static int init(int width, int height){
+	return 0;
+}
+
+static void shutdown(void){}
+
+static int set_mode(int width, int height){
+	return 0;
+}
+
+static void clear(uint8 color){}
+
+static void set_palette(rgb_t *pal){
+	uint16 c;
+	for (int i = 0; i < 256; i++){
+		c=(pal[i].b>>3)+((pal[i].g>>2)<<5)+((pal[i].r>>3)<<11);
+        myPalette[i]=(c>>8)|((c&0xff)<<8);
+	}
+}
+
+// vid_findmode() logs the size of the surface after releasing it, so the
+// bitmap is kept for the whole run instead of being made on every lock.
+static bitmap_t *lock_write(void){
+	if(myBitmap == NULL) myBitmap = bmp_createhw((uint8 *)fb, DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_WIDTH * 2);
+	return myBitmap;
+}
+
+static void free_write(int num_dirties, rect_t *dirty_rects){}
+
+static void custom_blit(bitmap_t *bmp, int num_dirties, rect_t *dirty_rects){
+	if(!blit_frame) return;
+	bench_video(myPalette, sizeof(myPalette));
+	for (int y = 0; y < bmp->height; y++) bench_video(bmp->line[y], bmp->width);
+}
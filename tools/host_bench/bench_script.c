@@ -0,0 +1,123 @@
+/*********************
+ *      INCLUDES
+ *********************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "bench.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+#define LINE_MAX_LENGTH 256
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+
+// Buttons held from a frame until the next step.
+typedef struct{
+    long frame;
+    uint16_t input;
+}script_step_t;
+
+/**********************
+ *  STATIC PROTOTYPES
+ **********************/
+static int button_bit(const char *name);
+
+/**********************
+ *   STATIC VARIABLES
+ **********************/
+static script_step_t *steps = NULL;
+static int step_count = 0;
+static int current_step = -1;
+
+// Same bits as input_read(), the emulators map them to the pad of each console.
+static const char *button_names[] = {"start", "select", "up", "down", "left", "right", "a", "b"};
+
+/**********************
+ *   GLOBAL FUNCTIONS
+ **********************/
+
+bool bench_script_load(const char *path){
+    FILE *file = fopen(path, "r");
+    if(file == NULL){
+        fprintf(stderr, "Error opening the input script %s\n", path);
+        return false;
+    }
+
+    char line[LINE_MAX_LENGTH];
+    int line_number = 0;
+    int allocated = 0;
+
+    while(fgets(line, sizeof(line), file) != NULL){
+        line_number++;
+
+        char *token = strtok(line, " \t\r\n");
+        if(token == NULL || token[0] == '#') continue;
+
+        char *end;
+        long frame = strtol(token, &end, 10);
+        if(*end != '\0' || frame < 0 || (step_count && frame <= steps[step_count - 1].frame)){
+            fprintf(stderr, "%s:%i: the frames have to go up\n", path, line_number);
+            fclose(file);
+            return false;
+        }
+
+        uint16_t input = INPUT_RELEASED;
+        while((token = strtok(NULL, " \t\r\n")) != NULL){
+            int bit = button_bit(token);
+            if(bit < 0){
+                fprintf(stderr, "%s:%i: unknown button %s\n", path, line_number, token);
+                fclose(file);
+                return false;
+            }
+            // The buttons are active low.
+            input &= ~(1 << bit);
+        }
+
+        if(step_count == allocated){
+            allocated = allocated ? allocated * 2 : 64;
+            steps = realloc(steps, allocated * sizeof(script_step_t));
+            if(steps == NULL){
+                fprintf(stderr, "Not enough memory for the input script\n");
+                fclose(file);
+                return false;
+            }
+        }
+
+        steps[step_count].frame = frame;
+        steps[step_count].input = input;
+        step_count++;
+    }
+
+    fclose(file);
+    return true;
+}
+
+uint16_t bench_script_input(long frame){
+    while(current_step + 1 < step_count && steps[current_step + 1].frame <= frame) current_step++;
+
+    if(current_step < 0) return INPUT_RELEASED;
+    return steps[current_step].input;
+}
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+/* Function: button_bit
+ * ---------------------
+ * Bit of a button on the value of input_read(), -1 if the name is unknown.
+ */
+static int button_bit(const char *name){
+    for(int i = 0; i < sizeof(button_names) / sizeof(button_names[0]); i++){
+        if(!strcmp(name, button_names[i])) return i;
+    }
+    return -1;
+}
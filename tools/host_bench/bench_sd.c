@@ -0,0 +1,207 @@
+/*********************
+ *      INCLUDES
+ *********************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp32/rom/crc.h"
+
+#include "sd_storage.h"
+#include "bench.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+#define MOUNT_POINT     "/sdcard/"
+
+// Header of the save data files, "SAVD", the same format as the device.
+#define SAVE_MAGIC      0x44564153
+#define SAVE_VERSION    1
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t size;
+    uint32_t crc;       // CRC32 of the data after the header.
+}sd_save_header_t;
+
+// The whole ROM is on RAM, the banks are pointers into it.
+struct sd_bank_cache{
+    uint8_t *data;
+    size_t bank_size;
+};
+
+/**********************
+ *  STATIC PROTOTYPES
+ **********************/
+static const char * host_path(const char *path, char *buffer, size_t size);
+
+/**********************
+ *   STATIC VARIABLES
+ **********************/
+static const char *TAG = "sd_host";
+
+/**********************
+ *   GLOBAL VARIABLES
+ **********************/
+const char *sd_host_root = ".";
+
+/**********************
+ *   GLOBAL FUNCTIONS
+ **********************/
+
+size_t sd_file_size(const char *path){
+    char buffer[1024];
+    struct stat st;
+
+    if(stat(host_path(path, buffer, sizeof(buffer)), &st) != 0) return 0;
+    return st.st_size;
+}
+
+void * sd_load_file(const char *path, size_t offset, size_t min_size, size_t *size){
+    char buffer[1024];
+    const char *file_path = host_path(path, buffer, sizeof(buffer));
+
+    FILE *f = fopen(file_path, "rb");
+    if(f == NULL){
+        ESP_LOGE(TAG, "Error opening: %s", file_path);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long file_size = ftell(f);
+    if(file_size < (long)offset) file_size = offset;
+    size_t length = file_size - offset;
+
+    uint8_t *data = calloc(1, length > min_size ? length : min_size);
+    if(data == NULL){
+        fclose(f);
+        return NULL;
+    }
+
+    fseek(f, offset, SEEK_SET);
+    if(fread(data, 1, length, f) != length){
+        ESP_LOGE(TAG, "Error reading: %s", file_path);
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+    fclose(f);
+
+    if(size != NULL) *size = length;
+    return data;
+}
+
+char * sd_get_file_flash(const char *path){
+    return sd_load_file(path, 0, 0, NULL);
+}
+
+sd_bank_cache_t * sd_bank_cache_open(const char *path, size_t bank_size, uint16_t slots){
+    sd_bank_cache_t *cache = malloc(sizeof(sd_bank_cache_t));
+    if(cache == NULL) return NULL;
+
+    cache->data = sd_load_file(path, 0, bank_size, NULL);
+    cache->bank_size = bank_size;
+    if(cache->data == NULL){
+        free(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+uint8_t * sd_bank_cache_get(sd_bank_cache_t *cache, uint16_t bank){
+    return cache->data + bank * cache->bank_size;
+}
+
+void sd_bank_cache_close(sd_bank_cache_t *cache){
+    if(cache == NULL) return;
+    free(cache->data);
+    free(cache);
+}
+
+bool sd_save_write(const char *path, void *data, size_t size){
+    char buffer[1024];
+    const char *file_path = host_path(path, buffer, sizeof(buffer));
+
+    sd_save_header_t header = {
+        .magic = SAVE_MAGIC,
+        .version = SAVE_VERSION,
+        .size = size,
+        .crc = crc32_le(0, data, size),
+    };
+
+    FILE *f = fopen(file_path, "wb");
+    if(f == NULL){
+        ESP_LOGE(TAG, "Error creating: %s", file_path);
+        return false;
+    }
+
+    bool r = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(data, 1, size, f) == size;
+    fclose(f);
+
+    // Written synchronously, the data is owned by this function like on the device.
+    if(r) free(data);
+    else ESP_LOGE(TAG, "Error writing: %s", file_path);
+    return r;
+}
+
+void * sd_save_read(const char *path, size_t *size){
+    size_t file_size = 0;
+
+    if(sd_file_size(path) == 0) return NULL;
+
+    uint8_t *data = sd_load_file(path, 0, 0, &file_size);
+    if(data == NULL) return NULL;
+
+    sd_save_header_t header;
+    if(file_size >= sizeof(header)) memcpy(&header, data, sizeof(header));
+    else header.magic = 0;
+
+    // The saves before this format didn't have a header.
+    if(header.magic != SAVE_MAGIC){
+        *size = file_size;
+        return data;
+    }
+
+    if(header.version != SAVE_VERSION || header.size != file_size - sizeof(header)
+       || crc32_le(0, data + sizeof(header), header.size) != header.crc){
+        ESP_LOGE(TAG, "Corrupted save data: %s", path);
+        free(data);
+        return NULL;
+    }
+
+    memmove(data, data + sizeof(header), header.size);
+    *size = header.size;
+    return data;
+}
+
+void sd_save_sync(){
+}
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+/* Function: host_path
+ * ---------------------
+ * Replace the mount point of the SD card with the host folder, other
+ * paths are used as they are.
+ */
+static const char * host_path(const char *path, char *buffer, size_t size){
+    size_t mount = strlen(MOUNT_POINT);
+    if(strncmp(path, MOUNT_POINT, mount) != 0) return path;
+
+    snprintf(buffer, size, "%s/%s", sd_host_root, path + mount);
+    return buffer;
+}
@@ -0,0 +1,202 @@
+/*********************
+ *      INCLUDES
+ *********************/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "system_manager.h"
+#include "bench.h"
+
+#include "shared.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+#define AUDIO_SAMPLE_RATE (16000)
+
+#define SMS_FRAME_WIDTH 256
+#define SMS_FRAME_HEIGHT 192
+
+#define GG_FRAME_WIDTH 160
+#define GG_FRAME_HEIGHT 144
+
+/**********************
+ *  STATIC PROTOTYPES
+ **********************/
+static int smsplus_load(const char *game_name, uint8_t console);
+static void smsplus_frame(int shown);
+static int smsplus_save(void *buffer, int size);
+static bool smsplus_restore(const void *buffer, int size);
+static void input_set();
+#if RENDER_BENCHMARK
+static void smsplus_report(void);
+#endif
+
+/**********************
+ *   STATIC VARIABLES
+ **********************/
+static uint16 color[PALETTE_SIZE];
+static int16_t *audioBuffer[2];
+static uint8_t audioBuffer_num = 0;
+static int16_t *fmBuffer;
+
+/**********************
+ *   GLOBAL VARIABLES
+ **********************/
+
+const bench_core_t bench_smsplus = {
+    .name = "smsplus",
+    .refresh_rate = 60,
+    .load = smsplus_load,
+    .frame = smsplus_frame,
+    .state_size = system_state_size,
+    .state_save = smsplus_save,
+    .state_load = smsplus_restore,
+#if RENDER_BENCHMARK
+    .report = smsplus_report,
+#endif
+};
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+/* Function: smsplus_load
+ * ---------------------
+ * Load the ROM and set up the emulator like SMSTask(), with a single
+ * frame buffer, the sinks copy it straight away.
+ */
+static int smsplus_load(const char *game_name, uint8_t console){
+    bool game_gear = console == GG;
+
+    if(!load_rom((char *)game_name, console)) return -1;
+
+    //Game Gear only renders its visible viewport, so its frame buffers are smaller.
+    bitmap.width = game_gear ? GG_FRAME_WIDTH : SMS_FRAME_WIDTH;
+    bitmap.height = game_gear ? GG_FRAME_HEIGHT : SMS_FRAME_HEIGHT;
+    bitmap.pitch = bitmap.width;
+    bitmap.data = calloc(1, bitmap.width * bitmap.height);
+
+    set_option_defaults();
+
+    option.sndrate = AUDIO_SAMPLE_RATE;
+    option.overscan = 0;
+    option.extra_gg = 0;
+    option.bilinear = 0;
+    option.aspect = 0;
+
+    //Only the Master System had the YM2413 FM unit.
+    option.fm = game_gear ? SND_NONE : SND_EMU2413;
+    sms.use_fm = (option.fm != SND_NONE);
+
+    system_init2();
+    system_reset();
+
+    audioBuffer[0] = calloc(snd.sample_count * 2, sizeof(int16_t));
+    audioBuffer[1] = calloc(snd.sample_count * 2, sizeof(int16_t));
+    if(sms.use_fm) fmBuffer = calloc(snd.sample_count, sizeof(int16_t));
+
+    return 0;
+}
+
+/* Function: smsplus_frame
+ * ---------------------
+ * Same steps as the loop of SMSTask(), with the YM2413 synthesis of the
+ * audio task done right after the frame.
+ */
+static void smsplus_frame(int shown){
+    input_set();
+
+    // The smsplus mixer writes the gain applied stereo frames straight into the audio buffer.
+    snd.output = audioBuffer[audioBuffer_num];
+    snd.gain = 256;
+
+    uint64_t start = bench_clock();
+    system_frame(!shown);
+    bench_phase(PHASE_EMULATION, start);
+
+    if(shown){
+        render_copy_palette(color);
+        bench_video(bitmap.data, bitmap.width * bitmap.height);
+        bench_video(color, sizeof(color));
+    }
+
+    if(sms.use_fm){
+        // Synthesize the YM2413 from the register log of this frame and mix it with the PSG.
+        start = bench_clock();
+
+        FM_Render(audioBuffer_num, fmBuffer, snd.sample_count);
+
+        int16_t *sample = audioBuffer[audioBuffer_num];
+        for(int x = 0; x < snd.sample_count * 2; x++){
+            int32_t mix = sample[x] + ((fmBuffer[x >> 1] * snd.gain) >> 8);
+
+            if(mix > 32767) mix = 32767;
+            else if(mix < -32768) mix = -32768;
+            sample[x] = mix;
+        }
+
+        bench_phase(PHASE_AUDIO, start);
+    }
+
+    bench_audio(audioBuffer[audioBuffer_num], snd.sample_count * 2);
+
+    audioBuffer_num = audioBuffer_num ? 0 : 1;
+    FM_LogSelect(audioBuffer_num);
+}
+
+/* Function: smsplus_save
+ * ---------------------
+ * Movie snapshots use the same format as the save files, the buffer
+ * always holds system_state_size() bytes.
+ */
+static int smsplus_save(void *buffer, int size){
+    return system_save_state(buffer);
+}
+
+/* Function: smsplus_restore
+ * ---------------------
+ * Restore a movie snapshot.
+ */
+static bool smsplus_restore(const void *buffer, int size){
+    return system_load_state(buffer, size) == 0;
+}
+
+/* Function: input_set
+ * ---------------------
+ * Same mapping of the buttons as SMS_manager.c.
+ */
+static void input_set(){
+    int smsButtons = 0;
+    int smsSystem = 0;
+
+    uint16_t inputs_value = bench_input();
+
+    if(!((inputs_value >> 3) & 0x01))  smsButtons |= INPUT_DOWN;
+    if(!((inputs_value >> 4) & 0x01))  smsButtons |= INPUT_LEFT;
+    if(!((inputs_value >> 2) & 0x01))  smsButtons |= INPUT_UP;
+    if(!((inputs_value >> 5) & 0x01))  smsButtons |= INPUT_RIGHT;
+    if(!((inputs_value >> 6) & 0x01))  smsButtons |= INPUT_BUTTON1;
+    if(!((inputs_value >> 7) & 0x01))  smsButtons |= INPUT_BUTTON2;
+
+    if(!((inputs_value >> 0) & 0x01))  smsSystem |= INPUT_START;
+    if(!((inputs_value >> 1) & 0x01))  smsSystem |= INPUT_PAUSE;
+
+    input.pad[0] = smsButtons;
+    input.system = smsSystem;
+}
+
+#if RENDER_BENCHMARK
+/* Function: smsplus_report
+ * ---------------------
+ * Average time of render_line(), the clock of the host counts nanoseconds
+ * instead of CPU cycles.
+ */
+static void smsplus_report(void){
+    if(render_line_count) printf("Render line: %u ns, %u lines\n", render_line_cycles / render_line_count, render_line_count);
+}
+#endif
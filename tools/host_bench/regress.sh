@@ -0,0 +1,103 @@
+#!/bin/sh
+#
+# Regression check of the emulator cores against golden hashes.
+#
+# Every game of a copy of the SD card is run for a fixed number of frames, drawing all of
+# them, and the hashes of the state, video and audio of each frame are compared with the
+# golden files made before the change. The input of a game comes from the files next to
+# its save data: "<game>.mov", a movie recorded on the device, and "<game>.input", an
+# input script (see ./host_bench -h). Without them the buttons are released.
+#
+#   ./regress.sh -u <sd-card-copy>     write the golden files, before the change
+#   ./regress.sh <sd-card-copy>        compare with them, after the change
+#
+# Options:
+#   -n <frames>   Frames of each game (default 1800)
+#   -g <dir>      Folder of the golden files (default <sd-card-copy>/Golden)
+#   -t            Save and load the state after every frame, the games must still match
+#                 their golden files (see -t of ./host_bench). The NES games are left
+#                 out, the SNSS states of nofrendo don't hold the whole machine.
+#
+
+BENCH="$(dirname "$0")/host_bench"
+FRAMES=1800
+GOLDEN=""
+UPDATE=""
+ROUND_TRIP=""
+
+while getopts "n:g:ut" opt; do
+    case $opt in
+        n) FRAMES=$OPTARG ;;
+        g) GOLDEN=$OPTARG ;;
+        u) UPDATE="-u" ;;
+        t) ROUND_TRIP="-t" ;;
+        *) sed -n '2,/^$/s/^# \{0,1\}//p' "$0"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -ne 1 ]; then
+    sed -n '2,/^$/s/^# \{0,1\}//p' "$0"
+    exit 1
+fi
+
+SD=$1
+[ -n "$GOLDEN" ] || GOLDEN="$SD/Golden"
+
+if [ ! -x "$BENCH" ]; then
+    echo "Build the benchmark first with make"
+    exit 1
+fi
+
+passed=0
+failed=0
+
+# Folders of the SD card and the console of their games, like the device.
+for entry in GameBoy:gb GameBoy_Color:gbc NES:nes Master_System:sms Game_Gear:gg; do
+    folder=${entry%%:*}
+    console=${entry#*:}
+
+    [ -d "$SD/$folder" ] || continue
+
+    [ -n "$ROUND_TRIP" ] && [ "$console" = nes ] && continue
+
+    for rom in "$SD/$folder"/*; do
+        [ -f "$rom" ] || continue
+        game=$(basename "$rom")
+
+        golden="$GOLDEN/$folder/$game.golden"
+        movie="$SD/$folder/Save_Data/$game.mov"
+        script="$SD/$folder/Save_Data/$game.input"
+
+        # The names of the games have spaces, the options are kept as arguments.
+        set -- -a -n "$FRAMES" -s "$SD" -g "$golden" $UPDATE $ROUND_TRIP
+        [ -f "$movie" ] && set -- "$@" -m "$movie"
+        [ -f "$script" ] && set -- "$@" -i "$script"
+
+        if [ -n "$UPDATE" ]; then
+            mkdir -p "$GOLDEN/$folder"
+        elif [ ! -f "$golden" ]; then
+            echo "NO GOLDEN $console $game"
+            failed=$((failed + 1))
+            continue
+        fi
+
+        output=$("$BENCH" "$@" "$console" "$game" 2>&1)
+        status=$?
+
+        # The golden report tells the first frame and part of the output that diverged.
+        case $status in
+            0) echo "OK       $console $game"
+               passed=$((passed + 1)) ;;
+            2) echo "DIFFERS  $console $game"
+               echo "$output" | grep -A4 "^Golden:" | sed 's/^/    /'
+               failed=$((failed + 1)) ;;
+            *) echo "ERROR    $console $game"
+               echo "$output" | tail -n 4 | sed 's/^/    /'
+               failed=$((failed + 1)) ;;
+        esac
+    done
+done
+
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]
@@ -0,0 +1,20 @@
+/* Host build: table driven version of the CRC32 of the ESP32 ROM. */
+#pragma once
+
+#include <stdint.h>
+
+static inline uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len){
+    static uint32_t table[256];
+
+    if(table[1] == 0){
+        for(uint32_t i = 0; i < 256; i++){
+            uint32_t c = i;
+            for(int k = 0; k < 8; k++) c = (c >> 1) ^ (0xEDB88320 & -(c & 1));
+            table[i] = c;
+        }
+    }
+
+    crc = ~crc;
+    while(len--) crc = (crc >> 8) ^ table[(crc ^ *buf++) & 0xFF];
+    return ~crc;
+}
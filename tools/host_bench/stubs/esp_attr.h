@@ -0,0 +1,7 @@
+/* Host build: the memory placement attributes of the ESP32 have no effect. */
+#pragma once
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define EXT_RAM_ATTR
+#define WORD_ALIGNED_ATTR __attribute__((aligned(4)))
@@ -0,0 +1,13 @@
+/* Host build: there is no flash, the ROMs are always loaded on RAM. */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int esp_err_t;
+
+typedef struct{
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+}esp_partition_t;
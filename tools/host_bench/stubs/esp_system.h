@@ -0,0 +1,6 @@
+/* Host build: only what the emulator cores use. */
+#pragma once
+
+#include <stdint.h>
+
+static inline uint32_t esp_get_free_heap_size(void){ return 4 * 1024 * 1024; }
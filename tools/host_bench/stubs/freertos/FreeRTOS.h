@@ -0,0 +1,16 @@
+/* Host build: the emulator cores only use the cycle counter of the Xtensa HAL. */
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include "sdkconfig.h"
+
+typedef void * QueueHandle_t;
+
+// Nanoseconds instead of CPU cycles, the cores only use it for their benchmark counters.
+static inline uint32_t xthal_get_ccount(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
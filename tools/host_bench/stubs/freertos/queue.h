@@ -0,0 +1,4 @@
+/* Host build: included by system_manager.h, the handles are defined in FreeRTOS.h. */
+#pragma once
+
+#include "freertos/FreeRTOS.h"
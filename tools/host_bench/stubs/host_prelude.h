@@ -0,0 +1,11 @@
+/* Host build: included before every source file.
+ * ESP-IDF makes stdint.h and the memory attributes visible everywhere. The cores use
+ * two Xtensa instructions: memw for the PSRAM workaround, which is empty on the host,
+ * and the breakpoint of the nofrendo asserts, which traps. */
+#pragma once
+
+#include <stdint.h>
+#include "esp_attr.h"
+
+__asm__(".macro memw\n.endm\n"
+        ".macro break.n code\nud2\n.endm");
@@ -0,0 +1,4 @@
+/* Host build: the options of the sdkconfig used by the emulator cores. */
+#pragma once
+
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ 240
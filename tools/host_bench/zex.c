@@ -0,0 +1,162 @@
+/*********************
+ *      INCLUDES
+ *********************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shared.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+// CP/M programs are loaded on the TPA, after the zero page.
+#define TPA_ADDRESS     0x0100
+// The BDOS is a port write followed by a RET, its address is also the top of the stack.
+#define BDOS_ADDRESS    0xFE00
+#define PORT_BDOS       0xFF
+#define PORT_EXIT       0xFE
+
+// T-states executed between the checks of the exit flag.
+#define SLICE_CYCLES    100000
+
+// Cycles left of the current z80_execute(), a port write ends the slice by clearing it.
+extern int z80_ICount;
+
+/**********************
+ *  STATIC PROTOTYPES
+ **********************/
+static void zex_writeport(uint16 port, uint8 data);
+static uint8 zex_readport(uint16 port);
+static int zex_irq_callback(int irqline);
+static void zex_putc(char c);
+
+/**********************
+ *   STATIC VARIABLES
+ **********************/
+static uint8 memory[0x10000];
+static bool finished = false;
+static int errors = 0;
+
+// Last characters printed, to count the failed tests on the output.
+static char tail[6];
+
+/**********************
+ *   GLOBAL FUNCTIONS
+ **********************/
+
+/*
+ * Instruction exerciser of the smsplus Z80 core.
+ *
+ * Runs a CP/M program like zexdoc.com or zexall.com on the core with a minimal BDOS that
+ * only prints characters (functions 2 and 9). The exercisers are not shipped with the
+ * firmware, zexdoc.com and zexall.com come with the source archive of the YAZE-AG emulator.
+ * The program is built twice: ./zex_inline has the prefixed opcodes inlined on the big
+ * switch like the firmware, ./zex_table has them on the function tables (BIG_SWITCH_PREFIX 0).
+ *
+ *   ./zex_inline zexdoc.com
+ *   make zexcheck ZEX=<folder with zexdoc.com and zexall.com>
+ *
+ * Every test prints its name followed by OK or ERROR and the program ends with
+ * "Tests complete", zexcheck also compares the output of both builds.
+ * The exit status is 0 when every test passed, 2 when any of them printed ERROR and 1
+ * when the program couldn't be run.
+ */
+int main(int argc, char **argv){
+    if(argc != 2){
+        fprintf(stderr, "Usage: %s <program.com>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if(file == NULL){
+        fprintf(stderr, "Error opening %s\n", argv[1]);
+        return 1;
+    }
+    size_t size = fread(&memory[TPA_ADDRESS], 1, BDOS_ADDRESS - TPA_ADDRESS, file);
+    fclose(file);
+    if(size == 0){
+        fprintf(stderr, "Empty program %s\n", argv[1]);
+        return 1;
+    }
+
+    // Warm boot: OUT (PORT_EXIT),A; HALT
+    memory[0x0000] = 0xD3;
+    memory[0x0001] = PORT_EXIT;
+    memory[0x0002] = 0x76;
+    // BDOS call: JP BDOS_ADDRESS, the programs take the top of the stack from it.
+    memory[0x0005] = 0xC3;
+    memory[0x0006] = BDOS_ADDRESS & 0xFF;
+    memory[0x0007] = BDOS_ADDRESS >> 8;
+    // OUT (PORT_BDOS),A; RET
+    memory[BDOS_ADDRESS] = 0xD3;
+    memory[BDOS_ADDRESS + 1] = PORT_BDOS;
+    memory[BDOS_ADDRESS + 2] = 0xC9;
+
+    // All the pages are RAM, the writes go through the write map like the SMS RAM.
+    for(int i = 0; i < 64; i++){
+        cpu_readmap[i] = &memory[i << 10];
+        cpu_writemap[i] = &memory[i << 10];
+        cpu_writetrap[i] = 0;
+    }
+    cpu_writeport16 = zex_writeport;
+    cpu_readport16 = zex_readport;
+
+    z80_init(0, 3579545, NULL, zex_irq_callback);
+    z80_reset();
+    Z80.pc.d = TPA_ADDRESS;
+    Z80.sp.d = BDOS_ADDRESS;
+
+    clock_t start = clock();
+    unsigned long long cycles = 0;
+    while(!finished) cycles += z80_execute(SLICE_CYCLES);
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("\n%llu T-states in %.2f s, %.1f MHz\n", cycles, seconds, cycles / seconds / 1e6);
+    printf("%i errors\n", errors);
+
+    return errors ? 2 : 0;
+}
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+/* Function: zex_writeport
+ * ---------------------
+ * BDOS functions and the warm boot, the function number is on C.
+ */
+static void zex_writeport(uint16 port, uint8 data){
+    if((port & 0xFF) == PORT_EXIT){
+        finished = true;
+        z80_ICount = 0;
+    }
+    else if((port & 0xFF) == PORT_BDOS){
+        if(Z80.bc.b.l == 2){
+            zex_putc(Z80.de.b.l);
+        }
+        else if(Z80.bc.b.l == 9){
+            for(uint16 address = Z80.de.w.l; memory[address] != '$'; address++) zex_putc(memory[address]);
+        }
+    }
+}
+
+static uint8 zex_readport(uint16 port){
+    return 0xFF;
+}
+
+static int zex_irq_callback(int irqline){
+    return 0xFF;
+}
+
+static void zex_putc(char c){
+    putchar(c);
+    fflush(stdout);
+
+    memmove(tail, tail + 1, sizeof(tail) - 2);
+    tail[sizeof(tail) - 2] = c;
+    if(strcmp(tail, "ERROR") == 0) errors++;
+}